@@ -57,787 +57,26 @@ extern "C" {
 #endif
 }
 
-#include <queue>
 #include <string.h>
 
-#define AVPKT_BUFFER_SIZE (KILOBYTE(256))
+#include "kernels.h"
+#include "audioparser.h"
 
-class cRpiAudioDecoder::cParser
-{
-
-public:
-
-	cParser() :
-		m_mutex(new cMutex()),
-		m_codec(cAudioCodec::eInvalid),
-		m_channels(0),
-		m_samplingRate(0),
-		m_size(0),
-		m_parsed(true)
-	{
-	}
-
-	~cParser()
-	{
-		delete m_mutex;
-	}
-
-	AVPacket* Packet(void)
-	{
-		return &m_packet;
-	}
-
-	cAudioCodec::eCodec GetCodec(void)
-	{
-		if (!m_parsed)
-			Parse();
-		return m_codec;
-	}
-
-	unsigned int GetChannels(void)
-	{
-		if (!m_parsed)
-			Parse();
-		return m_channels;
-	}
-
-	unsigned int GetSamplingRate(void)
-	{
-		if (!m_parsed)
-			Parse();
-		return m_samplingRate;
-	}
-
-	unsigned int GetFrameSize(void)
-	{
-		if (!m_parsed)
-			Parse();
-		return m_packet.size;
-	}
-
-	uint64_t GetPts(void)
-	{
-		uint64_t pts = 0;
-		m_mutex->Lock();
-
-		if (!m_ptsQueue.empty())
-			pts = m_ptsQueue.front()->pts;
-
-		m_mutex->Unlock();
-		return pts;
-	}
-
-	unsigned int GetFreeSpace(void)
-	{
-		return AVPKT_BUFFER_SIZE - m_size - FF_INPUT_BUFFER_PADDING_SIZE;
-	}
-
-	bool Empty(void)
-	{
-		if (!m_parsed)
-			Parse();
-		return m_packet.size == 0;
-	}
-
-	int Init(void)
-	{
-		if (!av_new_packet(&m_packet, AVPKT_BUFFER_SIZE))
-		{
-			Reset();
-			return 0;
-		}
-		return -1;
-	}
-
-	int DeInit(void)
-	{
-		av_free_packet(&m_packet);
-		return 0;
-	}
-
-	void Reset(void)
-	{
-		m_mutex->Lock();
-		m_codec = cAudioCodec::eInvalid;
-		m_channels = 0;
-		m_samplingRate = 0;
-		m_packet.size = 0;
-		m_size = 0;
-		m_parsed = true; // parser is empty, no need for parsing
-		memset(m_packet.data, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-
-		while (!m_ptsQueue.empty())
-		{
-			delete m_ptsQueue.front();
-			m_ptsQueue.pop();
-		}
-		m_mutex->Unlock();
-	}
-
-	bool Append(const unsigned char *data, uint64_t pts, unsigned int length)
-	{
-		m_mutex->Lock();
-		bool ret = true;
-
-		if (m_size + length + FF_INPUT_BUFFER_PADDING_SIZE > AVPKT_BUFFER_SIZE)
-			ret = false;
-		else
-		{
-			memcpy(m_packet.data + m_size, data, length);
-			m_size += length;
-			memset(m_packet.data + m_size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-
-			Pts* entry = new Pts(pts, length);
-			m_ptsQueue.push(entry);
-
-			m_parsed = false;
-		}
-		m_mutex->Unlock();
-		return ret;
-	}
-
-	void Shrink(unsigned int length, bool retainPts = false)
-	{
-		m_mutex->Lock();
-
-		if (length < m_size)
-		{
-			memmove(m_packet.data, m_packet.data + length, m_size - length);
-			m_size -= length;
-			memset(m_packet.data + m_size, 0, FF_INPUT_BUFFER_PADDING_SIZE);
-
-			while (!m_ptsQueue.empty() && length)
-			{
-				if (m_ptsQueue.front()->length <= length)
-				{
-					length -= m_ptsQueue.front()->length;
-					delete m_ptsQueue.front();
-					m_ptsQueue.pop();
-				}
-				else
-				{
-					// clear current PTS since it's not valid anymore after
-					// shrinking the packet
-					if (!retainPts)
-						m_ptsQueue.front()->pts = 0;
-
-					m_ptsQueue.front()->length -= length;
-					length = 0;
-				}
-			}
-
-			m_parsed = false;
-		}
-		else
-			Reset();
-
-		m_mutex->Unlock();
-	}
-	
-private:
-
-	cParser(const cParser&);
-	cParser& operator= (const cParser&);
-
-	// Check format of first audio packet in buffer. If format has been
-	// guessed, but packet is not yet complete, codec is set with a length
-	// of 0. Once the buffer contains either the exact amount of expected
-	// data or another valid packet start after the first frame, packet
-	// size is set to the first frame length.
-	// Valid packets are always moved to the buffer start, if no valid
-	// audio frame has been found, packet gets cleared.
-
-	void Parse()
-	{
-		m_mutex->Lock();
-
-		cAudioCodec::eCodec codec = cAudioCodec::eInvalid;
-		unsigned int channels = 0;
-		unsigned int offset = 0;
-		unsigned int frameSize = 0;
-		unsigned int samplingRate = 0;
-
-		while (m_size - offset >= 4)
-		{
-			// 0xFFE...      MPEG audio
-			// 0x0B77...     (E)AC-3 audio
-			// 0xFFF...      AAC audio
-			// 0x7FFE8001... DTS audio
-			// PCM audio can't be found
-
-			const uint8_t *p = m_packet.data + offset;
-			unsigned int n = m_size - offset;
-
-			switch (FastCheck(p))
-			{
-			case cAudioCodec::eMPG:
-				if (MpegCheck(p, n, frameSize, channels, samplingRate))
-					codec = cAudioCodec::eMPG;
-				break;
-
-			case cAudioCodec::eAC3:
-				if (Ac3Check(p, n, frameSize, channels, samplingRate))
-				{
-					codec = cAudioCodec::eAC3;
-					if (n > 5 && p[5] > (10 << 3))
-						codec = cAudioCodec::eEAC3;
-				}
-				break;
-			case cAudioCodec::eAAC:
-				if (AdtsCheck(p, n, frameSize, channels, samplingRate))
-					codec = cAudioCodec::eAAC;
-				break;
-
-			case cAudioCodec::eDTS:
-				if (DtsCheck(p, n, frameSize, channels, samplingRate))
-					codec = cAudioCodec::eDTS;
-				break;
-
-			default:
-				break;
-			}
-
-			if (codec != cAudioCodec::eInvalid)
-			{
-				// if there is enough data in buffer, check if predicted next
-				// frame start is valid
-				if (n < frameSize + 4 ||
-						FastCheck(p + frameSize) != cAudioCodec::eInvalid)
-				{
-					// if codec has been detected but buffer does not yet
-					// contains a complete frame, set size to zero to prevent
-					// frame from being decoded
-					if (frameSize > n)
-						frameSize = 0;
-
-					break;
-				}
-			}
-
-			++offset;
-		}
-
-		if (offset)
-		{
-			DBG("audio parser skipped %u of %u bytes", offset, m_size);
-			Shrink(offset, true);
-		}
-
-		if (codec != cAudioCodec::eInvalid)
-		{
-			m_codec = codec;
-			m_channels = channels;
-			m_samplingRate = samplingRate;
-			m_packet.size = frameSize;
-		}
-		else
-			m_packet.size = 0;
-
-		m_parsed = true;
-		m_mutex->Unlock();
-	}
-
-	struct Pts
-	{
-		Pts(uint64_t _pts, unsigned int _length)
-			: pts(_pts), length(_length) { };
-
-		uint64_t 		pts;
-		unsigned int 	length;
-	};
-
-	cMutex*				m_mutex;
-	AVPacket 			m_packet;
-	cAudioCodec::eCodec m_codec;
-	unsigned int		m_channels;
-	unsigned int		m_samplingRate;
-	unsigned int		m_size;
-	std::queue<Pts*> 	m_ptsQueue;
-	bool				m_parsed;
-
-	/* ---------------------------------------------------------------------- */
-	/*     audio codec parser helper functions, based on vdr-softhddevice     */
-	/* ---------------------------------------------------------------------- */
-
-	static const uint16_t BitRateTable[2][3][16];
-	static const uint16_t MpegSampleRateTable[4];
-	static const uint32_t Mpeg4SampleRateTable[16];
-	static const uint16_t Ac3SampleRateTable[4];
-	static const uint16_t Ac3FrameSizeTable[38][3];
-	static const uint32_t DtsSampleRateTable[16];
-
-	static cAudioCodec::eCodec FastCheck(const uint8_t *p)
-	{
-		return 	FastMpegCheck(p)  ? cAudioCodec::eMPG :
-				FastAc3Check (p)  ? cAudioCodec::eAC3 :
-				FastAdtsCheck(p)  ? cAudioCodec::eAAC :
-				FastDtsCheck (p)  ? cAudioCodec::eDTS :
-									cAudioCodec::eInvalid;
-	}
-
-	///
-	///	Fast check for MPEG audio.
-	///
-	///	0xFFE... MPEG audio
-	///
-	static bool FastMpegCheck(const uint8_t *p)
-	{
-		if (p[0] != 0xFF)			// 11bit frame sync
-			return false;
-		if ((p[1] & 0xE0) != 0xE0)
-			return false;
-		if ((p[1] & 0x18) == 0x08)	// version ID - 01 reserved
-			return false;
-		if (!(p[1] & 0x06))			// layer description - 00 reserved
-			return false;
-		if ((p[2] & 0xF0) == 0xF0)	// bit rate index - 1111 reserved
-			return false;
-		if ((p[2] & 0x0C) == 0x0C)	// sampling rate index - 11 reserved
-			return false;
-		return true;
-	}
-
-	///	Check for MPEG audio.
-	///
-	///	0xFFEx already checked.
-	///
-	///	From: http://www.mpgedit.org/mpgedit/mpeg_format/mpeghdr.htm
-	///
-	///	AAAAAAAA AAABBCCD EEEEFFGH IIJJKLMM
-	///
-	///	o a 11x Frame sync
-	///	o b 2x	MPEG audio version (2.5, reserved, 2, 1)
-	///	o c 2x	Layer (reserved, III, II, I)
-	///	o e 2x	BitRate index
-	///	o f 2x	SampleRate index (41000, 48000, 32000, 0)
-	///	o g 1x	Padding bit
-	/// o h 1x  Private bit
-	/// o i 2x  Channel mode
-	///	o ..	Doesn't care
-	///
-	///	frame length:
-	///	Layer I:
-	///		FrameLengthInBytes = (12 * BitRate / SampleRate + Padding) * 4
-	///	Layer II & III:
-	///		FrameLengthInBytes = 144 * BitRate / SampleRate + Padding
-	///
-	static bool MpegCheck(const uint8_t *p, unsigned int size,
-			unsigned int &frameSize, unsigned int &channels,
-			unsigned int &samplingRate)
-	{
-		frameSize = size;
-		if (size < 4)
-			return true;
-
-		int cmode = (p[3] >> 6) & 0x03;
-		int mpeg2 = !(p[1] & 0x08) && (p[1] & 0x10);
-		int mpeg25 = !(p[1] & 0x08) && !(p[1] & 0x10);
-		int layer = 4 - ((p[1] >> 1) & 0x03);
-		int padding = (p[2] >> 1) & 0x01;
-
-		// channel mode = [ stereo, joint stereo, dual channel, mono]
-		channels = cmode == 0x03 ? 1 : 2;
-
-		samplingRate = MpegSampleRateTable[(p[2] >> 2) & 0x03];
-		if (!samplingRate)
-			return false;
-
-		samplingRate >>= mpeg2;		// MPEG 2 half rate
-		samplingRate >>= mpeg25;	// MPEG 2.5 quarter rate
-
-		int bit_rate =
-				BitRateTable[mpeg2 | mpeg25][layer - 1][(p[2] >> 4) & 0x0F];
-		if (!bit_rate)
-			return false;
-
-		switch (layer)
-		{
-		case 1:
-			frameSize = (12000 * bit_rate) / samplingRate;
-			frameSize = (frameSize + padding) * 4;
-			break;
-		case 2:
-		case 3:
-		default:
-			frameSize = (144000 * bit_rate) / samplingRate;
-			frameSize = frameSize + padding;
-			break;
-		}
-		return true;
-	}
-
-	///
-	///	Fast check for (E-)AC-3 audio.
-	///
-	///	0x0B77... AC-3 audio
-	///
-	static bool FastAc3Check(const uint8_t *p)
-	{
-		if (p[0] != 0x0B)			// 16bit sync
-			return false;
-		if (p[1] != 0x77)
-			return false;
-		return true;
-	}
-
-	///
-	///	Check for (E-)AC-3 audio.
-	///
-	///	0x0B77xxxxxx already checked.
-	///
-	///	o AC-3 Header
-	///	AAAAAAAA AAAAAAAA BBBBBBBB BBBBBBBB CCDDDDDD EEEEEFFF GGGxxxxx
-	///
-	///	o a 16x Frame sync, always 0x0B77
-	///	o b 16x CRC 16
-	///	o c 2x	Sample rate ( 48000, 44100, 32000, reserved )
-	///	o d 6x	Frame size code
-	///	o e 5x	Bit stream ID
-	///	o f 3x	Bit stream mode
-	/// o g 3x  Audio coding mode
-	///
-	///	o E-AC-3 Header
-	///	AAAAAAAA AAAAAAAA BBCCCDDD DDDDDDDD EEFFGGGH IIIII...
-	///
-	///	o a 16x Frame sync, always 0x0B77
-	///	o b 2x	Frame type
-	///	o c 3x	Sub stream ID
-	///	o d 11x Frame size - 1 in words
-	///	o e 2x	Frame size code
-	///	o f 2x	Frame size code 2
-	/// o g 3x  Channel mode
-	/// 0 h 1x  LFE on
-	///
-	static bool Ac3Check(const uint8_t *p, unsigned int size,
-			unsigned int &frameSize, unsigned int &channels,
-			unsigned int &samplingRate)
-	{
-		frameSize = size;
-		if (size < 7)
-			return true;
-
-		int acmod;
-		bool lfe;
-		int fscod = (p[4] & 0xC0) >> 6;
-
-		samplingRate = Ac3SampleRateTable[fscod];
-
-		if (p[5] > (10 << 3))		// E-AC-3
-		{
-			if (fscod == 0x03)
-			{
-				int fscod2 = (p[4] & 0x30) >> 4;
-				if (fscod2 == 0x03)
-					return false;		// invalid fscod & fscod2
-
-				samplingRate = Ac3SampleRateTable[fscod2] / 2;
-			}
-
-			acmod = (p[4] & 0x0E) >> 1;	// number of channels, LFE excluded
-			lfe = p[4] & 0x01;
-
-			frameSize = ((p[2] & 0x07) << 8) + p[3] + 1;
-			frameSize *= 2;
-		}
-		else						// AC-3
-		{
-			if (fscod == 0x03)		// invalid sample rate
-				return false;
-
-			int frmsizcod = p[4] & 0x3F;
-			if (frmsizcod > 37)		// invalid frame size
-				return false;
-
-			acmod = p[6] >> 5;		// number of channels, LFE excluded
-
-			int lfe_bptr = 51;		// position of LFE bit in header for 2.0
-			if ((acmod & 0x01) && (acmod != 0x01))
-				lfe_bptr += 2;		// skip center mix level
-			if (acmod & 0x04)
-				lfe_bptr += 2;		// skip surround mix level
-			if (acmod == 0x02)
-				lfe_bptr += 2;		// skip surround mode
-			lfe = (p[lfe_bptr / 8] & (1 << (7 - (lfe_bptr % 8))));
-
-			// invalid is checked above
-			frameSize = Ac3FrameSizeTable[frmsizcod][fscod] * 2;
-		}
-
-		channels =
-			acmod == 0x00 ? 2 : 	// Ch1, Ch2
-			acmod == 0x01 ? 1 : 	// C
-			acmod == 0x02 ? 2 : 	// L, R
-			acmod == 0x03 ? 3 : 	// L, C, R
-			acmod == 0x04 ? 3 : 	// L, R, S
-			acmod == 0x05 ? 4 : 	// L, C, R, S
-			acmod == 0x06 ? 4 : 	// L, R, RL, RR
-			acmod == 0x07 ? 5 : 0;	// L, C, R, RL, RR
-
-		if (lfe) channels++;
-		return true;
-	}
-
-#if 0
-	///
-	///	Fast check for AAC LATM audio.
-	///
-	///	0x56E... AAC LATM audio
-	///
-	static bool FastLatmCheck(const uint8_t *p)
-	{
-		if (p[0] != 0x56)			// 11bit sync
-			return false;
-		if ((p[1] & 0xE0) != 0xE0)
-			return false;
-		return true;
-	}
-
-	///
-	///	Check for AAC LATM audio.
-	///
-	///	0x56Exxx already checked.
-	///
-	static bool LatmCheck(const uint8_t *p, unsigned int size,
-			unsigned int &frameSize, unsigned int &channels,
-			unsigned int &samplingRate)
-	{
-		frameSize = size;
-		if (size < 3)
-			return true;
-
-		// to do: determine channels
-		channels = 2;
-
-		// to do: determine sampling rate
-		samplingRate = 48000;
-
-		// 13 bit frame size without header
-		frameSize = ((p[1] & 0x1F) << 8) + p[2];
-		frameSize += 3;
-		return true;
-	}
+#if FF_INPUT_BUFFER_PADDING_SIZE > AUDIO_PARSER_PADDING
+#error "audio parser padding too small for this libavcodec version!"
 #endif
-	
-	///
-	///	Fast check for ADTS Audio Data Transport Stream.
-	///
-	///	0xFFF...  ADTS audio
-	///
-	static bool FastAdtsCheck(const uint8_t *p)
-	{
-		if (p[0] != 0xFF)			// 12bit sync
-			return false;
-		if ((p[1] & 0xF6) != 0xF0)	// sync + layer must be 0
-			return false;
-		if ((p[2] & 0x3C) == 0x3C)	// sampling frequency index != 15
-			return false;
-		return true;
-	}
-
-	///
-	///	Check for ADTS Audio Data Transport Stream.
-	///
-	///	0xFFF already checked.
-	///
-	///	AAAAAAAA AAAABCCD EEFFFFGH HHIJKLMM MMMMMMMM MMMOOOOO OOOOOOPP
-	///	(QQQQQQQQ QQQQQQQ)
-	///
-	///	o A*12	sync word 0xFFF
-	///	o B*1	MPEG Version: 0 for MPEG-4, 1 for MPEG-2
-	///	o C*2	layer: always 0
-	///	o ..
-	///	o F*4	sampling frequency index (15 is invalid)
-	///	o ..
-	/// o H*3	MPEG-4 channel configuration
-	/// o ...
-	///	o M*13	frame length
-	///
-	static bool AdtsCheck(const uint8_t *p, unsigned int size,
-			unsigned int &frameSize, unsigned int &channels,
-			unsigned int &samplingRate)
-	{
-		frameSize = size;
-		if (size < 6)
-			return true;
-
-		samplingRate = Mpeg4SampleRateTable[(p[2] >> 2) & 0x0F];
-
-		frameSize = (p[3] & 0x03) << 11;
-		frameSize |= (p[4] & 0xFF) << 3;
-		frameSize |= (p[5] & 0xE0) >> 5;
-
-	    int cConf = (p[2] & 0x01) << 7;
-	    cConf |= (p[3] & 0xC0) >> 6;
-	    channels =
-	    	cConf == 0x00 ? 0 : // defined in AOT specific config
-			cConf == 0x01 ? 1 : // C
-	    	cConf == 0x02 ? 2 : // L, R
-	    	cConf == 0x03 ? 3 : // C, L, R
-	    	cConf == 0x04 ? 4 : // C, L, R, RC
-	    	cConf == 0x05 ? 5 : // C, L, R, RL, RR
-	    	cConf == 0x06 ? 6 : // C, L, R, RL, RR, LFE
-	    	cConf == 0x07 ? 8 : // C, L, R, SL, SR, RL, RR, LFE
-				0;
-
-		if (!samplingRate || !channels)
-			return false;
-
-	    return true;
-	}
-
-	///
-	///	Fast check for DTS Audio Data Transport Stream.
-	///
-	///	0x7FFE8001....  DTS audio
-	///
-	static bool FastDtsCheck(const uint8_t *p)
-	{
-		if (p[0] != 0x7F)			// 32bit sync
-			return false;
-		if (p[1] != 0xFE)
-			return false;
-		if (p[2] != 0x80)
-			return false;
-		if (p[3] != 0x01)
-			return false;
-		return true;
-	}
-
-	///
-	///	Check for DTS Audio Data Transport Stream.
-	///
-	///	0x7FFE8001 already checked.
-	///
-	///	AAAAAAAA AAAAAAAA AAAAAAAA AAAAAAAA BCCCCCDE EEEEEEFF FFFFFFFF FFFFGGGG
-	/// GGHHHHII IIIJKLMN OOOPQRRS TTTTTTTT TTTTTTTT UVVVVWWX XXYZaaaa
-	///
-	///	o A*32	sync word 0x7FFE8001
-	///	o B*1   frame type
-	///	o C*5   deficit sample count
-	///	o D*1   CRC present flag
-	///	o E*7   number of PCM sample blocks
-	///	o F*14  primary frame size
-	///	o G*6   audio channel arrangement
-	///	o H*4   core audio sampling frequency
-	///	o I*5   transmission bit rate
-	///	o J*1   embedded downmix enabled
-	///	o K*1   embedded dynamic range flag
-	///	o L*1   embedded time stamp flag
-	///	o M*1   auxiliary data flag
-	///	o N*1   HDCD
-	///	o O*3   extension audio descriptor flag
-	///	o P*1   extended coding flag
-	///	o Q*1   audio sync word insertion flag
-	///	o R*2   low frequency effects flag
-	///	o S*1   predictor history flag
-	///	o T*16  header CRC check (if CRC present flag set)
-	///	o U*1   multi rate interpolator switch
-	///	o V*4   encoder software revision
-	///	o W*2   copy history
-	///	o X*3   source PCM resolution
-	///	o Y*1   front sum/difference flag
-	///	o Z*1   surrounds sum/difference flag
-	///	o a*4   dialog normalization parameter
-	///
-	static bool DtsCheck(const uint8_t *p, unsigned int size,
-			unsigned int &frameSize, unsigned int &channels,
-			unsigned int &samplingRate)
-	{
-		frameSize = size;
-		if (size < 11)
-			return true;
-
-		frameSize = ((p[5] & 0x03) << 12) + (p[6] << 4) + ((p[7] & 0xF0) >> 4);
-		frameSize++;
-
-		samplingRate = DtsSampleRateTable[(p[8] & 0x3C) >> 2];
-
-		int amode = ((p[7] & 0x0F) << 2) + ((p[8] & 0xC0) >> 6);
-		channels =
-			amode == 0x00 ? 1 : 	// mono
-			amode == 0x02 ? 2 : 	// L, R
-			amode == 0x03 ? 2 : 	// (L + R), (L - R)
-			amode == 0x04 ? 2 : 	// LT, RT
-			amode == 0x05 ? 3 : 	// L, R, C
-			amode == 0x06 ? 3 : 	// L, R, S
-			amode == 0x08 ? 4 : 	// L, R, RL, RR
-			amode == 0x09 ? 5 : 0;	// L, C, R, RL, RR
-
-		if (!samplingRate || !channels)
-			return false;
-
-		if (p[10] & 0x06) channels++;
-		return true;
-	}
-};
-
-///
-///	MPEG bit rate table.
-///
-///	BitRateTable[Version][Layer][Index]
-///
-const uint16_t cRpiAudioDecoder::cParser::BitRateTable[2][3][16] =
-{
-	{	// MPEG Version 1
-		{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
-		{0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
-		{0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 0}
-	},
-	{	// MPEG Version 2 & 2.5
-		{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
-		{0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0},
-		{0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0}
-	}
-};
-
-///
-///	MPEG sample rate table.
-///
-const uint16_t cRpiAudioDecoder::cParser::MpegSampleRateTable[4] =
-	{ 44100, 48000, 32000, 0 };
-
-///
-///	MPEG-4 sample rate table.
-///
-const uint32_t cRpiAudioDecoder::cParser::Mpeg4SampleRateTable[16] = {
-		96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
-		16000, 12000, 11025,  8000,  7350,     0,     0,     0
-};
-
-///
-///	AC-3 sample rate table.
-///
-const uint16_t cRpiAudioDecoder::cParser::Ac3SampleRateTable[4] =
-	{ 48000, 44100, 32000, 0 };
-
-///
-///	Possible AC-3 frame sizes.
-///
-///	from ATSC A/52 table 5.18 frame size code table.
-///
-const uint16_t cRpiAudioDecoder::cParser::Ac3FrameSizeTable[38][3] =
-{
-	{  64,   69,   96}, {  64,   70,   96}, {  80,   87,  120}, { 80,  88,  120},
-	{  96,  104,  144}, {  96,  105,  144}, { 112,  121,  168}, {112, 122,  168},
-	{ 128,  139,  192}, { 128,  140,  192}, { 160,  174,  240}, {160, 175,  240},
-	{ 192,  208,  288}, { 192,  209,  288}, { 224,  243,  336}, {224, 244,  336},
-	{ 256,  278,  384}, { 256,  279,  384}, { 320,  348,  480}, {320, 349,  480},
-	{ 384,  417,  576}, { 384,  418,  576}, { 448,  487,  672}, {448, 488,  672},
-	{ 512,  557,  768}, { 512,  558,  768}, { 640,  696,  960}, {640, 697,  960},
-	{ 768,  835, 1152}, { 768,  836, 1152}, { 896,  975, 1344}, {896, 976, 1344},
-	{1024, 1114, 1536}, {1024, 1115, 1536}, {1152, 1253, 1728},
-	{1152, 1254, 1728}, {1280, 1393, 1920}, {1280, 1394, 1920},
-};
 
-///
-///	DTS sample rate table.
-///
-const uint32_t cRpiAudioDecoder::cParser::DtsSampleRateTable[16] =
-	{ 0,  8000, 16000, 32000, 64000,
-	  0, 11025, 22050, 44100, 88200,
-	  0, 12000, 24000, 48000, 96000, 0 };
+// number of decoder contexts kept open, least recently used ones get closed
+#define AUDIO_MAX_CONTEXTS 2
 
-/* ------------------------------------------------------------------------- */
+// number of decoded frames the decoder may run ahead of the render. without
+// reference counted frames, legacy libavcodec reuses the frame buffers on each
+// decode call, so there's no queueing possible
+#if LIBAVCODEC_VERSION_MAJOR < 55
+#define AUDIO_FRAME_QUEUE_SIZE 1
+#else
+#define AUDIO_FRAME_QUEUE_SIZE 8
+#endif
 
 #define AV_CH_LAYOUT(ch) ( \
 		ch == 1 ? AV_CH_LAYOUT_MONO    : \
@@ -894,7 +133,8 @@ public:
 	}
 
 	int WriteSamples(uint8_t** data, int samples, uint64_t pts,
-			AVSampleFormat sampleFormat = AV_SAMPLE_FMT_NONE)
+			AVSampleFormat sampleFormat = AV_SAMPLE_FMT_NONE, int channels = 0,
+			uint64_t channelLayout = 0)
 	{
 		if (!Ready())
 			return 0;
@@ -927,51 +167,21 @@ public:
 		}
 		else
 		{
+			// local decode, use dedicated conversion if available
+			unsigned int inChannels = channels ? channels : m_inChannels;
+			PcmConverter convert = GetPcmConverter(sampleFormat,
+					inChannels, channelLayout, m_outChannels);
 #ifdef DO_RESAMPLE
-			// local decode, do resampling
-			if (!m_resamplerConfigured || m_pcmSampleFormat != sampleFormat)
+			// otherwise do resampling
+			if (!convert && (!m_resamplerConfigured ||
+					m_pcmSampleFormat != sampleFormat))
 			{
 				m_pcmSampleFormat = sampleFormat;
 				ApplyResamplerSettings();
 			}
-			if (m_resample)
-			{
-				m_pts = pts ? pts : m_pts;
-				OMX_BUFFERHEADERTYPE *buf = m_omx->GetAudioBuffer(m_pts);
-				if (buf)
-				{
-					if (buf->nAllocLen >= (samples * m_outChannels *
-						av_get_bytes_per_sample(AV_SAMPLE_FMT_S16)))
-					{
-						uint8_t *dst[] = { buf->pBuffer };
-						int copiedSamples = swr_convert(m_resample,
-							dst, samples, (const uint8_t **)data, samples);
-
-						buf->nFilledLen = av_samples_get_buffer_size(NULL,
-							m_outChannels, copiedSamples, AV_SAMPLE_FMT_S16, 1);
-
-						m_pts += copiedSamples * 90000 / m_samplingRate;
-					}
-					copied = m_omx->EmptyAudioBuffer(buf) ? samples : 0;
-				}
-			}
-#else
-			// local decode, no resampling
-			m_pts = pts ? pts : m_pts;
-			OMX_BUFFERHEADERTYPE *buf = m_omx->GetAudioBuffer(m_pts);
-			if (buf)
-			{
-				unsigned int size = samples * m_outChannels *
-						av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
-				if (buf->nAllocLen >= size)
-				{
-					memcpy(buf->pBuffer, *data, size);
-					buf->nFilledLen = size;
-					m_pts += samples * 90000 / m_samplingRate;
-				}
-				copied = m_omx->EmptyAudioBuffer(buf) ? samples : 0;
-			}
+			if (convert || m_resample)
 #endif
+				copied = WritePcm(convert, data, inChannels, samples, pts);
 		}
 		m_mutex->Unlock();
 		return copied;
@@ -1099,6 +309,75 @@ private:
 		m_configured = true;
 	}
 
+	/* ---------------------------------------------------------------------- */
+	/*  PCM conversion for the common decoder output formats, see kernels.h  */
+	/* ---------------------------------------------------------------------- */
+
+	// channels are the ones of the source
+	typedef void (*PcmConverter)(int16_t *dst, const float **src,
+			int samples, int channels);
+
+	// returns a dedicated kernel for the given conversion or NULL, if the
+	// conversion needs to be done by the resampler
+	static PcmConverter GetPcmConverter(AVSampleFormat format,
+			unsigned int inChannels, uint64_t inLayout,
+			unsigned int outChannels)
+	{
+		if (format == AV_SAMPLE_FMT_FLTP)
+		{
+			if (inChannels == outChannels)
+				return &cPcmKernels::FltpToS16;
+
+			// down mix expects FL FR FC (LFE) SL SR (or BL BR) order
+			if (outChannels == 2 && ((inChannels == 6 &&
+					(inLayout == AV_CH_LAYOUT_5POINT1 ||
+					inLayout == AV_CH_LAYOUT_5POINT1_BACK)) ||
+					(inChannels == 5 &&
+					(inLayout == AV_CH_LAYOUT_5POINT0 ||
+					inLayout == AV_CH_LAYOUT_5POINT0_BACK))))
+				return &cPcmKernels::Fltp5xToS16Stereo;
+		}
+		return 0;
+	}
+
+	// write decoded samples to a single buffer, converted by a dedicated
+	// kernel, by the resampler or, without resampler, copied as they are
+	int WritePcm(PcmConverter convert, uint8_t **data, unsigned int channels,
+			int samples, uint64_t pts)
+	{
+		m_pts = pts ? pts : m_pts;
+		OMX_BUFFERHEADERTYPE *buf = m_omx->GetAudioBuffer(m_pts);
+		if (!buf)
+			return 0;
+
+		unsigned int size = samples * m_outChannels *
+				av_get_bytes_per_sample(AV_SAMPLE_FMT_S16);
+		if (buf->nAllocLen >= size)
+		{
+			int converted = samples;
+			if (convert)
+				convert((int16_t *)buf->pBuffer, (const float **)data,
+						samples, channels);
+#ifdef DO_RESAMPLE
+			else
+			{
+				uint8_t *dst[] = { buf->pBuffer };
+				converted = max(0, swr_convert(m_resample,
+						dst, samples, (const uint8_t **)data, samples));
+
+				size = av_samples_get_buffer_size(NULL,
+						m_outChannels, converted, AV_SAMPLE_FMT_S16, 1);
+			}
+#else
+			else
+				memcpy(buf->pBuffer, *data, size);
+#endif
+			buf->nFilledLen = size;
+			m_pts += converted * 90000 / m_samplingRate;
+		}
+		return m_omx->EmptyAudioBuffer(buf) ? samples : 0;
+	}
+
 #ifdef DO_RESAMPLE
 	void ApplyResamplerSettings(void)
 	{
@@ -1151,11 +430,16 @@ private:
 
 cRpiAudioDecoder::cRpiAudioDecoder(cOmx *omx) :
 	cThread("audio decoder"),
+	m_codecUsage(0),
 	m_passthrough(false),
 	m_reset(false),
 	m_setupChanged(true),
+	m_queued(0),
+	m_maxQueued(0),
+	m_underruns(0),
+	m_resetStats(false),
 	m_wait(new cCondWait()),
-	m_parser(new cParser()),
+	m_parser(new cAudioParser()),
 	m_render(new cRpiAudioRender(omx))
 {
 	memset(m_codecs, 0, sizeof(m_codecs));
@@ -1193,36 +477,80 @@ int cRpiAudioDecoder::Init(void)
 	m_codecs[cAudioCodec::eAAC ].codec = avcodec_find_decoder(AV_CODEC_ID_AAC);
 	m_codecs[cAudioCodec::eDTS ].codec = avcodec_find_decoder(AV_CODEC_ID_DTS);
 
+	// decoder contexts are opened on first use, see GetContext()
 	for (int i = 0; i < cAudioCodec::eNumCodecs; i++)
 	{
 		cAudioCodec::eCodec codec = static_cast<cAudioCodec::eCodec>(i);
-		if (m_codecs[codec].codec)
+		if (codec != cAudioCodec::ePCM && !m_codecs[codec].codec)
+			ELOG("%s decoder not available!", cAudioCodec::Str(codec));
+	}
+
+	cRpiSetup::SetAudioSetupChangedCallback(&OnAudioSetupChanged, this);
+	Start();
+
+	return ret;
+}
+
+AVCodecContext *cRpiAudioDecoder::GetContext(cAudioCodec::eCodec codec)
+{
+	if (!m_codecs[codec].codec)
+		return NULL;
+
+	m_codecs[codec].lastUsed = ++m_codecUsage;
+	if (m_codecs[codec].context)
+		return m_codecs[codec].context;
+
+	// close least recently used context if limit has been reached
+	int open = 0;
+	cAudioCodec::eCodec lru = cAudioCodec::eInvalid;
+	for (int i = 0; i < cAudioCodec::eNumCodecs; i++)
+	{
+		cAudioCodec::eCodec c = static_cast<cAudioCodec::eCodec>(i);
+		if (m_codecs[c].context)
 		{
-			m_codecs[codec].context = avcodec_alloc_context3(m_codecs[codec].codec);
-			if (!m_codecs[codec].context)
-			{
-				ELOG("failed to allocate %s context!", cAudioCodec::Str(codec));
-				ret = -1;
-				break;
-			}
-			if (avcodec_open2(m_codecs[codec].context, m_codecs[codec].codec, NULL) < 0)
-			{
-				ELOG("failed to open %s decoder!", cAudioCodec::Str(codec));
-				ret = -1;
-				break;
-			}
+			open++;
+			if (lru == cAudioCodec::eInvalid ||
+					m_codecs[c].lastUsed < m_codecs[lru].lastUsed)
+				lru = c;
 		}
 	}
+	if (open >= AUDIO_MAX_CONTEXTS)
+		CloseContext(lru);
 
-	if (!ret)
+	cTimeMs time;
+	AVCodecContext *context = avcodec_alloc_context3(m_codecs[codec].codec);
+	if (!context)
 	{
-		cRpiSetup::SetAudioSetupChangedCallback(&OnAudioSetupChanged, this);
-		Start();
+		ELOG("failed to allocate %s context!", cAudioCodec::Str(codec));
+		return NULL;
+	}
+#if LIBAVCODEC_VERSION_MAJOR >= 55
+	// decoded frames are queued, so decoder must not reuse their buffers
+	context->refcounted_frames = 1;
+#endif
+	if (avcodec_open2(context, m_codecs[codec].codec, NULL) < 0)
+	{
+		ELOG("failed to open %s decoder!", cAudioCodec::Str(codec));
+		av_free(context);
+		return NULL;
 	}
-	else
-		DeInit();
 
-	return ret;
+	DLOG("opened %s decoder in %dms", cAudioCodec::Str(codec),
+			(int)time.Elapsed());
+
+	m_codecs[codec].context = context;
+	return context;
+}
+
+void cRpiAudioDecoder::CloseContext(cAudioCodec::eCodec codec)
+{
+	if (m_codecs[codec].context)
+	{
+		DBG("closing %s decoder", cAudioCodec::Str(codec));
+		avcodec_close(m_codecs[codec].context);
+		av_free(m_codecs[codec].context);
+		m_codecs[codec].context = NULL;
+	}
 }
 
 int cRpiAudioDecoder::DeInit(void)
@@ -1240,11 +568,7 @@ int cRpiAudioDecoder::DeInit(void)
 	cRpiSetup::SetAudioSetupChangedCallback(0);
 
 	for (int i = 0; i < cAudioCodec::eNumCodecs; i++)
-	{
-		cAudioCodec::eCodec codec = static_cast<cAudioCodec::eCodec>(i);
-		if (m_codecs[codec].codec)
-			avcodec_close(m_codecs[codec].context);
-	}
+		CloseContext(static_cast<cAudioCodec::eCodec>(i));
 
 	av_log_set_callback(&av_log_default_callback);
 	m_parser->DeInit();
@@ -1281,6 +605,23 @@ bool cRpiAudioDecoder::Poll(void)
 	return m_parser->GetFreeSpace() > KILOBYTE(16);
 }
 
+void cRpiAudioDecoder::GetQueueStats(int &queued, int &size, int &maxQueued,
+		int &underruns, bool reset)
+{
+	// counters are only written by the decoder thread, which clears them
+	// on its next iteration if requested
+	queued = m_queued;
+	size = AUDIO_FRAME_QUEUE_SIZE;
+	maxQueued = m_maxQueued;
+	underruns = m_underruns;
+
+	if (reset)
+	{
+		m_resetStats = true;
+		m_wait->Signal();
+	}
+}
+
 void cRpiAudioDecoder::HandleAudioSetupChanged()
 {
 	DBG("HandleAudioSetupChanged()");
@@ -1294,39 +635,63 @@ void cRpiAudioDecoder::Action(void)
 	unsigned int channels = 0;
 	unsigned int samplingRate = 0;
 	cAudioCodec::eCodec codec = cAudioCodec::eInvalid;
+	AVCodecContext *context = NULL;
+
+	// pool of decoded frames, queued until render is ready to take them
+	AVFrame *frames[AUDIO_FRAME_QUEUE_SIZE];
+	int head = 0, queued = 0;
 
-	AVFrame *frame = av_frame_alloc();
-	if (!frame)
+	for (int i = 0; i < AUDIO_FRAME_QUEUE_SIZE; i++)
 	{
-		ELOG("failed to allocate audio frame!");
-		return;
+		frames[i] = av_frame_alloc();
+		if (!frames[i])
+		{
+			ELOG("failed to allocate audio frame!");
+			while (i--)
+				av_frame_free(&frames[i]);
+			return;
+		}
 	}
 
 	while (Running())
 	{
+		if (m_resetStats)
+		{
+			m_maxQueued = queued;
+			m_underruns = 0;
+			m_resetStats = false;
+		}
+
 		if (m_reset)
 		{
 			m_parser->Reset();
 			m_render->Flush();
-			av_frame_unref(frame);
+			for (; queued; queued--, head = (head + 1) % AUDIO_FRAME_QUEUE_SIZE)
+				av_frame_unref(frames[head]);
 			m_reset = false;
 		}
+		m_queued = queued;
 
-		// test for codec change if there is data in parser and no left over
-		if (!m_parser->Empty() && !frame->nb_samples)
-			m_setupChanged |= codec != m_parser->GetCodec() ||
+		// test for codec change if there is data in parser. frames decoded
+		// ahead with the old parameters are passed to render first, so stop
+		// decoding and set up the new codec once the queue has run empty
+		bool formatChanged = !m_parser->Empty() &&
+				(codec != m_parser->GetCodec() ||
 				channels != m_parser->GetChannels() ||
-				samplingRate != m_parser->GetSamplingRate();
+				samplingRate != m_parser->GetSamplingRate());
+
+		m_setupChanged |= formatChanged && !queued;
 
 		// if necessary, set up audio codec
-		if (!m_parser->Empty() && m_setupChanged)
+		if (!m_parser->Empty() && m_setupChanged && !queued)
 		{
-			if (codec != m_parser->GetCodec() && codec != cAudioCodec::eInvalid)
-				avcodec_flush_buffers(m_codecs[codec].context);
+			if (codec != m_parser->GetCodec() && context)
+				avcodec_flush_buffers(context);
 
 			codec = m_parser->GetCodec();
 			channels = m_parser->GetChannels();
 			samplingRate = m_parser->GetSamplingRate();
+			context = NULL;
 
 			// validate channel layout and apply new audio parameters
 			if (AV_CH_LAYOUT(channels))
@@ -1335,30 +700,42 @@ void cRpiAudioDecoder::Action(void)
 				m_render->SetCodec(codec, channels, samplingRate,
 						m_parser->GetFrameSize());
 
+				// decoder is only needed if audio isn't passed through
+				if (!m_render->IsPassthrough())
+				{
+					context = GetContext(codec);
+					if (!context)
+						m_setupChanged = true;
 #ifndef DO_RESAMPLE
+					else
+					{
 #if FF_API_REQUEST_CHANNELS
-				// if there's no libswresample, let decoder do the down mix
-				m_codecs[codec].context->request_channels =
-						m_render->GetChannels();
+						// if there's no libswresample, let decoder down mix
+						context->request_channels = m_render->GetChannels();
 #endif
-				m_codecs[codec].context->request_channel_layout =
-						AV_CH_LAYOUT(m_render->GetChannels());
+						context->request_channel_layout =
+								AV_CH_LAYOUT(m_render->GetChannels());
+					}
 #endif
+				}
 			}
 			m_reset = m_setupChanged;
 			continue;
 		}
 
-		// if there's audio data available...
-		if (!m_parser->Empty())
+		bool busy = false;
+
+		// if there's audio data of the current format available...
+		if (!m_parser->Empty() && !formatChanged && !m_setupChanged)
 		{
 			// ... either pass through if render is ready
 			if (m_render->IsPassthrough())
 			{
 				if (m_render->Ready())
 				{
-					int len = m_render->WriteSamples(&m_parser->Packet()->data,
-							m_parser->Packet()->size, m_parser->GetPts());
+					uint8_t *data = m_parser->GetFrame();
+					int len = m_render->WriteSamples(&data,
+							m_parser->GetFrameSize(), m_parser->GetPts());
 					if (len)
 					{
 						m_parser->Shrink(len);
@@ -1366,17 +743,30 @@ void cRpiAudioDecoder::Action(void)
 					}
 				}
 			}
-			// ... or decode if there's no leftover
-			else if (!frame->nb_samples)
+			// ... or decode ahead as long as there's a free frame
+			else if (queued < AUDIO_FRAME_QUEUE_SIZE)
 			{
+				AVFrame *frame =
+						frames[(head + queued) % AUDIO_FRAME_QUEUE_SIZE];
+
+				AVPacket packet;
+				av_init_packet(&packet);
+				packet.data = m_parser->GetFrame();
+				packet.size = m_parser->GetFrameSize();
+
 				int gotFrame = 0;
-				int len = avcodec_decode_audio4(m_codecs[codec].context,
-						frame, &gotFrame, m_parser->Packet());
+				int len = avcodec_decode_audio4(context,
+						frame, &gotFrame, &packet);
 
 				if (len > 0 && gotFrame)
 				{
 					frame->pts = m_parser->GetPts();
 					m_parser->Shrink(len);
+
+					if (++queued > m_maxQueued)
+						m_maxQueued = queued;
+
+					busy = true;
 				}
 				else
 				{
@@ -1387,23 +777,42 @@ void cRpiAudioDecoder::Action(void)
 				}
 			}
 		}
-		// if there's leftover, pass decoded audio data to render when ready
-		if (frame->nb_samples && m_render->Ready())
+		// if there are decoded frames, pass them to render when ready
+		if (queued && m_render->Ready())
 		{
+			AVFrame *frame = frames[head];
 			int len = m_render->WriteSamples(frame->extended_data,
 					frame->nb_samples, frame->pts,
-					(AVSampleFormat)frame->format);
+					(AVSampleFormat)frame->format,
+					av_get_channel_layout_nb_channels(frame->channel_layout),
+					frame->channel_layout);
 			if (len)
 			{
 				av_frame_unref(frame);
-				continue;
+				head = (head + 1) % AUDIO_FRAME_QUEUE_SIZE;
+
+				// render took the last frame and there's nothing to decode
+				if (!--queued && m_parser->Empty())
+					m_underruns++;
+
+				busy = true;
 			}
 		}
 		// nothing to be done...
-		m_wait->Wait(50);
+		if (!busy)
+			m_wait->Wait(50);
 	}
 
-	av_frame_free(&frame);
+	for (; queued; queued--, head = (head + 1) % AUDIO_FRAME_QUEUE_SIZE)
+		av_frame_unref(frames[head]);
+
+	for (int i = 0; i < AUDIO_FRAME_QUEUE_SIZE; i++)
+		av_frame_free(&frames[i]);
+
+	m_queued = 0;
+	DLOG("audio frame queue: max. depth %d/%d, %d underruns",
+			m_maxQueued, AUDIO_FRAME_QUEUE_SIZE, m_underruns);
+
 	DLOG("cAudioDecoder() thread ended");
 }
 
@@ -31,6 +31,11 @@ public:
 	virtual bool Poll(void);
 	virtual void Reset(void);
 
+	// depth of the decoded frame queue, its size and maximum depth and the
+	// number of times it ran dry since the last reset of the statistics
+	void GetQueueStats(int &queued, int &size, int &maxQueued,
+			int &underruns, bool reset = false);
+
 protected:
 
 	virtual void Action(void);
@@ -46,19 +51,27 @@ protected:
 	{
 		class AVCodec		 *codec;
 	    class AVCodecContext *context;
+		unsigned int		 lastUsed;
 	};
 
-private:
+	class AVCodecContext *GetContext(cAudioCodec::eCodec codec);
+	void CloseContext(cAudioCodec::eCodec codec);
 
-	class cParser;
+private:
 
 	Codec		  	m_codecs[cAudioCodec::eNumCodecs];
+	unsigned int	m_codecUsage;
 	bool		  	m_passthrough;
 	bool		  	m_reset;
 	bool		  	m_setupChanged;
 
+	int				m_queued;
+	int				m_maxQueued;
+	int				m_underruns;
+	bool			m_resetStats;
+
 	cCondWait	 	*m_wait;
-	cParser		 	*m_parser;
+	class cAudioParser	*m_parser;
 	cRpiAudioRender	*m_render;
 };
 
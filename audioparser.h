@@ -0,0 +1,939 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+#ifndef AUDIO_PARSER_H
+#define AUDIO_PARSER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#include "tools.h"
+
+// The audio parser only depends on the CPU and on the logging functions of
+// the includer, so it can be exercised on any host, see bench/kernelbench.c.
+
+// ring buffer for incoming audio data, size must be a power of two
+#define AVPKT_BUFFER_SIZE (256 * 1024)
+
+// number of bytes at the ring buffer start which are mirrored behind its end,
+// so the frame header checks never need to care about the wrap around
+#define AVPKT_MIRROR_SIZE (16)
+
+// largest possible audio frame (DTS, 14 bit frame size)
+#define AVPKT_FRAME_SIZE  (16 * 1024)
+
+// number of PTS entries, one is used per appended PES payload, size must be a
+// power of two
+#define PTS_QUEUE_SIZE    (4096)
+
+// zeroed bytes behind each frame handed out, covers the input padding of
+// every libavcodec version, which may read past the frame end
+#define AUDIO_PARSER_PADDING (64)
+
+/* ------------------------------------------------------------------------- */
+/*     audio codec parser tables, based on vdr-softhddevice                  */
+/* ------------------------------------------------------------------------- */
+
+///
+///	MPEG bit rate table.
+///
+///	BitRateTable[Version][Layer][Index]
+///
+static const uint16_t BitRateTable[2][3][16] =
+{
+	{	// MPEG Version 1
+		{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+		{0, 32, 48, 56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+		{0, 32, 40, 48,  56,  64,  80,  96, 112, 128, 160, 192, 224, 256, 320, 0}
+	},
+	{	// MPEG Version 2 & 2.5
+		{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+		{0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0},
+		{0,  8, 16, 24, 32, 40, 48,  56,  64,  80,  96, 112, 128, 144, 160, 0}
+	}
+};
+
+///
+///	MPEG sample rate table.
+///
+static const uint16_t MpegSampleRateTable[4] =
+	{ 44100, 48000, 32000, 0 };
+
+///
+///	MPEG-4 sample rate table.
+///
+static const uint32_t Mpeg4SampleRateTable[16] = {
+		96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050,
+		16000, 12000, 11025,  8000,  7350,     0,     0,     0
+};
+
+///
+///	AC-3 sample rate table.
+///
+static const uint16_t Ac3SampleRateTable[4] =
+	{ 48000, 44100, 32000, 0 };
+
+///
+///	Possible AC-3 frame sizes.
+///
+///	from ATSC A/52 table 5.18 frame size code table.
+///
+static const uint16_t Ac3FrameSizeTable[38][3] =
+{
+	{  64,   69,   96}, {  64,   70,   96}, {  80,   87,  120}, { 80,  88,  120},
+	{  96,  104,  144}, {  96,  105,  144}, { 112,  121,  168}, {112, 122,  168},
+	{ 128,  139,  192}, { 128,  140,  192}, { 160,  174,  240}, {160, 175,  240},
+	{ 192,  208,  288}, { 192,  209,  288}, { 224,  243,  336}, {224, 244,  336},
+	{ 256,  278,  384}, { 256,  279,  384}, { 320,  348,  480}, {320, 349,  480},
+	{ 384,  417,  576}, { 384,  418,  576}, { 448,  487,  672}, {448, 488,  672},
+	{ 512,  557,  768}, { 512,  558,  768}, { 640,  696,  960}, {640, 697,  960},
+	{ 768,  835, 1152}, { 768,  836, 1152}, { 896,  975, 1344}, {896, 976, 1344},
+	{1024, 1114, 1536}, {1024, 1115, 1536}, {1152, 1253, 1728},
+	{1152, 1254, 1728}, {1280, 1393, 1920}, {1280, 1394, 1920},
+};
+
+///
+///	DTS sample rate table.
+///
+static const uint32_t DtsSampleRateTable[16] =
+	{ 0,  8000, 16000, 32000, 64000,
+	  0, 11025, 22050, 44100, 88200,
+	  0, 12000, 24000, 48000, 96000, 0 };
+
+/* ------------------------------------------------------------------------- */
+
+// The parser is shared between exactly one producer (PlayAudio(), appending
+// data) and one consumer (the decoder thread, parsing and shrinking). Both
+// ring buffers use free-running indices, each written by one side only, so
+// no locking is needed. The consumer also performs the reset by dropping
+// all data it is able to see.
+
+class cAudioParser
+{
+
+public:
+
+	cAudioParser() :
+		m_buffer(0),
+		m_frame(0),
+		m_rdPtr(0),
+		m_wrPtr(0),
+		m_ptsRdIdx(0),
+		m_ptsWrIdx(0),
+		m_ptsOverflows(0),
+		m_ptsOverflowsLogged(0),
+		m_codec(cAudioCodec::eInvalid),
+		m_channels(0),
+		m_samplingRate(0),
+		m_parsed(true),
+		m_parsedWrPtr(0),
+		m_data(0),
+		m_size(0)
+	{ }
+
+	~cAudioParser()
+	{
+	}
+
+	// current frame, followed by AUDIO_PARSER_PADDING zeroed bytes
+	uint8_t* GetFrame(void)
+	{
+		if (!Parsed())
+			Parse();
+		return m_data;
+	}
+
+	cAudioCodec::eCodec GetCodec(void)
+	{
+		if (!Parsed())
+			Parse();
+		return m_codec;
+	}
+
+	unsigned int GetChannels(void)
+	{
+		if (!Parsed())
+			Parse();
+		return m_channels;
+	}
+
+	unsigned int GetSamplingRate(void)
+	{
+		if (!Parsed())
+			Parse();
+		return m_samplingRate;
+	}
+
+	unsigned int GetFrameSize(void)
+	{
+		if (!Parsed())
+			Parse();
+		return m_size;
+	}
+
+	uint64_t GetPts(void)
+	{
+		return m_ptsRdIdx != m_ptsWrIdx ?
+				m_ptsQueue[m_ptsRdIdx & (PTS_QUEUE_SIZE - 1)].pts : 0;
+	}
+
+	unsigned int GetFreeSpace(void)
+	{
+		return m_ptsWrIdx - m_ptsRdIdx < PTS_QUEUE_SIZE ?
+				AVPKT_BUFFER_SIZE - Size() : 0;
+	}
+
+	bool Empty(void)
+	{
+		if (!Parsed())
+			Parse();
+		return m_size == 0;
+	}
+
+	int Init(void)
+	{
+		m_buffer = (uint8_t *)malloc(AVPKT_BUFFER_SIZE +
+				AVPKT_MIRROR_SIZE + AUDIO_PARSER_PADDING);
+		m_frame = (uint8_t *)malloc(AVPKT_FRAME_SIZE +
+				AUDIO_PARSER_PADDING);
+
+		if (m_buffer && m_frame)
+		{
+			memset(m_buffer + AVPKT_BUFFER_SIZE, 0,
+					AVPKT_MIRROR_SIZE + AUDIO_PARSER_PADDING);
+			memset(m_frame + AVPKT_FRAME_SIZE, 0, AUDIO_PARSER_PADDING);
+
+			m_rdPtr = 0;
+			m_wrPtr = 0;
+			m_ptsRdIdx = 0;
+			m_ptsWrIdx = 0;
+			Reset();
+			return 0;
+		}
+		DeInit();
+		return -1;
+	}
+
+	int DeInit(void)
+	{
+		free(m_buffer);
+		free(m_frame);
+		m_buffer = 0;
+		m_frame = 0;
+		m_data = 0;
+		m_size = 0;
+		return 0;
+	}
+
+	// to be called by consumer only
+	void Reset(void)
+	{
+		Drop(Size());
+	}
+
+	// to be called by producer only
+	bool Append(const unsigned char *data, uint64_t pts, unsigned int length)
+	{
+		if (Size() + length > AVPKT_BUFFER_SIZE)
+			return false;
+
+		if (m_ptsWrIdx - m_ptsRdIdx >= PTS_QUEUE_SIZE)
+		{
+			m_ptsOverflows++;
+			return false;
+		}
+
+		unsigned int pos = m_wrPtr & (AVPKT_BUFFER_SIZE - 1);
+		unsigned int chunk = AVPKT_BUFFER_SIZE - pos;
+		if (chunk > length)
+			chunk = length;
+
+		memcpy(m_buffer + pos, data, chunk);
+		memcpy(m_buffer, data + chunk, length - chunk);
+
+		// update mirrored buffer start if it has been written
+		if (pos < AVPKT_MIRROR_SIZE)
+			memcpy(m_buffer + AVPKT_BUFFER_SIZE + pos, m_buffer + pos,
+					std::min(chunk, AVPKT_MIRROR_SIZE - pos));
+		if (chunk < length)
+			memcpy(m_buffer + AVPKT_BUFFER_SIZE, m_buffer,
+					std::min(length - chunk, (unsigned int)AVPKT_MIRROR_SIZE));
+
+		Pts &entry = m_ptsQueue[m_ptsWrIdx & (PTS_QUEUE_SIZE - 1)];
+		entry.pts = pts;
+		entry.length = length;
+
+		// publish PTS entry before its data, so the consumer always finds the
+		// PTS for all data it sees
+		__sync_synchronize();
+		m_ptsWrIdx++;
+		__sync_synchronize();
+		m_wrPtr += length;
+
+		return true;
+	}
+
+	// to be called by consumer only
+	void Shrink(unsigned int length, bool retainPts = false)
+	{
+		unsigned int size = Size();
+		if (length < size)
+		{
+			DropPts(length, retainPts);
+			__sync_synchronize();
+			m_rdPtr += length;
+			m_parsed = false;
+		}
+		// the producer may have appended more data in the meantime, which
+		// must not get lost
+		else
+			Drop(size);
+	}
+
+	// check for an audio frame header at p, n bytes of which are valid and at
+	// least AVPKT_MIRROR_SIZE are readable, returns the codec or eInvalid
+	static cAudioCodec::eCodec Check(const uint8_t *p, unsigned int n,
+			unsigned int &frameSize, unsigned int &channels,
+			unsigned int &samplingRate)
+	{
+		switch (FastCheck(p))
+		{
+		case cAudioCodec::eMPG:
+			if (MpegCheck(p, n, frameSize, channels, samplingRate))
+				return cAudioCodec::eMPG;
+			break;
+
+		case cAudioCodec::eAC3:
+			if (Ac3Check(p, n, frameSize, channels, samplingRate))
+				return n > 5 && p[5] > (10 << 3) ?
+						cAudioCodec::eEAC3 : cAudioCodec::eAC3;
+			break;
+
+		case cAudioCodec::eAAC:
+			if (AdtsCheck(p, n, frameSize, channels, samplingRate))
+				return cAudioCodec::eAAC;
+			break;
+
+		case cAudioCodec::eDTS:
+			if (DtsCheck(p, n, frameSize, channels, samplingRate))
+				return cAudioCodec::eDTS;
+			break;
+
+		default:
+			break;
+		}
+		return cAudioCodec::eInvalid;
+	}
+
+	// check for a possible frame start at p, AVPKT_MIRROR_SIZE bytes of which
+	// are readable
+	static cAudioCodec::eCodec FastCheck(const uint8_t *p)
+	{
+		return 	FastMpegCheck(p)  ? cAudioCodec::eMPG :
+				FastAc3Check (p)  ? cAudioCodec::eAC3 :
+				FastAdtsCheck(p)  ? cAudioCodec::eAAC :
+				FastDtsCheck (p)  ? cAudioCodec::eDTS :
+									cAudioCodec::eInvalid;
+	}
+
+private:
+
+	cAudioParser(const cAudioParser&);
+	cAudioParser& operator= (const cAudioParser&);
+
+	// number of bytes in ring buffer, pointers are running freely and
+	// wrap around together with the buffer size
+	unsigned int Size(void)
+	{
+		return m_wrPtr - m_rdPtr;
+	}
+
+	// pointer to data at given offset from current read position, at least
+	// AVPKT_MIRROR_SIZE bytes are accessible in a row
+	const uint8_t* At(unsigned int offset)
+	{
+		return m_buffer + ((m_rdPtr + offset) & (AVPKT_BUFFER_SIZE - 1));
+	}
+
+	// parsing result is valid as long as no data has been consumed or added
+	bool Parsed(void)
+	{
+		return m_parsed && m_parsedWrPtr == m_wrPtr;
+	}
+
+	// drop given number of bytes, which must not exceed what the consumer has
+	// seen, and the parsing result
+	void Drop(unsigned int size)
+	{
+		DropPts(size, false);
+		__sync_synchronize();
+		m_rdPtr += size;
+
+		m_codec = cAudioCodec::eInvalid;
+		m_channels = 0;
+		m_samplingRate = 0;
+		m_data = m_buffer;
+		m_size = 0;
+
+		// parser is empty, no need for parsing until new data arrives
+		m_parsed = true;
+		m_parsedWrPtr = m_rdPtr;
+
+		if (m_ptsOverflows != m_ptsOverflowsLogged)
+		{
+			m_ptsOverflowsLogged = m_ptsOverflows;
+			DLOG("audio parser PTS queue overflowed %u times",
+					m_ptsOverflowsLogged);
+		}
+	}
+
+	void DropPts(unsigned int length, bool retainPts)
+	{
+		while (m_ptsRdIdx != m_ptsWrIdx && length)
+		{
+			Pts &entry = m_ptsQueue[m_ptsRdIdx & (PTS_QUEUE_SIZE - 1)];
+			if (entry.length <= length)
+			{
+				length -= entry.length;
+				m_ptsRdIdx++;
+			}
+			else
+			{
+				// clear current PTS since it's not valid anymore after
+				// shrinking the packet
+				if (!retainPts)
+					entry.pts = 0;
+
+				entry.length -= length;
+				length = 0;
+			}
+		}
+	}
+
+	// Check format of first audio packet in buffer. If format has been
+	// guessed, but packet is not yet complete, codec is set with a length
+	// of 0. Once the buffer contains either the exact amount of expected
+	// data or another valid packet start after the first frame, packet
+	// size is set to the first frame length.
+	// Invalid data in front of a valid packet is dropped by moving the read
+	// pointer. If the frame wraps around the ring buffer end, it is copied
+	// to a linear frame buffer, otherwise the packet directly points into
+	// the ring buffer. If no valid audio frame has been found, packet gets
+	// cleared.
+
+	void Parse()
+	{
+		cAudioCodec::eCodec codec = cAudioCodec::eInvalid;
+		unsigned int channels = 0;
+		unsigned int offset = 0;
+		unsigned int frameSize = 0;
+		unsigned int samplingRate = 0;
+
+		unsigned int wrPtr = m_wrPtr;
+		__sync_synchronize();
+		unsigned int size = wrPtr - m_rdPtr;
+
+		while (size - offset >= 4)
+		{
+			// 0xFFE...      MPEG audio
+			// 0x0B77...     (E)AC-3 audio
+			// 0xFFF...      AAC audio
+			// 0x7FFE8001... DTS audio
+			// PCM audio can't be found
+
+			const uint8_t *p = At(offset);
+			unsigned int n = size - offset;
+
+			codec = Check(p, n, frameSize, channels, samplingRate);
+			if (codec != cAudioCodec::eInvalid)
+			{
+				// if there is enough data in buffer, check if predicted next
+				// frame start is valid
+				if (n < frameSize + 4 ||
+						FastCheck(At(offset + frameSize)) != cAudioCodec::eInvalid)
+				{
+					// if codec has been detected but buffer does not yet
+					// contains a complete frame, set size to zero to prevent
+					// frame from being decoded
+					if (frameSize > n)
+						frameSize = 0;
+
+					break;
+				}
+			}
+
+			++offset;
+		}
+
+		if (offset)
+		{
+			DBG("audio parser skipped %u of %u bytes", offset, size);
+			DropPts(offset, true);
+			__sync_synchronize();
+			m_rdPtr += offset;
+		}
+
+		if (codec != cAudioCodec::eInvalid && frameSize <= AVPKT_FRAME_SIZE)
+		{
+			m_codec = codec;
+			m_channels = channels;
+			m_samplingRate = samplingRate;
+			m_size = frameSize;
+
+			unsigned int pos = m_rdPtr & (AVPKT_BUFFER_SIZE - 1);
+			if (pos + frameSize <= AVPKT_BUFFER_SIZE)
+				m_data = m_buffer + pos;
+			else
+			{
+				unsigned int chunk = AVPKT_BUFFER_SIZE - pos;
+				memcpy(m_frame, m_buffer + pos, chunk);
+				memcpy(m_frame + chunk, m_buffer, frameSize - chunk);
+				memset(m_frame + frameSize, 0, AUDIO_PARSER_PADDING);
+				m_data = m_frame;
+			}
+		}
+		else
+			m_size = 0;
+
+		m_parsed = true;
+		m_parsedWrPtr = wrPtr;
+	}
+
+	struct Pts
+	{
+		uint64_t 		pts;
+		unsigned int 	length;
+	};
+
+	uint8_t*			m_buffer;
+	uint8_t*			m_frame;
+
+	volatile unsigned int m_rdPtr;
+	volatile unsigned int m_wrPtr;
+
+	Pts					m_ptsQueue[PTS_QUEUE_SIZE];
+	volatile unsigned int m_ptsRdIdx;
+	volatile unsigned int m_ptsWrIdx;
+	unsigned int		m_ptsOverflows;
+	unsigned int		m_ptsOverflowsLogged;
+
+	cAudioCodec::eCodec m_codec;
+	unsigned int		m_channels;
+	unsigned int		m_samplingRate;
+	bool				m_parsed;
+	unsigned int		m_parsedWrPtr;
+
+	uint8_t*			m_data;
+	unsigned int		m_size;
+
+	/* ---------------------------------------------------------------------- */
+	/*     audio codec parser helper functions, based on vdr-softhddevice     */
+	/* ---------------------------------------------------------------------- */
+
+	///
+	///	Fast check for MPEG audio.
+	///
+	///	0xFFE... MPEG audio
+	///
+	static bool FastMpegCheck(const uint8_t *p)
+	{
+		if (p[0] != 0xFF)			// 11bit frame sync
+			return false;
+		if ((p[1] & 0xE0) != 0xE0)
+			return false;
+		if ((p[1] & 0x18) == 0x08)	// version ID - 01 reserved
+			return false;
+		if (!(p[1] & 0x06))			// layer description - 00 reserved
+			return false;
+		if ((p[2] & 0xF0) == 0xF0)	// bit rate index - 1111 reserved
+			return false;
+		if ((p[2] & 0x0C) == 0x0C)	// sampling rate index - 11 reserved
+			return false;
+		return true;
+	}
+
+	///	Check for MPEG audio.
+	///
+	///	0xFFEx already checked.
+	///
+	///	From: http://www.mpgedit.org/mpgedit/mpeg_format/mpeghdr.htm
+	///
+	///	AAAAAAAA AAABBCCD EEEEFFGH IIJJKLMM
+	///
+	///	o a 11x Frame sync
+	///	o b 2x	MPEG audio version (2.5, reserved, 2, 1)
+	///	o c 2x	Layer (reserved, III, II, I)
+	///	o e 2x	BitRate index
+	///	o f 2x	SampleRate index (41000, 48000, 32000, 0)
+	///	o g 1x	Padding bit
+	/// o h 1x  Private bit
+	/// o i 2x  Channel mode
+	///	o ..	Doesn't care
+	///
+	///	frame length:
+	///	Layer I:
+	///		FrameLengthInBytes = (12 * BitRate / SampleRate + Padding) * 4
+	///	Layer II & III:
+	///		FrameLengthInBytes = 144 * BitRate / SampleRate + Padding
+	///
+	static bool MpegCheck(const uint8_t *p, unsigned int size,
+			unsigned int &frameSize, unsigned int &channels,
+			unsigned int &samplingRate)
+	{
+		// frame size is unknown as long as the header is incomplete
+		frameSize = 0;
+		if (size < 4)
+			return true;
+
+		int cmode = (p[3] >> 6) & 0x03;
+		int mpeg2 = !(p[1] & 0x08) && (p[1] & 0x10);
+		int mpeg25 = !(p[1] & 0x08) && !(p[1] & 0x10);
+		int layer = 4 - ((p[1] >> 1) & 0x03);
+		int padding = (p[2] >> 1) & 0x01;
+
+		// channel mode = [ stereo, joint stereo, dual channel, mono]
+		channels = cmode == 0x03 ? 1 : 2;
+
+		samplingRate = MpegSampleRateTable[(p[2] >> 2) & 0x03];
+		if (!samplingRate)
+			return false;
+
+		samplingRate >>= mpeg2;		// MPEG 2 half rate
+		samplingRate >>= mpeg25;	// MPEG 2.5 quarter rate
+
+		int bit_rate =
+				BitRateTable[mpeg2 | mpeg25][layer - 1][(p[2] >> 4) & 0x0F];
+		if (!bit_rate)
+			return false;
+
+		switch (layer)
+		{
+		case 1:
+			frameSize = (12000 * bit_rate) / samplingRate;
+			frameSize = (frameSize + padding) * 4;
+			break;
+		case 2:
+		case 3:
+		default:
+			frameSize = (144000 * bit_rate) / samplingRate;
+			frameSize = frameSize + padding;
+			break;
+		}
+		return true;
+	}
+
+	///
+	///	Fast check for (E-)AC-3 audio.
+	///
+	///	0x0B77... AC-3 audio
+	///
+	static bool FastAc3Check(const uint8_t *p)
+	{
+		if (p[0] != 0x0B)			// 16bit sync
+			return false;
+		if (p[1] != 0x77)
+			return false;
+		return true;
+	}
+
+	///
+	///	Check for (E-)AC-3 audio.
+	///
+	///	0x0B77xxxxxx already checked.
+	///
+	///	o AC-3 Header
+	///	AAAAAAAA AAAAAAAA BBBBBBBB BBBBBBBB CCDDDDDD EEEEEFFF GGGxxxxx
+	///
+	///	o a 16x Frame sync, always 0x0B77
+	///	o b 16x CRC 16
+	///	o c 2x	Sample rate ( 48000, 44100, 32000, reserved )
+	///	o d 6x	Frame size code
+	///	o e 5x	Bit stream ID
+	///	o f 3x	Bit stream mode
+	/// o g 3x  Audio coding mode
+	///
+	///	o E-AC-3 Header
+	///	AAAAAAAA AAAAAAAA BBCCCDDD DDDDDDDD EEFFGGGH IIIII...
+	///
+	///	o a 16x Frame sync, always 0x0B77
+	///	o b 2x	Frame type
+	///	o c 3x	Sub stream ID
+	///	o d 11x Frame size - 1 in words
+	///	o e 2x	Frame size code
+	///	o f 2x	Frame size code 2
+	/// o g 3x  Channel mode
+	/// 0 h 1x  LFE on
+	///
+	static bool Ac3Check(const uint8_t *p, unsigned int size,
+			unsigned int &frameSize, unsigned int &channels,
+			unsigned int &samplingRate)
+	{
+		// frame size is unknown as long as the header is incomplete
+		frameSize = 0;
+		if (size < 7)
+			return true;
+
+		int acmod;
+		bool lfe;
+		int fscod = (p[4] & 0xC0) >> 6;
+
+		samplingRate = Ac3SampleRateTable[fscod];
+
+		if (p[5] > (10 << 3))		// E-AC-3
+		{
+			if (fscod == 0x03)
+			{
+				int fscod2 = (p[4] & 0x30) >> 4;
+				if (fscod2 == 0x03)
+					return false;		// invalid fscod & fscod2
+
+				samplingRate = Ac3SampleRateTable[fscod2] / 2;
+			}
+
+			acmod = (p[4] & 0x0E) >> 1;	// number of channels, LFE excluded
+			lfe = p[4] & 0x01;
+
+			frameSize = ((p[2] & 0x07) << 8) + p[3] + 1;
+			frameSize *= 2;
+		}
+		else						// AC-3
+		{
+			if (fscod == 0x03)		// invalid sample rate
+				return false;
+
+			int frmsizcod = p[4] & 0x3F;
+			if (frmsizcod > 37)		// invalid frame size
+				return false;
+
+			acmod = p[6] >> 5;		// number of channels, LFE excluded
+
+			int lfe_bptr = 51;		// position of LFE bit in header for 2.0
+			if ((acmod & 0x01) && (acmod != 0x01))
+				lfe_bptr += 2;		// skip center mix level
+			if (acmod & 0x04)
+				lfe_bptr += 2;		// skip surround mix level
+			if (acmod == 0x02)
+				lfe_bptr += 2;		// skip surround mode
+			lfe = (p[lfe_bptr / 8] & (1 << (7 - (lfe_bptr % 8))));
+
+			// invalid is checked above
+			frameSize = Ac3FrameSizeTable[frmsizcod][fscod] * 2;
+		}
+
+		channels =
+			acmod == 0x00 ? 2 : 	// Ch1, Ch2
+			acmod == 0x01 ? 1 : 	// C
+			acmod == 0x02 ? 2 : 	// L, R
+			acmod == 0x03 ? 3 : 	// L, C, R
+			acmod == 0x04 ? 3 : 	// L, R, S
+			acmod == 0x05 ? 4 : 	// L, C, R, S
+			acmod == 0x06 ? 4 : 	// L, R, RL, RR
+			acmod == 0x07 ? 5 : 0;	// L, C, R, RL, RR
+
+		if (lfe) channels++;
+		return true;
+	}
+
+#if 0
+	///
+	///	Fast check for AAC LATM audio.
+	///
+	///	0x56E... AAC LATM audio
+	///
+	static bool FastLatmCheck(const uint8_t *p)
+	{
+		if (p[0] != 0x56)			// 11bit sync
+			return false;
+		if ((p[1] & 0xE0) != 0xE0)
+			return false;
+		return true;
+	}
+
+	///
+	///	Check for AAC LATM audio.
+	///
+	///	0x56Exxx already checked.
+	///
+	static bool LatmCheck(const uint8_t *p, unsigned int size,
+			unsigned int &frameSize, unsigned int &channels,
+			unsigned int &samplingRate)
+	{
+		// frame size is unknown as long as the header is incomplete
+		frameSize = 0;
+		if (size < 3)
+			return true;
+
+		// to do: determine channels
+		channels = 2;
+
+		// to do: determine sampling rate
+		samplingRate = 48000;
+
+		// 13 bit frame size without header
+		frameSize = ((p[1] & 0x1F) << 8) + p[2];
+		frameSize += 3;
+		return true;
+	}
+#endif
+	
+	///
+	///	Fast check for ADTS Audio Data Transport Stream.
+	///
+	///	0xFFF...  ADTS audio
+	///
+	static bool FastAdtsCheck(const uint8_t *p)
+	{
+		if (p[0] != 0xFF)			// 12bit sync
+			return false;
+		if ((p[1] & 0xF6) != 0xF0)	// sync + layer must be 0
+			return false;
+		if ((p[2] & 0x3C) == 0x3C)	// sampling frequency index != 15
+			return false;
+		return true;
+	}
+
+	///
+	///	Check for ADTS Audio Data Transport Stream.
+	///
+	///	0xFFF already checked.
+	///
+	///	AAAAAAAA AAAABCCD EEFFFFGH HHIJKLMM MMMMMMMM MMMOOOOO OOOOOOPP
+	///	(QQQQQQQQ QQQQQQQ)
+	///
+	///	o A*12	sync word 0xFFF
+	///	o B*1	MPEG Version: 0 for MPEG-4, 1 for MPEG-2
+	///	o C*2	layer: always 0
+	///	o ..
+	///	o F*4	sampling frequency index (15 is invalid)
+	///	o ..
+	/// o H*3	MPEG-4 channel configuration
+	/// o ...
+	///	o M*13	frame length
+	///
+	static bool AdtsCheck(const uint8_t *p, unsigned int size,
+			unsigned int &frameSize, unsigned int &channels,
+			unsigned int &samplingRate)
+	{
+		// frame size is unknown as long as the header is incomplete
+		frameSize = 0;
+		if (size < 6)
+			return true;
+
+		samplingRate = Mpeg4SampleRateTable[(p[2] >> 2) & 0x0F];
+
+		frameSize = (p[3] & 0x03) << 11;
+		frameSize |= (p[4] & 0xFF) << 3;
+		frameSize |= (p[5] & 0xE0) >> 5;
+
+	    int cConf = (p[2] & 0x01) << 7;
+	    cConf |= (p[3] & 0xC0) >> 6;
+	    channels =
+	    	cConf == 0x00 ? 0 : // defined in AOT specific config
+			cConf == 0x01 ? 1 : // C
+	    	cConf == 0x02 ? 2 : // L, R
+	    	cConf == 0x03 ? 3 : // C, L, R
+	    	cConf == 0x04 ? 4 : // C, L, R, RC
+	    	cConf == 0x05 ? 5 : // C, L, R, RL, RR
+	    	cConf == 0x06 ? 6 : // C, L, R, RL, RR, LFE
+	    	cConf == 0x07 ? 8 : // C, L, R, SL, SR, RL, RR, LFE
+				0;
+
+		if (!samplingRate || !channels)
+			return false;
+
+	    return true;
+	}
+
+	///
+	///	Fast check for DTS Audio Data Transport Stream.
+	///
+	///	0x7FFE8001....  DTS audio
+	///
+	static bool FastDtsCheck(const uint8_t *p)
+	{
+		if (p[0] != 0x7F)			// 32bit sync
+			return false;
+		if (p[1] != 0xFE)
+			return false;
+		if (p[2] != 0x80)
+			return false;
+		if (p[3] != 0x01)
+			return false;
+		return true;
+	}
+
+	///
+	///	Check for DTS Audio Data Transport Stream.
+	///
+	///	0x7FFE8001 already checked.
+	///
+	///	AAAAAAAA AAAAAAAA AAAAAAAA AAAAAAAA BCCCCCDE EEEEEEFF FFFFFFFF FFFFGGGG
+	/// GGHHHHII IIIJKLMN OOOPQRRS TTTTTTTT TTTTTTTT UVVVVWWX XXYZaaaa
+	///
+	///	o A*32	sync word 0x7FFE8001
+	///	o B*1   frame type
+	///	o C*5   deficit sample count
+	///	o D*1   CRC present flag
+	///	o E*7   number of PCM sample blocks
+	///	o F*14  primary frame size
+	///	o G*6   audio channel arrangement
+	///	o H*4   core audio sampling frequency
+	///	o I*5   transmission bit rate
+	///	o J*1   embedded downmix enabled
+	///	o K*1   embedded dynamic range flag
+	///	o L*1   embedded time stamp flag
+	///	o M*1   auxiliary data flag
+	///	o N*1   HDCD
+	///	o O*3   extension audio descriptor flag
+	///	o P*1   extended coding flag
+	///	o Q*1   audio sync word insertion flag
+	///	o R*2   low frequency effects flag
+	///	o S*1   predictor history flag
+	///	o T*16  header CRC check (if CRC present flag set)
+	///	o U*1   multi rate interpolator switch
+	///	o V*4   encoder software revision
+	///	o W*2   copy history
+	///	o X*3   source PCM resolution
+	///	o Y*1   front sum/difference flag
+	///	o Z*1   surrounds sum/difference flag
+	///	o a*4   dialog normalization parameter
+	///
+	static bool DtsCheck(const uint8_t *p, unsigned int size,
+			unsigned int &frameSize, unsigned int &channels,
+			unsigned int &samplingRate)
+	{
+		// frame size is unknown as long as the header is incomplete
+		frameSize = 0;
+		if (size < 11)
+			return true;
+
+		frameSize = ((p[5] & 0x03) << 12) + (p[6] << 4) + ((p[7] & 0xF0) >> 4);
+		frameSize++;
+
+		samplingRate = DtsSampleRateTable[(p[8] & 0x3C) >> 2];
+
+		int amode = ((p[7] & 0x0F) << 2) + ((p[8] & 0xC0) >> 6);
+		channels =
+			amode == 0x00 ? 1 : 	// mono
+			amode == 0x02 ? 2 : 	// L, R
+			amode == 0x03 ? 2 : 	// (L + R), (L - R)
+			amode == 0x04 ? 2 : 	// LT, RT
+			amode == 0x05 ? 3 : 	// L, R, C
+			amode == 0x06 ? 3 : 	// L, R, S
+			amode == 0x08 ? 4 : 	// L, R, RL, RR
+			amode == 0x09 ? 5 : 0;	// L, C, R, RL, RR
+
+		if (!samplingRate || !channels)
+			return false;
+
+		if (p[10] & 0x06) channels++;
+		return true;
+	}
+};
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+// startup time and memory of the audio decoders, opened as cRpiAudioDecoder
+// did before for all codecs at plugin start (eager) and as it does now on
+// first use of a codec (lazy). each run is a fresh process, so static tables
+// the decoders build on open are accounted for. reports the time until the
+// decoder is ready and the resident memory it added, averaged over the runs.
+// build with 'make codecbench', optional argument is the number of runs
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+
+#if LIBAVCODEC_VERSION_MAJOR < 55
+#  define AVCodecID        CodecID
+#  define AV_CODEC_ID_MP3  CODEC_ID_MP3
+#  define AV_CODEC_ID_AC3  CODEC_ID_AC3
+#  define AV_CODEC_ID_EAC3 CODEC_ID_EAC3
+#  define AV_CODEC_ID_AAC  CODEC_ID_AAC
+#  define AV_CODEC_ID_DTS  CODEC_ID_DTS
+#endif
+}
+
+// same limit as in audio.c
+#define AUDIO_MAX_CONTEXTS 2
+
+static double Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// resident set size in KiB. VmRSS of /proc/self/status is only updated in
+// batches by newer kernels, smaps_rollup counts the pages when it's read
+static long Rss(void)
+{
+	static const char *files[] = { "/proc/self/smaps_rollup", "/proc/self/status" };
+	static const char *keys[] = { "Rss:", "VmRSS:" };
+
+	for (int i = 0; i < 2; i++)
+	{
+		FILE *f = fopen(files[i], "r");
+		if (!f)
+			continue;
+
+		long rss = -1;
+		char line[128];
+		int len = strlen(keys[i]);
+		while (fgets(line, sizeof(line), f))
+			if (!strncmp(line, keys[i], len))
+				rss = atol(line + len);
+		fclose(f);
+
+		if (rss >= 0)
+			return rss;
+	}
+	return 0;
+}
+
+struct tCodec
+{
+	const char *name;
+	enum AVCodecID id;
+};
+
+// codecs decoded by cRpiAudioDecoder, PCM doesn't need a decoder
+static const tCodec codecs[] = {
+	{ "MPG",   AV_CODEC_ID_MP3  },
+	{ "AC3",   AV_CODEC_ID_AC3  },
+	{ "E-AC3", AV_CODEC_ID_EAC3 },
+	{ "AAC",   AV_CODEC_ID_AAC  },
+	{ "DTS",   AV_CODEC_ID_DTS  },
+};
+
+#define NUM_CODECS (sizeof(codecs) / sizeof(codecs[0]))
+
+// scenarios, each measured in its own process
+enum eScenario {
+	eEager,    // all contexts at startup
+	eLazyMpg,  // channel with MPEG audio only
+	eLazyAc3,  // channel with AC3 only
+	eLazyZap,  // zapping MPG -> AC3 -> AAC, LRU closes MPG
+	eNumScenarios
+};
+
+static const char *scenarioStr[] = {
+	"eager, all at start",
+	"lazy, MPG on first use",
+	"lazy, AC3 on first use",
+	"lazy, zap MPG/AC3/AAC",
+};
+
+struct tResult
+{
+	double startup; // s from plugin start until decoders are found/opened
+	double open;    // s for opening contexts on first use
+	long rss;       // KiB added by startup and first use
+	int contexts;   // contexts left open
+	bool ok;
+};
+
+static AVCodecContext *Open(AVCodec *codec)
+{
+	if (!codec)
+		return 0;
+
+	AVCodecContext *context = avcodec_alloc_context3(codec);
+	if (!context)
+		return 0;
+
+#if LIBAVCODEC_VERSION_MAJOR >= 55 && LIBAVCODEC_VERSION_MAJOR < 59
+	context->refcounted_frames = 1;
+#endif
+	if (avcodec_open2(context, codec, NULL) < 0)
+	{
+		av_free(context);
+		return 0;
+	}
+	return context;
+}
+
+static void Close(AVCodecContext *&context)
+{
+	if (context)
+	{
+		avcodec_close(context);
+		av_free(context);
+		context = 0;
+	}
+}
+
+static tResult Run(eScenario scenario)
+{
+	tResult r = { 0, 0, 0, 0, true };
+	AVCodec *codec[NUM_CODECS];
+	AVCodecContext *context[NUM_CODECS];
+	unsigned int lastUsed[NUM_CODECS];
+	unsigned int usage = 0;
+	memset(context, 0, sizeof(context));
+	memset(lastUsed, 0, sizeof(lastUsed));
+
+	long rss = Rss();
+
+	// Init()
+	double start = Now();
+#if LIBAVCODEC_VERSION_MAJOR < 59
+	avcodec_register_all();
+#endif
+	for (unsigned int i = 0; i < NUM_CODECS; i++)
+	{
+		codec[i] = (AVCodec *)avcodec_find_decoder(codecs[i].id);
+		if (scenario == eEager)
+		{
+			context[i] = Open(codec[i]);
+			r.ok &= context[i] != 0;
+		}
+	}
+	r.startup = Now() - start;
+
+	// GetContext() for the codecs of the channels tuned to
+	static const int mpg[] = { 0, -1 }, ac3[] = { 1, -1 },
+			zap[] = { 0, 1, 3, -1 };
+	const int *use = scenario == eLazyMpg ? mpg : scenario == eLazyAc3 ? ac3 :
+			scenario == eLazyZap ? zap : 0;
+
+	start = Now();
+	for (; use && *use >= 0; use++)
+	{
+		lastUsed[*use] = ++usage;
+		if (context[*use])
+			continue;
+
+		int open = 0, lru = -1;
+		for (unsigned int i = 0; i < NUM_CODECS; i++)
+			if (context[i])
+			{
+				open++;
+				if (lru < 0 || lastUsed[i] < lastUsed[lru])
+					lru = i;
+			}
+		if (open >= AUDIO_MAX_CONTEXTS)
+			Close(context[lru]);
+
+		context[*use] = Open(codec[*use]);
+		r.ok &= context[*use] != 0;
+	}
+	r.open = Now() - start;
+	r.rss = Rss() - rss;
+
+	for (unsigned int i = 0; i < NUM_CODECS; i++)
+		if (context[i])
+			r.contexts++;
+
+	for (unsigned int i = 0; i < NUM_CODECS; i++)
+		Close(context[i]);
+
+	return r;
+}
+
+// runs a scenario in a child process, which passes its result through a pipe
+static bool RunChild(eScenario scenario, tResult &r)
+{
+	int fd[2];
+	if (pipe(fd))
+		return false;
+
+	pid_t pid = fork();
+	if (pid < 0)
+		return false;
+
+	if (!pid)
+	{
+		close(fd[0]);
+		tResult result = Run(scenario);
+		bool ok = write(fd[1], &result, sizeof(result)) == sizeof(result);
+		_exit(ok ? 0 : 1);
+	}
+
+	close(fd[1]);
+	bool ok = read(fd[0], &r, sizeof(r)) == sizeof(r);
+	close(fd[0]);
+
+	int status;
+	waitpid(pid, &status, 0);
+	return ok && WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	int runs = argc > 1 ? atoi(argv[1]) : 10;
+	bool ok = runs > 0;
+
+	for (int s = 0; s < eNumScenarios && ok; s++)
+	{
+		double startup = 0, open = 0;
+		long rss = 0;
+		int contexts = 0;
+		bool valid = true;
+
+		for (int i = 0; i < runs; i++)
+		{
+			tResult r = { 0, 0, 0, 0, false };
+			valid &= RunChild((eScenario)s, r) && r.ok;
+			startup += r.startup;
+			open += r.open;
+			rss += r.rss;
+			contexts = r.contexts;
+		}
+
+		printf("%-24s startup %7.2f ms, first use %7.2f ms, "
+				"%5ld KiB RSS, %d contexts  %s\n", scenarioStr[s],
+				startup * 1e3 / runs, open * 1e3 / runs, rss / runs, contexts,
+				valid ? "ok" : "FAILED");
+		ok &= valid;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,335 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+// host benchmark of the text layout of the OpenVG OSD. EPG descriptions are
+// wrapped into lines, which are shaped by cOvgFontFace as cOvgCmdDrawText
+// does and drawn with the software font path. checks the width of shaped
+// strings against FreeType. build with 'make fontbench', optional arguments
+// are the font file and the number of passes
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include <vector>
+
+#define esyslog(a...) void()
+#define isyslog(a...) void()
+#define dsyslog(a...) void()
+
+#include "ovgfont.h"
+
+#define FONT_FILE "/usr/share/fonts/truetype/dejavu/DejaVuSans.ttf"
+
+// text area of an EPG screen at 1080p
+#define FONT_SIZE  32
+#define TEXT_WIDTH 1600
+#define PAGE_LINES 24
+
+static double Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *epg[] = {
+	"Tatort: Borowski und der gute Mensch. Ein Überfall auf einen "
+	"Geldtransporter endet tödlich, und Kommissar Borowski muss sich mit "
+	"einem Täter auseinandersetzen, der ihm näher ist, als ihm lieb sein "
+	"kann. Währenddessen ermittelt Sarah Brandt im Umfeld der Opfer und "
+	"stößt auf ein Geflecht aus Schulden, Lügen und alten Rechnungen.",
+
+	"Die Sendung mit der Maus – Lach- und Sachgeschichten, heute mit: Wie "
+	"kommt die Füllung in die Praline? Warum rollt der Käse? Außerdem "
+	"Käpt'n Blaubär, Shaun das Schaf und eine Reise zum größten Hafen "
+	"Europas. Für Kinder ab 4 Jahren geeignet.",
+
+	"Tagesschau. Themen u.a.: Bundestag berät über den Haushalt 2027; "
+	"Gipfeltreffen in Brüssel – Einigung über Energiepreise erwartet; "
+	"Unwetter in Süddeutschland: Straßen überflutet, Bahnverkehr "
+	"eingeschränkt; Fußball: Ergebnisse des 9. Spieltags. Das Wetter: "
+	"Im Norden Regen, im Süden teils sonnig bei 12 bis 17 °C.",
+
+	"Doctor Who. The Doctor and Clara arrive on a space station orbiting a "
+	"dying star, where the crew has been replaced, one by one, by "
+	"something that wears their faces. \"Don't blink\" has never been "
+	"better advice. Series 8, episode 7 of 12. Subtitles available.",
+
+	"Arte Reportage: Île de Sein – Leben am Ende der Welt. Ein Jahr lang "
+	"begleitet das Filmteam die 200 Bewohner der bretonischen Insel, "
+	"zwischen Stürmen, Fischfang und dem täglichen Fährschiff, das "
+	"Lebensmittel, Ärzte und Touristen bringt. (Frankreich 2025, 52 Min.)",
+
+	"Spielfilm, USA 1982. Los Angeles, 2019: Rick Deckard, ein ehemaliger "
+	"Blade Runner, soll vier Replikanten aufspüren, die von einer "
+	"Kolonie geflohen sind. Regie: Ridley Scott. Mit Harrison Ford, "
+	"Rutger Hauer, Sean Young. FSK 16, 117 Min., 16:9, Dolby Digital 5.1.",
+};
+
+#define EPG_SIZE (sizeof(epg) / sizeof(epg[0]))
+
+typedef std::vector<uint> tSymbols;
+
+static tSymbols ToSymbols(const char *s)
+{
+	tSymbols symbols;
+	const unsigned char *p = (const unsigned char *)s;
+	while (*p)
+	{
+		uint c = *p++;
+		if (c >= 0xf0)
+		{
+			c = (c & 0x07) << 18 | (p[0] & 0x3f) << 12 | (p[1] & 0x3f) << 6 |
+					(p[2] & 0x3f);
+			p += 3;
+		}
+		else if (c >= 0xe0)
+		{
+			c = (c & 0x0f) << 12 | (p[0] & 0x3f) << 6 | (p[1] & 0x3f);
+			p += 2;
+		}
+		else if (c >= 0xc0)
+		{
+			c = (c & 0x1f) << 6 | (p[0] & 0x3f);
+			p += 1;
+		}
+		symbols.push_back(c);
+	}
+	return symbols;
+}
+
+// width in px as the OSD measures text, by glyph advances and kerning
+static float Width(const cOvgFontFace &face, const tSymbols &text,
+		unsigned int from, unsigned int to)
+{
+	float width = 0;
+	uint prevSym = 0;
+	for (unsigned int i = from; i < to; i++)
+		if (cOvgGlyph *g = face.Glyph(text[i]))
+		{
+			width += g->AdvanceX() + face.Kerning(g, prevSym);
+			prevSym = text[i];
+		}
+	return width * FONT_SIZE;
+}
+
+// wrap texts into lines of the given width at spaces, each terminated by 0
+static void Wrap(const cOvgFontFace &face, int width,
+		std::vector<tSymbols> &lines)
+{
+	for (unsigned int i = 0; i < EPG_SIZE; i++)
+	{
+		tSymbols text = ToSymbols(epg[i]);
+		unsigned int start = 0;
+		while (start < text.size())
+		{
+			unsigned int end = text.size(), space = start;
+			for (unsigned int j = start; j < text.size(); j++)
+				if (text[j] == ' ')
+				{
+					if (space > start && Width(face, text, start, j) > width)
+					{
+						end = space;
+						break;
+					}
+					space = j;
+				}
+			if (end == text.size() && space > start &&
+					Width(face, text, start, end) > width)
+				end = space;
+
+			tSymbols line(text.begin() + start, text.begin() + end);
+			line.push_back(0);
+			lines.push_back(line);
+			start = end < text.size() ? end + 1 : end;
+		}
+	}
+}
+
+// width of a string in units of the font size, straight from FreeType
+static float FreeTypeWidth(FT_Face face, const tSymbols &line)
+{
+	FT_Pos width = 0;
+	FT_UInt prev = 0;
+	for (unsigned int i = 0; line[i]; i++)
+	{
+		FT_UInt index = FT_Get_Char_Index(face, line[i]);
+		if (FT_Load_Glyph(face, index, FT_LOAD_DEFAULT))
+			continue;
+
+		if (prev)
+		{
+			FT_Vector delta;
+			FT_Get_Kerning(face, prev, index, FT_KERNING_DEFAULT, &delta);
+			width += delta.x;
+		}
+		width += face->glyph->advance.x;
+		prev = index;
+	}
+	return (float)width / CHAR_HEIGHT;
+}
+
+/* ------------------------------------------------------------------------- */
+
+// shape pages of lines, as redrawing the OSD does. returns ns per character
+static double Layout(const cOvgFontFace &face,
+		const std::vector<tSymbols> &lines, unsigned int first,
+		unsigned int count, int passes)
+{
+	unsigned int chars = 0;
+	float width = 0;
+	double start = Now();
+	for (int p = 0; p < passes; p++)
+		for (unsigned int i = 0; i < count; i++)
+		{
+			const tSymbols &line = lines[(first + i) % lines.size()];
+			width += face.String(&line[0])->Width();
+			chars += line.size() - 1;
+		}
+	double seconds = Now() - start;
+	return width > 0 ? seconds * 1e9 / chars : 0;
+}
+
+static bool BenchLayout(FT_Library lib, const char *fontFile, int passes)
+{
+	std::vector<tSymbols> page, all;
+
+	// lines of one EPG page and, for scrolling, lines of many more widths
+	// than fit into the string cache
+	{
+		cOvgFontFace face(lib, fontFile);
+		Wrap(face, TEXT_WIDTH, page);
+		for (int w = TEXT_WIDTH / 2; w <= TEXT_WIDTH; w += 40)
+			Wrap(face, w, all);
+	}
+	unsigned int pageLines = page.size() < PAGE_LINES ?
+			page.size() : PAGE_LINES;
+
+	cOvgFontFace face(lib, fontFile);
+
+	// first page with glyphs converted from outlines
+	double cold = Layout(face, page, 0, pageLines, 1);
+
+	// redrawing the page finds all strings in the cache
+	double warm = Layout(face, page, 0, pageLines, passes);
+
+	// scrolling through more lines than are cached shapes the strings
+	// evicted meanwhile, glyphs are converted already
+	Layout(face, all, 0, all.size(), 1);
+	int misses = face.StringMisses();
+	double scroll = Layout(face, all, 0, all.size(), passes / 10 + 1);
+	misses = face.StringMisses() - misses;
+
+	// shaped strings need to be as wide as FreeType lays them out
+	FT_Face ftFace;
+	bool ok = !FT_New_Face(lib, fontFile, 0, &ftFace);
+	if (ok)
+	{
+		FT_Set_Char_Size(ftFace, 0, CHAR_HEIGHT, 0, 0);
+		for (unsigned int i = 0; i < all.size(); i++)
+			ok &= fabsf(face.String(&all[i][0])->Width() -
+					FreeTypeWidth(ftFace, all[i])) < 1e-3f;
+		FT_Done_Face(ftFace);
+	}
+
+	printf("Layout %3u lines/page: first %6.0f ns/char, redraw %5.1f "
+			"ns/char, %5u lines scrolled %5.1f ns/char (%d%% shaped)  %s\n",
+			pageLines, cold, warm, (unsigned int)all.size(), scroll,
+			(int)(misses * 100LL / ((passes / 10 + 1) * all.size())),
+			ok ? "ok" : "MISMATCH");
+
+	return ok;
+}
+
+// draw pages with the software font path, as cOvgCmdDrawText does
+static bool BenchDraw(FT_Library lib, const char *fontFile, int passes)
+{
+	std::vector<tSymbols> page;
+	cOvgFontFace face(lib, fontFile);
+	Wrap(face, TEXT_WIDTH, page);
+	unsigned int pageLines = page.size() < PAGE_LINES ?
+			page.size() : PAGE_LINES;
+
+	int lineHeight = (int)(face.Height() * FONT_SIZE);
+	cRasterSurface surface(TEXT_WIDTH + 64, pageLines * lineHeight);
+	cRasterPath path;
+
+	unsigned int chars = 0;
+	double start = Now();
+	for (int p = 0; p < passes; p++)
+	{
+		surface.Fill(0, 0, surface.Width(), surface.Height(), 0xff000000);
+		for (unsigned int l = 0; l < pageLines; l++)
+		{
+			cOvgString *string = face.String(&page[l][0]);
+
+			float scale = (float)FONT_SIZE / CHAR_HEIGHT;
+			float x = 0;
+			float y = l * lineHeight + FONT_SIZE - 1;
+
+			path.Clear();
+			for (int i = 0; i < string->Length(); i++)
+			{
+				cOvgGlyph *glyph = face.Glyph(string->GlyphIds()[i]);
+				if (!glyph)
+					continue;
+
+				path.SetTransform(scale, 0.0f, 0.0f, -scale, x, y);
+				glyph->AppendOutline(path);
+
+				x += glyph->AdvanceX() * FONT_SIZE;
+				if (i + 1 < string->Length())
+					x += string->Kerning()[i] * FONT_SIZE;
+			}
+			surface.Fill(path, 0xffffffff);
+			chars += string->Length();
+		}
+	}
+	double seconds = Now() - start;
+
+	// some ink needs to be on the surface
+	double cover = 0;
+	for (int i = 0; i < surface.Width() * surface.Height(); i++)
+		cover += (surface.Data()[i] & 0xff) / 255.0;
+	bool ok = cover > chars / passes * FONT_SIZE;
+
+	printf("Draw   %3u lines/page: %6.1f ms/page, %5.0f ns/char  %s\n",
+			pageLines, seconds * 1e3 / passes, seconds * 1e9 / chars,
+			ok ? "ok" : "MISMATCH");
+
+	return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	const char *fontFile = argc > 1 ? argv[1] : FONT_FILE;
+	int passes = argc > 2 ? atoi(argv[2]) : 1000;
+
+	FT_Library lib;
+	if (FT_Init_FreeType(&lib))
+		return 1;
+
+	FT_Face face;
+	if (FT_New_Face(lib, fontFile, 0, &face))
+	{
+		fprintf(stderr, "failed to open %s!\n", fontFile);
+		FT_Done_FreeType(lib);
+		return 1;
+	}
+	FT_Done_Face(face);
+
+	bool ok = true;
+	ok &= BenchLayout(lib, fontFile, passes);
+	ok &= BenchDraw(lib, fontFile, passes / 10 + 1);
+
+	FT_Done_FreeType(lib);
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,940 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+// host benchmark of the CPU kernels, the audio parser and the software OSD
+// rasterizer, checks each of them against a plain reference and reports its
+// throughput. build with 'make kernelbench'
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include <queue>
+#include <vector>
+
+// the audio parser logs through VDR, which isn't available here
+#define esyslog(a...) void()
+#define isyslog(a...) void()
+#define dsyslog(a...) void()
+
+#include "kernels.h"
+#include "audioparser.h"
+#include "rasterizer.h"
+
+static double Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int Random(void)
+{
+	static unsigned int seed = 1;
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+// frames processed in the given time, each of them with size units
+static bool Report(const char *name, int frames, int size, const char *unit,
+		double seconds, bool ok)
+{
+	printf("%-36s %9.1f frames/s %8.1f M%s/s  %s\n", name,
+			frames / seconds, (double)size * frames / seconds / 1e6, unit,
+			ok ? "ok" : "MISMATCH");
+	return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+
+static bool BenchExpand(int width, int height, int numColors, int frames)
+{
+	uint32_t palette[256];
+	memset(palette, 0, sizeof(palette));
+	for (int i = 0; i < numColors; i++)
+		palette[i] = Random() | 0xff000000;
+
+	uint8_t *src = (uint8_t *)malloc(width * height);
+	uint32_t *dst = (uint32_t *)malloc(width * height * sizeof(uint32_t));
+	for (int i = 0; i < width * height; i++)
+		src[i] = Random() % numColors;
+
+	double start = Now();
+	for (int f = 0; f < frames; f++)
+		for (int y = 0; y < height; y++)
+			cPixelKernels::Expand(dst + y * width, src + y * width, width,
+					palette, numColors);
+	double seconds = Now() - start;
+
+	bool ok = true;
+	for (int i = 0; i < width * height && ok; i++)
+		ok = dst[i] == palette[src[i]];
+
+	char name[64];
+	snprintf(name, sizeof(name), "Expand %dx%d, %d colors",
+			width, height, numColors);
+	free(src);
+	free(dst);
+	return Report(name, frames, width * height, "px", seconds, ok);
+}
+
+// two lines of subtitle text in an 8 bit bitmap of a few colors in use:
+// runs of transparent background, glyph strokes with outline and anti-aliased
+// edges. passed with the colors in use, as the OSD does, or with all 256, as
+// it did before
+static bool BenchExpandSubtitle(int width, int height, int usedColors,
+		bool allColors, int frames)
+{
+	uint32_t palette[256];
+	memset(palette, 0, sizeof(palette));
+	for (int i = 1; i < usedColors; i++)
+		palette[i] = Random() | 0xff000000;
+
+	uint8_t *src = (uint8_t *)calloc(width * height, 1);
+	uint32_t *dst = (uint32_t *)malloc(width * height * sizeof(uint32_t));
+	for (int y = 0; y < height; y++)
+	{
+		// text rows in the middle of each half, words in the middle of the
+		// row
+		int row = y % (height / 2);
+		if (row < height / 8 || row >= height * 3 / 8)
+			continue;
+
+		for (int x = width / 5; x < width * 4 / 5; )
+		{
+			// gap between glyphs or words
+			x += 2 + Random() % (Random() % 8 ? 6 : 24);
+
+			// stroke: anti-aliased edge, outline, fill, outline, edge
+			int fill = 2 + Random() % 5;
+			int stroke[] = { usedColors - 1, 2, 1, 2, usedColors - 1 };
+			int length[] = { 1, 2, fill, 2, 1 };
+			for (int i = 0; i < 5; i++)
+				for (int l = 0; l < length[i] && x < width; l++)
+					src[y * width + x++] = stroke[i];
+		}
+	}
+
+	double start = Now();
+	for (int f = 0; f < frames; f++)
+		for (int y = 0; y < height; y++)
+			cPixelKernels::Expand(dst + y * width, src + y * width, width,
+					palette, allColors ? 256 : usedColors);
+	double seconds = Now() - start;
+
+	bool ok = true;
+	for (int i = 0; i < width * height && ok; i++)
+		ok = dst[i] == palette[src[i]];
+
+	char name[64];
+	snprintf(name, sizeof(name), "Expand subtitle %dx%d, %d of %d",
+			width, height, usedColors, allColors ? 256 : usedColors);
+	free(src);
+	free(dst);
+	return Report(name, frames, width * height, "px", seconds, ok);
+}
+
+// layers blended with premultiplied alpha, then converted back, as the raw
+// OSD composes its pixmaps
+static bool BenchCompose(int width, int height, int frames)
+{
+	const int numLayers = 3;
+	const int layerAlpha[numLayers] = { 255, 255, 160 };
+
+	uint32_t *layers[numLayers];
+	for (int l = 0; l < numLayers; l++)
+	{
+		layers[l] = (uint32_t *)malloc(width * height * sizeof(uint32_t));
+		for (int i = 0; i < width * height; i++)
+			layers[l][i] = Random() << 8 | (Random() & 0xff);
+	}
+	uint32_t *dst = (uint32_t *)malloc(width * height * sizeof(uint32_t));
+
+	double start = Now();
+	for (int f = 0; f < frames; f++)
+		for (int y = 0; y < height; y++)
+		{
+			uint32_t *row = dst + y * width;
+			memset(row, 0, width * sizeof(uint32_t));
+			for (int l = 0; l < numLayers; l++)
+				cPixelKernels::BlendRow(row, layers[l] + y * width, width,
+						layerAlpha[l]);
+			cPixelKernels::Unpremultiply(row, width);
+		}
+	double seconds = Now() - start;
+
+	// each layer rounds to 8 bits, which leaves less precision for the
+	// colors of nearly transparent pixels
+	bool ok = true;
+	for (int i = 0; i < width * height && ok; i++)
+	{
+		double c[4] = { 0, 0, 0, 0 };
+		for (int l = 0; l < numLayers; l++)
+		{
+			uint32_t s = layers[l][i];
+			double a = floor((s >> 24) * layerAlpha[l] / 255.0 + 0.5) / 255.0;
+			for (int ch = 0; ch < 3; ch++)
+				c[ch] = (s >> (16 - 8 * ch) & 0xff) * a + c[ch] * (1 - a);
+			c[3] = a + c[3] * (1 - a);
+		}
+
+		int a = (int)(c[3] * 255 + 0.5);
+		ok = abs((int)(dst[i] >> 24) - a) <= 1;
+		int tolerance = numLayers + 255 * numLayers / (a + 1);
+		for (int ch = 0; ch < 3 && ok && a; ch++)
+			ok = abs((int)(dst[i] >> (16 - 8 * ch) & 0xff) -
+					(int)(c[ch] / c[3] + 0.5)) <= tolerance;
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "Compose %dx%d, %d layers",
+			width, height, numLayers);
+	for (int l = 0; l < numLayers; l++)
+		free(layers[l]);
+	free(dst);
+	return Report(name, frames, width * height, "px", seconds, ok);
+}
+
+/* ------------------------------------------------------------------------- */
+
+static int16_t RefS16(float sample)
+{
+	float s = roundf(sample * 32768.0f);
+	return s < -32768.0f ? -32768 : s > 32767.0f ? 32767 : (int16_t)s;
+}
+
+#define PCM_FRAME_SIZE 1536 // samples per frame, as of AC-3
+
+// what swr_convert() does for a planar float 5.x to stereo signed 16 bit down
+// mix with default settings, as libswresample isn't available on the host:
+// matrix of swr_build_matrix() (center and surround at -3dB, LFE at 0,
+// normalized by the largest sum of a row), mixed per output channel in float
+// by rematrix.c and converted with lrintf() and clipped by audioconvert.c
+static void SwrDownMix(int16_t *dst, const float **src, int samples,
+		int channels, float *tmp)
+{
+	float matrix[2][6] = { { 0 } };
+	matrix[0][0] = matrix[1][1] = 1;
+	matrix[0][2] = matrix[1][2] = M_SQRT1_2;
+	matrix[0][channels - 2] = matrix[1][channels - 1] = M_SQRT1_2;
+
+	double maxCoef = 1 + 2 * M_SQRT1_2;
+	for (int o = 0; o < 2; o++)
+		for (int c = 0; c < channels; c++)
+			matrix[o][c] /= maxCoef;
+
+	for (int o = 0; o < 2; o++)
+		for (int i = 0; i < samples; i++)
+		{
+			float v = 0;
+			for (int c = 0; c < channels; c++)
+				if (matrix[o][c])
+					v += src[c][i] * matrix[o][c];
+			tmp[o * samples + i] = v;
+		}
+
+	for (int i = 0; i < samples; i++)
+		for (int o = 0; o < 2; o++)
+		{
+			long v = lrintf(tmp[o * samples + i] * (1 << 15));
+			*dst++ = v < -32768 ? -32768 : v > 32767 ? 32767 : v;
+		}
+}
+
+// conversion of same channel count or down mix of 5 or 6 channels
+static bool BenchPcm(int inChannels, int frames)
+{
+	bool downMix = inChannels > 2;
+	float *planes[6];
+	for (int ch = 0; ch < inChannels; ch++)
+	{
+		planes[ch] = (float *)malloc(PCM_FRAME_SIZE * sizeof(float));
+		for (int i = 0; i < PCM_FRAME_SIZE; i++)
+			planes[ch][i] = (int)(Random() % 80000 - 40000) / 32768.0f;
+	}
+	// exact halves to check the rounding
+	planes[0][0] = 0.5f / 32768.0f;
+	planes[1][1] = -2.5f / 32768.0f;
+
+	int16_t *dst = (int16_t *)malloc(PCM_FRAME_SIZE * 2 * sizeof(int16_t));
+	const float **src = (const float **)planes;
+
+	double start = Now();
+	for (int f = 0; f < frames; f++)
+	{
+		if (downMix)
+			cPcmKernels::Fltp5xToS16Stereo(dst, src, PCM_FRAME_SIZE,
+					inChannels);
+		else
+			cPcmKernels::FltpToS16(dst, src, PCM_FRAME_SIZE, inChannels);
+	}
+	double seconds = Now() - start;
+
+	bool ok = true;
+	if (!downMix)
+	{
+		for (int i = 0; i < PCM_FRAME_SIZE && ok; i++)
+			ok = dst[2 * i] == RefS16(planes[0][i]) &&
+				dst[2 * i + 1] == RefS16(planes[1][i]);
+
+		for (int ch = 0; ch < inChannels; ch++)
+			free(planes[ch]);
+		free(dst);
+		return Report("FltpToS16 stereo", frames, PCM_FRAME_SIZE, "samples",
+				seconds, ok);
+	}
+
+	// the result of libswresample may differ by one, as it rounds half to
+	// even and the vector version adds the products in a different order
+	int16_t *ref = (int16_t *)malloc(PCM_FRAME_SIZE * 2 * sizeof(int16_t));
+	float *tmp = (float *)malloc(PCM_FRAME_SIZE * 2 * sizeof(float));
+
+	double swrStart = Now();
+	for (int f = 0; f < frames; f++)
+		SwrDownMix(ref, src, PCM_FRAME_SIZE, inChannels, tmp);
+	double swrSeconds = Now() - swrStart;
+
+	int diffs = 0;
+	for (int i = 0; i < PCM_FRAME_SIZE * 2; i++)
+	{
+		ok &= abs(dst[i] - ref[i]) <= 1;
+		diffs += dst[i] != ref[i];
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "Fltp5xToS16Stereo 5.%d",
+			inChannels == 6 ? 1 : 0);
+	ok = Report(name, frames, PCM_FRAME_SIZE, "samples", seconds, ok);
+
+	snprintf(name, sizeof(name), "swr_convert 5.%d, C path",
+			inChannels == 6 ? 1 : 0);
+	Report(name, frames, PCM_FRAME_SIZE, "samples", swrSeconds, true);
+	printf("  %d of %d samples differ by one from swr_convert\n", diffs,
+			PCM_FRAME_SIZE * 2);
+
+	for (int ch = 0; ch < inChannels; ch++)
+		free(planes[ch]);
+	free(tmp);
+	free(ref);
+	free(dst);
+	return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+
+// elementary stream of MPEG layer II (256 kbit/s) or AC-3 (448 kbit/s, 5.1)
+// frames at 48 kHz with random payload, split into PES payloads of random
+// size which aren't aligned to the frames
+
+struct tAudioStream
+{
+	std::vector<uint8_t> data;
+	std::vector<unsigned int> pes;
+	std::vector<bool> pesStart;
+	unsigned int frameSize;
+};
+
+static void MakeAudioStream(tAudioStream &s, bool ac3, unsigned int size,
+		bool tiny = false)
+{
+	static const uint8_t mp2[] = { 0xff, 0xfd, 0xc4, 0x04 };
+	static const uint8_t ac3hdr[] = { 0x0b, 0x77, 0x00, 0x00, 0x1e, 0x40, 0xe1 };
+
+	s.frameSize = ac3 ? 1792 : 768;
+	size -= size % s.frameSize;
+	s.data.resize(size);
+	for (unsigned int i = 0; i < size; i++)
+		s.data[i] = Random();
+	for (unsigned int i = 0; i < size; i += s.frameSize)
+		if (ac3)
+			memcpy(&s.data[i], ac3hdr, sizeof(ac3hdr));
+		else
+			memcpy(&s.data[i], mp2, sizeof(mp2));
+
+	s.pes.clear();
+	s.pesStart.assign(size, false);
+	for (unsigned int pos = 0; pos < size; )
+	{
+		// tiny payloads let the PTS queue run full before the ring does,
+		// others end with a frame like broadcast PES usually do
+		unsigned int length = Random() % 4096 + 1;
+		if (tiny && Random() % 2)
+			length = Random() % 16 + 1;
+		else if (tiny && Random() % 2)
+			length = s.frameSize - pos % s.frameSize;
+		if (length > size - pos)
+			length = size - pos;
+		s.pes.push_back(length);
+		s.pesStart[pos] = true;
+		pos += length;
+	}
+}
+
+// the parser as it was before it became a ring: a linear buffer which is
+// moved down on each shrink, heap allocated PTS entries and a (recursive)
+// mutex taken by every call, using the same frame header checks
+
+class cLinearAudioParser
+{
+public:
+
+	cLinearAudioParser() :
+		m_buffer((uint8_t *)malloc(AVPKT_BUFFER_SIZE)),
+		m_size(0), m_frameSize(0), m_parsed(true), m_copied(0), m_locks(0)
+	{
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&m_mutex, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+
+	~cLinearAudioParser()
+	{
+		Reset();
+		pthread_mutex_destroy(&m_mutex);
+		free(m_buffer);
+	}
+
+	bool Append(const uint8_t *data, uint64_t pts, unsigned int length)
+	{
+		Lock();
+		bool ret = m_size + length + AUDIO_PARSER_PADDING <= AVPKT_BUFFER_SIZE;
+		if (ret)
+		{
+			memcpy(m_buffer + m_size, data, length);
+			m_size += length;
+			m_copied += length;
+			memset(m_buffer + m_size, 0, AUDIO_PARSER_PADDING);
+			m_pts.push(new Pts(pts, length));
+			m_parsed = false;
+		}
+		Unlock();
+		return ret;
+	}
+
+	void Shrink(unsigned int length, bool retainPts = false)
+	{
+		Lock();
+		if (length < m_size)
+		{
+			memmove(m_buffer, m_buffer + length, m_size - length);
+			m_size -= length;
+			m_copied += m_size;
+			memset(m_buffer + m_size, 0, AUDIO_PARSER_PADDING);
+
+			while (!m_pts.empty() && length)
+			{
+				if (m_pts.front()->length <= length)
+				{
+					length -= m_pts.front()->length;
+					delete m_pts.front();
+					m_pts.pop();
+				}
+				else
+				{
+					if (!retainPts)
+						m_pts.front()->pts = 0;
+					m_pts.front()->length -= length;
+					length = 0;
+				}
+			}
+			m_parsed = false;
+		}
+		else
+			Reset();
+		Unlock();
+	}
+
+	uint64_t GetPts(void)
+	{
+		Lock();
+		uint64_t pts = m_pts.empty() ? 0 : m_pts.front()->pts;
+		Unlock();
+		return pts;
+	}
+
+	bool Empty(void)
+	{
+		if (!m_parsed)
+			Parse();
+		return !m_frameSize;
+	}
+
+	uint8_t *GetFrame(void)         { return m_buffer;    }
+	unsigned int GetFrameSize(void) { return m_frameSize; }
+	uint64_t Copied(void)           { return m_copied;    }
+	uint64_t Locks(void)            { return m_locks;     }
+
+private:
+
+	struct Pts
+	{
+		Pts(uint64_t _pts, unsigned int _length) :
+			pts(_pts), length(_length) { }
+
+		uint64_t pts;
+		unsigned int length;
+	};
+
+	void Lock(void)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_locks++;
+	}
+
+	void Unlock(void)
+	{
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	void Reset(void)
+	{
+		Lock();
+		m_size = 0;
+		m_frameSize = 0;
+		m_parsed = true;
+		while (!m_pts.empty())
+		{
+			delete m_pts.front();
+			m_pts.pop();
+		}
+		Unlock();
+	}
+
+	void Parse(void)
+	{
+		Lock();
+		unsigned int offset = 0, frameSize = 0, channels, samplingRate;
+		cAudioCodec::eCodec codec = cAudioCodec::eInvalid;
+
+		while (m_size - offset >= 4)
+		{
+			const uint8_t *p = m_buffer + offset;
+			unsigned int n = m_size - offset;
+
+			codec = cAudioParser::Check(p, n, frameSize, channels,
+					samplingRate);
+			if (codec != cAudioCodec::eInvalid && (n < frameSize + 4 ||
+					cAudioParser::FastCheck(p + frameSize) !=
+						cAudioCodec::eInvalid))
+			{
+				if (frameSize > n)
+					frameSize = 0;
+				break;
+			}
+			++offset;
+		}
+		if (offset)
+			Shrink(offset, true);
+
+		m_frameSize = codec != cAudioCodec::eInvalid ? frameSize : 0;
+		m_parsed = true;
+		Unlock();
+	}
+
+	pthread_mutex_t m_mutex;
+	uint8_t *m_buffer;
+	unsigned int m_size;
+	unsigned int m_frameSize;
+	bool m_parsed;
+	std::queue<Pts *> m_pts;
+	uint64_t m_copied;
+	uint64_t m_locks;
+};
+
+// counts the bytes copied by the ring buffer parser: the appended data, the
+// mirrored ring start and frames wrapping around the ring end
+
+class cRingAudioParser : public cAudioParser
+{
+public:
+
+	cRingAudioParser() : m_wrPos(0), m_rdPos(0), m_copied(0) { Init(); }
+	~cRingAudioParser() { DeInit(); }
+
+	bool Append(const uint8_t *data, uint64_t pts, unsigned int length)
+	{
+		if (!cAudioParser::Append(data, pts, length))
+			return false;
+
+		unsigned int pos = m_wrPos & (AVPKT_BUFFER_SIZE - 1);
+		unsigned int chunk = std::min(AVPKT_BUFFER_SIZE - pos, length);
+		m_copied += length;
+		if (pos < AVPKT_MIRROR_SIZE)
+			m_copied += std::min(chunk, AVPKT_MIRROR_SIZE - pos);
+		if (chunk < length)
+			m_copied += std::min(length - chunk, (unsigned int)AVPKT_MIRROR_SIZE);
+
+		m_wrPos += length;
+		return true;
+	}
+
+	uint8_t *GetFrame(void)
+	{
+		unsigned int pos = m_rdPos & (AVPKT_BUFFER_SIZE - 1);
+		if (pos + GetFrameSize() > AVPKT_BUFFER_SIZE)
+			m_copied += GetFrameSize();
+		return cAudioParser::GetFrame();
+	}
+
+	void Shrink(unsigned int length)
+	{
+		cAudioParser::Shrink(length);
+		m_rdPos += length;
+	}
+
+	uint64_t Copied(void) { return m_copied; }
+	uint64_t Locks(void)  { return 0;        }
+
+private:
+
+	unsigned int m_wrPos;
+	unsigned int m_rdPos;
+	uint64_t m_copied;
+};
+
+// feed the stream as PlayAudio() does, while the decoder lags behind by
+// backlog bytes, checks frame data and PTS attribution if requested
+template<class T> static bool ParseStream(T &parser, const tAudioStream &s,
+		unsigned int backlog, bool verify, int &frames)
+{
+	const uint8_t *data = &s.data[0];
+	unsigned int wr = 0, rd = 0;
+	bool ok = true;
+
+	for (unsigned int i = 0; i <= s.pes.size(); i++)
+	{
+		if (i < s.pes.size())
+		{
+			if (!parser.Append(data + wr, wr + 1, s.pes[i]))
+				return false;
+			wr += s.pes[i];
+		}
+		// the decoder catches up at the end of the stream
+		else
+			backlog = 0;
+
+		while (wr - rd > backlog && !parser.Empty())
+		{
+			unsigned int size = parser.GetFrameSize();
+			const uint8_t *frame = parser.GetFrame();
+			uint64_t pts = parser.GetPts();
+
+			// a frame gets the PTS of the PES starting with it
+			if (verify)
+				ok &= size == s.frameSize && !memcmp(frame, data + rd, size) &&
+						pts == (s.pesStart[rd] ? rd + 1 : 0);
+
+			parser.Shrink(size);
+			rd += size;
+			frames++;
+		}
+	}
+	return ok && rd == wr;
+}
+
+template<class T> static bool BenchParser(const char *name,
+		const tAudioStream &s, unsigned int backlog, int passes)
+{
+	int frames = 0;
+	bool ok;
+	{
+		T parser;
+		ok = ParseStream(parser, s, backlog, true, frames);
+	}
+
+	T parser;
+	frames = 0;
+	double start = Now();
+	for (int i = 0; i < passes; i++)
+		ok &= ParseStream(parser, s, backlog, false, frames);
+	double seconds = Now() - start;
+
+	char str[64];
+	snprintf(str, sizeof(str), "%s %s, backlog %uk", name,
+			s.frameSize == 768 ? "MP2" : "AC-3", backlog / 1024);
+	ok = Report(str, frames, s.frameSize, "B", seconds, ok);
+	printf("%-36s %9.0f ns/frame %8.0f B copied/frame  %.1f locks/frame\n",
+			"", seconds * 1e9 / frames, (double)parser.Copied() / frames,
+			(double)parser.Locks() / frames);
+	return ok;
+}
+
+// producer and consumer on two threads, as PlayAudio() and the decoder thread
+// use the parser. checks that every frame arrives in order with its data and
+// PTS, while both the ring and the PTS queue wrap around and run full
+
+struct tParserStress
+{
+	cAudioParser parser;
+	const tAudioStream *stream;
+	volatile bool done;
+	volatile bool abort;
+	int stalls;
+};
+
+static void *ParserProducer(void *arg)
+{
+	tParserStress *t = (tParserStress *)arg;
+	const tAudioStream &s = *t->stream;
+	unsigned int wr = 0;
+
+	for (unsigned int i = 0; i < s.pes.size() && !t->abort; i++)
+	{
+		while (!t->parser.Append(&s.data[wr], wr + 1, s.pes[i]) && !t->abort)
+		{
+			t->stalls++;
+			sched_yield();
+		}
+		wr += s.pes[i];
+	}
+	__sync_synchronize();
+	t->done = true;
+	return 0;
+}
+
+static bool StressParser(bool ac3, int passes)
+{
+	tAudioStream s;
+	MakeAudioStream(s, ac3, 16 << 20, true);
+
+	bool ok = true;
+	int frames = 0, stalls = 0;
+	double start = Now();
+
+	for (int i = 0; i < passes && ok; i++)
+	{
+		tParserStress t;
+		t.parser.Init();
+		t.stream = &s;
+		t.done = false;
+		t.abort = false;
+		t.stalls = 0;
+
+		pthread_t producer;
+		pthread_create(&producer, 0, ParserProducer, &t);
+
+		unsigned int rd = 0;
+		while (ok)
+		{
+			if (t.parser.Empty())
+			{
+				// everything appended has been seen, nothing may be left
+				bool done = t.done;
+				__sync_synchronize();
+				if (done && t.parser.Empty())
+					break;
+
+				sched_yield();
+				continue;
+			}
+
+			unsigned int size = t.parser.GetFrameSize();
+			uint64_t pts = t.parser.GetPts();
+			ok = size == s.frameSize && rd + size <= s.data.size() &&
+					!memcmp(t.parser.GetFrame(), &s.data[rd], size) &&
+					pts == (s.pesStart[rd] ? rd + 1 : 0);
+
+			t.parser.Shrink(size);
+			rd += size;
+			frames++;
+		}
+		if (!ok)
+		{
+			printf("parser mismatch at offset %u\n", rd);
+			t.abort = true;
+		}
+
+		pthread_join(producer, 0);
+		t.parser.DeInit();
+
+		ok &= rd == s.data.size();
+		stalls += t.stalls;
+	}
+	double seconds = Now() - start;
+
+	char name[64];
+	snprintf(name, sizeof(name), "Parse 2 threads %s, %d stalls",
+			ac3 ? "AC-3" : "MP2", stalls);
+	return Report(name, frames, s.frameSize, "B", seconds, ok);
+}
+
+static bool BenchParsers(int passes)
+{
+	tAudioStream mp2, ac3;
+	MakeAudioStream(mp2, false, 4 << 20);
+	MakeAudioStream(ac3, true, 4 << 20);
+
+	bool ok = true;
+	ok &= BenchParser<cLinearAudioParser>("Parse linear", mp2, 0, passes);
+	ok &= BenchParser<cRingAudioParser>("Parse ring", mp2, 0, passes);
+	ok &= BenchParser<cLinearAudioParser>("Parse linear", ac3, 0, passes);
+	ok &= BenchParser<cRingAudioParser>("Parse ring", ac3, 0, passes);
+
+	// about one second of AC-3 queued up in front of the decoder
+	ok &= BenchParser<cLinearAudioParser>("Parse linear", ac3, 64 * 1024,
+			passes);
+	ok &= BenchParser<cRingAudioParser>("Parse ring", ac3, 64 * 1024,
+			passes);
+
+	ok &= StressParser(false, passes);
+	ok &= StressParser(true, passes);
+	return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+
+// shapes of size px on a grid, either ellipses or rings with a hole of half
+// the radius, as glyphs have. checked by the total coverage
+static bool BenchPath(bool ring, int size, int frames)
+{
+	const int width = 1280, height = 720;
+	int cols = width / size, rows = height / size;
+	cRasterSurface surface(width, height);
+	cRasterPath path;
+
+	double start = Now();
+	for (int f = 0; f < frames; f++)
+	{
+		surface.Fill(0, 0, width, height, 0);
+		for (int y = 0; y < rows; y++)
+			for (int x = 0; x < cols; x++)
+			{
+				// unit square with y pointing up, as drawn by the OSD
+				path.Clear();
+				path.SetTransform(size, 0.0f, 0.0f, -size,
+						x * size + 0.25f, (y + 1) * size - 0.25f);
+				if (ring)
+				{
+					path.MoveTo(1.0f, 0.5f);
+					path.ArcTo(0.5f, 0.5f, 0.5f, 0.5f, 0, 360);
+					path.MoveTo(0.75f, 0.5f);
+					path.ArcTo(0.5f, 0.5f, 0.25f, 0.25f, 0, -360);
+					path.Close();
+				}
+				else
+					path.Ellipse(0);
+
+				surface.Fill(path, 0xffffffff);
+			}
+	}
+	double seconds = Now() - start;
+
+	double cover = 0;
+	for (int i = 0; i < width * height; i++)
+		cover += (surface.Data()[i] >> 24) / 255.0;
+
+	// flattened curves may be off by a tenth of a pixel along the outline
+	double expected = cols * rows * M_PI * size * size / 4 * (ring ? 0.75 : 1);
+	double outline = cols * rows * M_PI * size * (ring ? 1.5 : 1);
+	bool ok = fabs(cover - expected) < outline * 0.1;
+
+	char name[64];
+	snprintf(name, sizeof(name), "Fill %s %dpx", ring ? "ring" : "ellipse",
+			size);
+	return Report(name, frames, cols * rows * size * size, "px", seconds, ok);
+}
+
+// layer alpha is applied to the source alpha in 8 bits, as the OSD does
+static uint32_t RefSrcOver(uint32_t s, uint32_t d, int alpha)
+{
+	double sa = floor((s >> 24) * alpha / 255.0 + 0.5) / 255.0;
+	double da = (d >> 24) / 255.0;
+	double a = sa + da * (1 - sa);
+	if (a <= 0)
+		return d;
+
+	uint32_t out = (uint32_t)(a * 255 + 0.5) << 24;
+	for (int shift = 0; shift < 24; shift += 8)
+	{
+		double c = ((s >> shift & 0xff) * sa +
+				(d >> shift & 0xff) * da * (1 - sa)) / a;
+		out |= (uint32_t)(c + 0.5) << shift;
+	}
+	return out;
+}
+
+// blend a layer over a surface, as the OSD does for each pixmap
+static bool BenchSrcOver(int width, int height, int alpha, int frames)
+{
+	cRasterSurface surface(width, height);
+	uint32_t *layer = (uint32_t *)malloc(width * height * sizeof(uint32_t));
+	uint32_t *ref = (uint32_t *)malloc(width * height * sizeof(uint32_t));
+	for (int i = 0; i < width * height; i++)
+	{
+		layer[i] = Random() << 8 | (Random() & 0xff);
+		ref[i] = Random() << 8 | (Random() & 0xff);
+	}
+
+	double seconds = 0;
+	for (int f = 0; f < frames; f++)
+	{
+		memcpy(surface.Data(), ref, width * height * sizeof(uint32_t));
+		double start = Now();
+		surface.Draw(0, 0, layer, width, width, height, 0, 0, width, height,
+				alpha, true);
+		seconds += Now() - start;
+	}
+
+	// rounding may differ by one, weights of 8 bits leave less precision for
+	// the colors of nearly transparent pixels
+	bool ok = true;
+	for (int i = 0; i < width * height && ok; i++)
+	{
+		uint32_t d = surface.Data()[i], r = RefSrcOver(layer[i], ref[i], alpha);
+		int tolerance = 1;
+		for (int shift = 24; shift >= 0 && ok; shift -= 8)
+		{
+			ok = abs((int)(d >> shift & 0xff) - (int)(r >> shift & 0xff)) <=
+					tolerance;
+			tolerance = 1 + 128 / ((r >> 24) + 1);
+		}
+	}
+
+	char name[64];
+	snprintf(name, sizeof(name), "SrcOver %dx%d, alpha %d", width, height,
+			alpha);
+	free(layer);
+	free(ref);
+	return Report(name, frames, width * height, "px", seconds, ok);
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 100;
+	bool ok = true;
+
+	ok &= BenchExpand(1280, 720, 16, frames);
+	ok &= BenchExpand(1920, 1080, 16, frames);
+	ok &= BenchExpand(1280, 720, 256, frames);
+	ok &= BenchExpand(1920, 1080, 256, frames);
+	ok &= BenchExpandSubtitle(1920, 160, 4, true, frames * 10);
+	ok &= BenchExpandSubtitle(1920, 160, 4, false, frames * 10);
+	ok &= BenchExpandSubtitle(1920, 160, 24, true, frames * 10);
+	ok &= BenchExpandSubtitle(1920, 160, 24, false, frames * 10);
+	ok &= BenchCompose(1280, 720, frames);
+	ok &= BenchCompose(1920, 1080, frames);
+
+	ok &= BenchPcm(2, frames * 100);
+	ok &= BenchPcm(6, frames * 100);
+	ok &= BenchPcm(5, frames * 100);
+	ok &= BenchParsers(frames / 20 + 1);
+
+	ok &= BenchPath(false, 40, frames);
+	ok &= BenchPath(false, 240, frames);
+	ok &= BenchPath(true, 24, frames);
+	ok &= BenchSrcOver(1280, 720, 255, frames);
+	ok &= BenchSrcOver(1920, 1080, 192, frames);
+
+	return ok ? 0 : 1;
+}
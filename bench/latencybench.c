@@ -0,0 +1,202 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+// offline replay of live mode PTS/STC traces through the latency controller
+// of cOmxDevice. PTS of a sender with drifting clock arrive with jitter, STC
+// runs at the speed corrected by the controller, quantized to clock scale
+// steps as cOmxDevice applies it. checks that latency converges to its target
+// without oscillating. build with 'make latencybench'
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+#define esyslog(a...) void()
+#define isyslog(a...) void()
+#define dsyslog(a...) void()
+
+#include "latency.h"
+
+// samples per second, one per video frame and audio frame in average
+#define SAMPLE_RATE 56
+
+static unsigned int seed = 1;
+
+static unsigned int Random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+// uniformly distributed in [0, 1)
+static double Uniform(void)
+{
+	return (Random() & 0xffffff) / (double)0x1000000;
+}
+
+struct tTrace
+{
+	const char *name;
+	double drift;       // sender clock against local clock, ppm
+	double jitter;      // uniform network/demux jitter, ms
+	double burst;       // extra delay of occasional bursts, ms
+	double latency;     // initial latency, ms
+	int target;         // setup target, 0 for automatic
+	int seconds;        // length of the trace
+};
+
+struct tResult
+{
+	double settle;      // seconds until the error stays in band
+	double overshoot;   // largest error beyond target, ms
+	int crossings;      // crossings of the band from one side to the other
+	double error;       // mean absolute error of the last quarter, ms
+	double correction;  // mean correction of the last quarter, ppm
+	double changes;     // clock scale changes per minute
+};
+
+// clock scale is 16.16 fixed point, changes of less than two steps are
+// ignored, see cOmxDevice::UpdateLatency()
+static int ToScale(int correction)
+{
+	return 65536 + (int)(correction * 65536LL / 1000000);
+}
+
+static tResult Replay(const tTrace &t, float gainP, float gainI,
+		float smoothing)
+{
+	seed = 1;
+	cLatencyController controller(gainP, gainI, smoothing);
+
+	int scale = 65536;
+	int changes = 0;
+
+	double local = 0, arrival = 0, mean = 0, last = 0;
+	double stc = -t.latency;
+	int samples = t.seconds * SAMPLE_RATE;
+
+	tResult r = { -1, 0, 0, 0, 0, 0 };
+	int first = 0, side = 0, quarter = 0;
+
+	// band around the target the error should settle to, as far as jitter
+	// and bursts allow
+	double band = 10 + t.jitter / 2;
+
+	for (int i = 0; i < samples; i++)
+	{
+		// sender's PTS in ms, arriving after jitter and occasional bursts,
+		// in order
+		double send = (double)i * 1000 / SAMPLE_RATE;
+		double pts = send * (1 + t.drift / 1e6);
+		double delay = t.jitter * Uniform();
+		if (t.burst && Random() % (SAMPLE_RATE * 10) == 0)
+			delay += t.burst;
+		if (send + delay > arrival)
+			arrival = send + delay;
+
+		// STC advances at corrected speed until the sample arrives
+		stc += (arrival - local) * scale / 65536.0;
+		local = arrival;
+
+		int correction = controller.Update((int)(pts - stc),
+				(int64_t)local, t.target, 150);
+
+		int newScale = ToScale(correction);
+		if (abs(newScale - scale) >= 2)
+		{
+			scale = newScale;
+			changes++;
+		}
+
+		if (!controller.Valid())
+			continue;
+
+		// error averaged over 10s for both controllers, so single bursts
+		// don't count as leaving the band
+		double error = controller.Latency() - controller.Target(t.target);
+		if (last)
+			mean += (error - mean) * (local - last) / 10000;
+		else
+			mean = error;
+		error = mean;
+		last = local;
+		int s = error > band ? 1 : error < -band ? -1 : 0;
+
+		// settled when the error entered the band for the last time
+		if (s)
+			r.settle = -1;
+		else if (r.settle < 0)
+			r.settle = local / 1000;
+
+		// error crossing the band from one side to the other
+		if (s && side && s != side)
+			r.crossings++;
+		if (s)
+			side = s;
+
+		// error beyond target on the side opposite to where it started
+		if (!first)
+			first = s;
+		if (first && (error > 0) != (first > 0))
+			r.overshoot = fmax(r.overshoot, fabs(error));
+
+		if (i >= samples * 3 / 4)
+		{
+			r.error += fabs(error);
+			r.correction += correction;
+			quarter++;
+		}
+	}
+
+	if (quarter)
+	{
+		r.error /= quarter;
+		r.correction /= quarter;
+	}
+	r.changes = changes * 60.0 / t.seconds;
+	return r;
+}
+
+static bool Bench(const tTrace &t, const char *gains, float gainP,
+		float gainI, float smoothing, bool check)
+{
+	tResult r = Replay(t, gainP, gainI, smoothing);
+
+	// settled in the first half, stays there and doesn't oscillate
+	bool ok = r.settle >= 0 && r.settle < t.seconds / 2 && r.crossings <= 1 &&
+			r.error < 5 + t.jitter / 4;
+
+	printf("%-22s %-4s settled %5.0fs %2d crossings overshoot %4.0fms "
+			"error %4.1fms corr %+6.1fppm (drift %+3.0f) %4.1f changes/min  %s\n",
+			t.name, gains, r.settle, r.crossings, r.overshoot, r.error,
+			r.correction, t.drift, r.changes,
+			ok ? "ok" : check ? "FAILED" : "-");
+
+	return ok || !check;
+}
+
+int main(int argc, char *argv[])
+{
+	static const tTrace traces[] = {
+		{ "DVB, auto target",      30,  5,   0, 300,   0, 7200 },
+		{ "DVB, target 200ms",    -20,  5,   0, 350, 200, 7200 },
+		{ "DVB, target 600ms",     10,  5,   0, 350, 600, 7200 },
+		{ "stream, bursts",        50, 40, 300, 800,   0, 7200 },
+		{ "far off, fast range",   -5,  5,   0, 900, 300, 7200 },
+	};
+
+	bool ok = true;
+	for (unsigned int i = 0; i < sizeof(traces) / sizeof(traces[0]); i++)
+	{
+		// controller used before, integrating per sample without smoothing
+		Bench(traces[i], "old", 1.0f, 0.002f * SAMPLE_RATE, 0, false);
+		ok &= Bench(traces[i], "new", LATENCY_GAIN_P, LATENCY_GAIN_I,
+				LATENCY_ERROR_SMOOTHING, true);
+	}
+
+	return ok ? 0 : 1;
+}
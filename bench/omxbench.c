@@ -0,0 +1,455 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+// host benchmark of the video buffer handling of cOmx. streams of PES packets
+// are packed by cOmxVideoPacker into the buffers of a stub decoder, which
+// checks data and time stamps, and compared to passing one buffer per packet
+// as cOmxDevice did before. a decoder consuming data at a limited rate checks
+// that back-pressure neither loses nor reorders data. build with
+// 'make omxbench'
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <vector>
+
+// the packer only uses these fields of the OpenMAX buffer header
+struct OMX_BUFFERHEADERTYPE
+{
+	uint8_t *pBuffer;
+	uint32_t nAllocLen;
+	uint32_t nFilledLen;
+	uint32_t nOffset;
+	uint32_t nFlags;
+	uint64_t nTimeStamp;
+	void *pAppPrivate;
+};
+
+#define OMX_BUFFERFLAG_ENDOFFRAME 0x00000010
+
+#include "omxpacker.h"
+
+// as set up by cOmx::SetVideoCodec()
+#define VIDEO_BUFFER_SIZE  (64 * 1024)
+#define VIDEO_BUFFER_COUNT 64
+
+static double Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int seed = 1;
+
+static unsigned int Random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* ------------------------------------------------------------------------- */
+
+// video elementary stream cut into PES payloads as VDR passes them to
+// PlayVideo(), only the first packet of a frame carries its PTS
+
+struct tVideoStream
+{
+	std::vector<uint8_t> data;
+	std::vector<cOmxVideoPacker::Fragment> packets;
+	std::vector<uint64_t> ptsAt; // PTS of frames starting at an offset
+};
+
+// H.264 in unbounded PES, which VDR's cTsToPes hands out in pieces of at
+// most 64k, or MPEG-2 in bounded PES of a few kB, with frame sizes of a GOP
+// of I, P and B frames
+static void MakeVideoStream(tVideoStream &s, bool h264, int frames)
+{
+	static const int gop[] = { 0, 2, 2, 1, 2, 2, 1, 2, 2, 1, 2, 2 };
+	static const int h264Size[] = { 200000, 50000, 20000 };
+	static const int mpeg2Size[] = { 80000, 30000, 10000 };
+
+	// same stream for both ways of passing it
+	seed = 1;
+
+	std::vector<unsigned int> frameSize;
+	unsigned int size = 0;
+	for (int i = 0; i < frames; i++)
+	{
+		int type = gop[i % (sizeof(gop) / sizeof(gop[0]))];
+		int mean = h264 ? h264Size[type] : mpeg2Size[type];
+		frameSize.push_back(mean / 2 + Random() % mean);
+		size += frameSize.back();
+	}
+
+	s.data.resize(size);
+	for (unsigned int i = 0; i < size; i++)
+		s.data[i] = Random();
+
+	s.packets.clear();
+	s.ptsAt.assign(size, 0);
+	unsigned int pos = 0;
+	for (int i = 0; i < frames; i++)
+	{
+		uint64_t pts = 3600 * (i + 1);
+		s.ptsAt[pos] = pts;
+		for (unsigned int left = frameSize[i]; left; )
+		{
+			unsigned int max = h264 ? 65526 : 2048 + Random() % 6144;
+			cOmxVideoPacker::Fragment packet = { &s.data[pos],
+					left < max ? left : max, pts };
+			s.packets.push_back(packet);
+			pos += packet.length;
+			left -= packet.length;
+			pts = 0;
+		}
+	}
+}
+
+/* ------------------------------------------------------------------------- */
+
+// buffers of a stub decoder, which checks data and time stamps and either
+// consumes them right when they're submitted or emulates a decoder taking
+// them at a given byte rate in a thread of its own, like the video decoder
+// calling back cOmx::OnBufferEmpty(). counts the locks cOmx takes around the
+// buffer functions
+
+class cStubDecoder : public cOmxVideoPacker::cBufferSource
+{
+public:
+
+	cStubDecoder(const tVideoStream &stream, int bytesPerSecond = 0) :
+		m_stream(stream), m_rate(bytesPerSecond), m_free(0), m_head(0),
+		m_tail(0), m_queued(0), m_maxQueued(0), m_pos(0), m_buffers(0),
+		m_locks(0), m_stalls(0), m_ok(true), m_active(true)
+	{
+		pthread_mutex_init(&m_mutex, 0);
+		pthread_mutex_init(&m_bufferMutex, 0);
+		pthread_cond_init(&m_bufferCond, 0);
+		for (int i = 0; i < VIDEO_BUFFER_COUNT; i++)
+		{
+			OMX_BUFFERHEADERTYPE *buf = new OMX_BUFFERHEADERTYPE;
+			memset(buf, 0, sizeof(*buf));
+			buf->pBuffer = new uint8_t[VIDEO_BUFFER_SIZE];
+			buf->nAllocLen = VIDEO_BUFFER_SIZE;
+			m_all.push_back(buf);
+			Put(buf);
+		}
+		if (m_rate)
+			pthread_create(&m_thread, 0, Decode, this);
+	}
+
+	virtual ~cStubDecoder()
+	{
+		if (m_rate)
+		{
+			pthread_mutex_lock(&m_bufferMutex);
+			m_active = false;
+			pthread_cond_broadcast(&m_bufferCond);
+			pthread_mutex_unlock(&m_bufferMutex);
+			pthread_join(m_thread, 0);
+		}
+		for (unsigned int i = 0; i < m_all.size(); i++)
+		{
+			delete[] m_all[i]->pBuffer;
+			delete m_all[i];
+		}
+		pthread_cond_destroy(&m_bufferCond);
+		pthread_mutex_destroy(&m_bufferMutex);
+		pthread_mutex_destroy(&m_mutex);
+	}
+
+	void Lock(void)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_locks++;
+	}
+
+	void Unlock(void)
+	{
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	virtual OMX_BUFFERHEADERTYPE* AcquireVideoBuffer(uint64_t pts)
+	{
+		pthread_mutex_lock(&m_bufferMutex);
+		OMX_BUFFERHEADERTYPE *buf = m_free;
+		if (buf)
+		{
+			m_free = static_cast <OMX_BUFFERHEADERTYPE*>(buf->pAppPrivate);
+			buf->pAppPrivate = 0;
+			buf->nFilledLen = 0;
+			buf->nFlags = 0;
+			buf->nTimeStamp = pts;
+		}
+		else
+			m_stalls++;
+		pthread_mutex_unlock(&m_bufferMutex);
+		return buf;
+	}
+
+	virtual void ReleaseVideoBuffer(OMX_BUFFERHEADERTYPE *buf)
+	{
+		pthread_mutex_lock(&m_bufferMutex);
+		Put(buf);
+		pthread_mutex_unlock(&m_bufferMutex);
+	}
+
+	virtual bool SubmitVideoBuffer(OMX_BUFFERHEADERTYPE *buf)
+	{
+		pthread_mutex_lock(&m_bufferMutex);
+		m_buffers++;
+		if (m_rate)
+		{
+			buf->pAppPrivate = 0;
+			if (m_tail)
+				m_tail->pAppPrivate = buf;
+			else
+				m_head = buf;
+			m_tail = buf;
+			if (++m_queued > m_maxQueued)
+				m_maxQueued = m_queued;
+			pthread_cond_broadcast(&m_bufferCond);
+		}
+		else
+		{
+			Check(buf);
+			Put(buf);
+		}
+		pthread_mutex_unlock(&m_bufferMutex);
+		return true;
+	}
+
+	// wait for the decoder to return a buffer, as cOmxDevice::Poll() does
+	void WaitForBuffer(void)
+	{
+		pthread_mutex_lock(&m_bufferMutex);
+		if (!m_free)
+			pthread_cond_wait(&m_bufferCond, &m_bufferMutex);
+		pthread_mutex_unlock(&m_bufferMutex);
+	}
+
+	// wait for the decoder to consume all submitted buffers
+	void Drain(void)
+	{
+		pthread_mutex_lock(&m_bufferMutex);
+		while (m_head)
+			pthread_cond_wait(&m_bufferCond, &m_bufferMutex);
+		pthread_mutex_unlock(&m_bufferMutex);
+	}
+
+	bool Ok(void)          { return m_ok && m_pos == m_stream.data.size(); }
+	int Buffers(void)      { return m_buffers; }
+	int Locks(void)        { return m_locks; }
+	int Stalls(void)       { return m_stalls; }
+	int MaxQueued(void)    { return m_maxQueued; }
+
+private:
+
+	void Put(OMX_BUFFERHEADERTYPE *buf)
+	{
+		buf->pAppPrivate = m_free;
+		m_free = buf;
+	}
+
+	// data needs to arrive in order, a time stamp only at a frame start
+	void Check(OMX_BUFFERHEADERTYPE *buf)
+	{
+		m_ok &= m_pos + buf->nFilledLen <= m_stream.data.size() &&
+			!memcmp(buf->pBuffer, &m_stream.data[m_pos], buf->nFilledLen) &&
+			buf->nTimeStamp == m_stream.ptsAt[m_pos];
+
+		m_pos += buf->nFilledLen;
+	}
+
+	static void* Decode(void *data)
+	{
+		cStubDecoder *decoder = static_cast <cStubDecoder*>(data);
+		pthread_mutex_lock(&decoder->m_bufferMutex);
+		while (decoder->m_active)
+		{
+			OMX_BUFFERHEADERTYPE *buf = decoder->m_head;
+			if (!buf)
+			{
+				pthread_cond_wait(&decoder->m_bufferCond,
+						&decoder->m_bufferMutex);
+				continue;
+			}
+			pthread_mutex_unlock(&decoder->m_bufferMutex);
+
+			decoder->Check(buf);
+			usleep((uint64_t)buf->nFilledLen * 1000000 / decoder->m_rate);
+
+			pthread_mutex_lock(&decoder->m_bufferMutex);
+			decoder->m_head =
+					static_cast <OMX_BUFFERHEADERTYPE*>(buf->pAppPrivate);
+			if (!decoder->m_head)
+				decoder->m_tail = 0;
+			decoder->m_queued--;
+			decoder->Put(buf);
+			pthread_cond_broadcast(&decoder->m_bufferCond);
+		}
+		pthread_mutex_unlock(&decoder->m_bufferMutex);
+		return 0;
+	}
+
+	const tVideoStream &m_stream;
+	int m_rate;
+	std::vector<OMX_BUFFERHEADERTYPE *> m_all;
+	OMX_BUFFERHEADERTYPE *m_free;
+	OMX_BUFFERHEADERTYPE *m_head;
+	OMX_BUFFERHEADERTYPE *m_tail;
+	int m_queued;
+	int m_maxQueued;
+	pthread_mutex_t m_mutex;
+	pthread_mutex_t m_bufferMutex;
+	pthread_cond_t m_bufferCond;
+	pthread_t m_thread;
+	unsigned int m_pos;
+	int m_buffers;
+	int m_locks;
+	int m_stalls;
+	bool m_ok;
+	bool m_active;
+};
+
+// one buffer per packet, each taken with GetVideoBuffer() and passed with
+// EmptyVideoBuffer(), both of which lock cOmx
+static void PlayUnpacked(cStubDecoder &decoder, const tVideoStream &s)
+{
+	for (unsigned int i = 0; i < s.packets.size(); i++)
+	{
+		const unsigned char *data = s.packets[i].data;
+		unsigned int length = s.packets[i].length;
+		uint64_t pts = s.packets[i].pts;
+
+		while (length)
+		{
+			decoder.Lock();
+			OMX_BUFFERHEADERTYPE *buf = decoder.AcquireVideoBuffer(pts);
+			decoder.Unlock();
+
+			unsigned int len = length < buf->nAllocLen ? length : buf->nAllocLen;
+			memcpy(buf->pBuffer, data, len);
+			buf->nFilledLen = len;
+			data += len;
+			length -= len;
+			pts = 0;
+
+			decoder.Lock();
+			decoder.SubmitVideoBuffer(buf);
+			decoder.Unlock();
+		}
+	}
+}
+
+// each packet passed with WriteVideoData(), which locks cOmx once
+static void PlayPacked(cStubDecoder &decoder, const tVideoStream &s)
+{
+	cOmxVideoPacker packer(&decoder);
+	for (unsigned int i = 0; i < s.packets.size(); i++)
+	{
+		decoder.Lock();
+		packer.Write(&s.packets[i], 1);
+		decoder.Unlock();
+	}
+	decoder.Lock();
+	packer.Flush();
+	decoder.Unlock();
+}
+
+// each packet passed with WriteVideoData() to a decoder consuming data at a
+// given rate. a packet not taken is repeated after waiting for the decoder,
+// as VDR does after polling the device
+static bool BenchBackPressure(bool h264, int bytesPerSecond, int frames)
+{
+	tVideoStream s;
+	MakeVideoStream(s, h264, frames);
+
+	cStubDecoder decoder(s, bytesPerSecond);
+	cOmxVideoPacker packer(&decoder);
+	int repeats = 0;
+
+	double start = Now();
+	for (unsigned int i = 0; i < s.packets.size(); )
+	{
+		decoder.Lock();
+		int taken = packer.Write(&s.packets[i], 1);
+		decoder.Unlock();
+
+		if (taken)
+			i++;
+		else
+		{
+			repeats++;
+			decoder.WaitForBuffer();
+		}
+	}
+	decoder.Lock();
+	packer.Flush();
+	decoder.Unlock();
+	decoder.Drain();
+	double seconds = Now() - start;
+
+	double rate = s.data.size() / seconds;
+	bool ok = decoder.Ok() && decoder.MaxQueued() <= VIDEO_BUFFER_COUNT &&
+			rate <= bytesPerSecond * 1.05;
+
+	printf("%-6s %4.0f MB/s decoder: %6d repeats %6d stalls %3d max queued "
+			"%5.1f MB/s  %s\n",
+			h264 ? "H.264" : "MPEG-2", bytesPerSecond / 1e6, repeats,
+			decoder.Stalls(), decoder.MaxQueued(), rate / 1e6,
+			ok ? "ok" : "MISMATCH");
+
+	return ok;
+}
+
+static bool BenchPacking(bool h264, bool packed, int frames)
+{
+	tVideoStream s;
+	MakeVideoStream(s, h264, frames);
+
+	cStubDecoder decoder(s);
+	double start = Now();
+	if (packed)
+		PlayPacked(decoder, s);
+	else
+		PlayUnpacked(decoder, s);
+	double seconds = Now() - start;
+
+	int packets = s.packets.size();
+	printf("%-6s %-9s %6d packets %5.2f locks/packet %6d buffers "
+			"%6.0f B/buffer %5.0f ns/packet  %s\n",
+			h264 ? "H.264" : "MPEG-2", packed ? "packed" : "unpacked",
+			packets, (double)decoder.Locks() / packets, decoder.Buffers(),
+			(double)s.data.size() / decoder.Buffers(),
+			seconds * 1e9 / packets, decoder.Ok() ? "ok" : "MISMATCH");
+
+	return decoder.Ok();
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 1000;
+	bool ok = true;
+
+	ok &= BenchPacking(true, false, frames);
+	ok &= BenchPacking(true, true, frames);
+	ok &= BenchPacking(false, false, frames);
+	ok &= BenchPacking(false, true, frames);
+
+	ok &= BenchBackPressure(true, 200000000, frames);
+	ok &= BenchBackPressure(false, 50000000, frames);
+
+	return ok ? 0 : 1;
+}
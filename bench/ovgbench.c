@@ -0,0 +1,427 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+// host benchmark of the command hand-over to the OpenVG thread. a mix of
+// commands as drawn by OSD menus is replayed through cOvgCmdQueue to a thread
+// executing them with a null renderer, once with commands taken from
+// cOvgSlabPool as cOvgCmd does and once with commands from the heap as before.
+// reports heap allocations and time per command. opening and closing an OSD
+// measures the latency until the flush is executed and the wake-ups of the
+// idle thread, which either sleeps until signaled or polls every 20ms as it
+// did before. build with 'make ovgbench'
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <new>
+#include <vector>
+
+#include "ovgqueue.h"
+
+// all calls of the global operator new, which covers the heap allocated
+// commands and the fallback of cOvgSlabPool for larger ones
+static int heapAllocs = 0;
+
+void *operator new(size_t size)
+{
+	__sync_fetch_and_add(&heapAllocs, 1);
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void *ptr) throw()
+{
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t size) throw()
+{
+	free(ptr);
+}
+
+static double Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned int seed = 1;
+
+static unsigned int Random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return seed >> 8;
+}
+
+/* ------------------------------------------------------------------------- */
+
+// renderer doing nothing but checking that commands arrive in order
+
+struct tNullRenderer
+{
+	unsigned int next;
+	unsigned int executed;
+	bool ok;
+};
+
+class cBenchCmd
+{
+public:
+
+	cBenchCmd(unsigned int seq) : m_seq(seq) { }
+	virtual ~cBenchCmd() { }
+
+	virtual void Execute(tNullRenderer *r)
+	{
+		r->ok &= m_seq == r->next;
+		r->next = m_seq + 1;
+		r->executed++;
+	}
+
+protected:
+
+	unsigned int m_seq;
+};
+
+// commands of the same size as the cOvgCmd they stand for, either taken from
+// the slab pool as cOvgCmd does or from the heap
+
+static cOvgSlabPool pool;
+
+template<bool slab, int size> class cBenchCmdOf : public cBenchCmd
+{
+public:
+
+	cBenchCmdOf(unsigned int seq) : cBenchCmd(seq) { }
+
+	static void *operator new(size_t sz)
+	{
+		return slab ? pool.Alloc(sz) : ::operator new(sz);
+	}
+
+	static void operator delete(void *ptr, size_t sz)
+	{
+		if (slab)
+			pool.Free(ptr, sz);
+		else
+			::operator delete(ptr);
+	}
+
+	static cBenchCmd *Create(unsigned int seq)
+	{
+		return new cBenchCmdOf<slab, size>(seq);
+	}
+
+private:
+
+	char m_data[size - sizeof(cBenchCmd)];
+};
+
+// commands drawn per 100 by OSD menus, sizes of cOvgCmd on a 64 bit host.
+// on the 32 bit Pi they're smaller, so DrawBitmap fits into a slot as well
+struct tMix
+{
+	const char *name;
+	int size;
+	int weight;
+	cBenchCmd *(*create[2])(unsigned int seq);
+};
+
+#define MIX(name, size, weight) { name, size, weight, \
+	{ cBenchCmdOf<false, size>::Create, cBenchCmdOf<true, size>::Create } }
+
+static const tMix mix[] = {
+	MIX("DrawText",      64, 35),
+	MIX("DrawRectangle", 40, 25),
+	MIX("RenderPixels",  56,  8),
+	MIX("DrawImage",     32,  6),
+	MIX("DrawBitmap",    72,  6),
+	MIX("CopyPixels",    48,  6),
+	MIX("Clear",         24,  4),
+	MIX("DrawEllipse",   40,  3),
+	MIX("DrawSlope",     40,  2),
+	MIX("DrawPixel",     32,  1),
+	MIX("SaveRegion",    40,  1),
+	MIX("RestoreRegion", 24,  1),
+	MIX("DropRegion",    24,  1),
+	MIX("Flush",         16,  1),
+};
+
+#define MIX_SIZE (sizeof(mix) / sizeof(mix[0]))
+
+// commands of an OSD frame in random order, a flush at its end
+static void MakeFrame(std::vector<int> &frame)
+{
+	frame.clear();
+	for (unsigned int i = 0; i < MIX_SIZE - 1; i++)
+		for (int j = 0; j < mix[i].weight; j++)
+			frame.push_back(i);
+
+	for (unsigned int i = frame.size() - 1; i > 0; i--)
+	{
+		unsigned int j = Random() % (i + 1);
+		int t = frame[i];
+		frame[i] = frame[j];
+		frame[j] = t;
+	}
+	frame.push_back(MIX_SIZE - 1);
+}
+
+// command the producer waits for, like the completion fence of
+// CreatePixmap(), or takes the time of, like the flush showing the OSD
+
+class cBenchMark : public cBenchCmd
+{
+public:
+
+	cBenchMark(unsigned int seq) : cBenchCmd(seq), m_time(0), m_done(false)
+	{
+		pthread_mutex_init(&m_mutex, 0);
+		pthread_cond_init(&m_cond, 0);
+	}
+
+	virtual ~cBenchMark()
+	{
+		pthread_cond_destroy(&m_cond);
+		pthread_mutex_destroy(&m_mutex);
+	}
+
+	virtual void Execute(tNullRenderer *r)
+	{
+		cBenchCmd::Execute(r);
+		pthread_mutex_lock(&m_mutex);
+		m_time = Now();
+		m_done = true;
+		pthread_cond_broadcast(&m_cond);
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	// returns the time the command has been executed at
+	double Wait(void)
+	{
+		pthread_mutex_lock(&m_mutex);
+		while (!m_done)
+			pthread_cond_wait(&m_cond, &m_mutex);
+		double time = m_time;
+		pthread_mutex_unlock(&m_mutex);
+		return time;
+	}
+
+private:
+
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_cond;
+	double m_time;
+	bool m_done;
+};
+
+/* ------------------------------------------------------------------------- */
+
+// the OpenVG thread as cOvgThread::ProcessCommands() runs it, a null command
+// ends it. marks are kept for the producer, which deletes them
+
+struct tConsumer
+{
+	cOvgCmdQueue<cBenchCmd*> *queue;
+	tNullRenderer renderer;
+	int timeout;
+	int wakeups; // without commands to execute
+};
+
+static void *Consume(void *data)
+{
+	tConsumer *c = static_cast<tConsumer*>(data);
+	bool waited = false;
+	while (true)
+	{
+		cBenchCmd *cmd;
+		if (!c->queue->Get(cmd))
+		{
+			// count wake-ups finding nothing to do
+			if (waited)
+				c->wakeups++;
+			c->queue->Wait(c->timeout);
+			waited = true;
+		}
+		else if (!cmd)
+			break;
+		else
+		{
+			waited = false;
+			bool mark = dynamic_cast<cBenchMark *>(cmd);
+			cmd->Execute(&c->renderer);
+			if (!mark)
+				delete cmd;
+		}
+	}
+	return 0;
+}
+
+static bool BenchReplay(bool slab, int frames)
+{
+	cOvgCmdQueue<cBenchCmd*> queue;
+	tConsumer c = { &queue, { 0, 0, true }, 20, 0 };
+
+	seed = 1;
+	std::vector<int> frame;
+	frame.reserve(128);
+	int allocs = heapAllocs;
+	int stalls = 0;
+	unsigned int seq = 0;
+
+	pthread_t thread;
+	pthread_create(&thread, 0, Consume, &c);
+
+	double start = Now();
+	for (int i = 0; i < frames; i++)
+	{
+		MakeFrame(frame);
+		for (unsigned int j = 0; j < frame.size(); j++)
+		{
+			const tMix &m = mix[frame[j]];
+			if (queue.Put(m.create[slab](seq++), j == frame.size() - 1))
+				stalls++;
+		}
+	}
+	queue.Put(0, true);
+	pthread_join(thread, 0);
+	double seconds = Now() - start;
+
+	allocs = heapAllocs - allocs;
+	int slabs = pool.Slabs();
+	pool.CleanUp();
+
+	bool ok = c.renderer.ok && c.renderer.executed == seq;
+	printf("%-5s %8u commands %6.3f heap allocs/cmd (%d slabs) %4d stalls "
+			"%5.0f ns/cmd  %s\n",
+			slab ? "slab" : "heap", seq, (double)(allocs + slabs) / seq,
+			slabs, stalls, seconds * 1e9 / seq, ok ? "ok" : "MISMATCH");
+
+	return ok;
+}
+
+// allocation and release of the commands only, without the queue
+static void BenchAlloc(bool slab, int frames)
+{
+	seed = 1;
+	std::vector<int> frame;
+	MakeFrame(frame);
+
+	std::vector<cBenchCmd*> cmds(frame.size());
+	unsigned int count = 0;
+
+	double start = Now();
+	for (int i = 0; i < frames; i++)
+	{
+		for (unsigned int j = 0; j < frame.size(); j++)
+			cmds[j] = mix[frame[j]].create[slab](j);
+		for (unsigned int j = 0; j < frame.size(); j++)
+			delete cmds[j];
+		count += frame.size();
+	}
+	double seconds = Now() - start;
+	pool.CleanUp();
+
+	printf("%-5s %8u commands allocated and freed %5.1f ns/cmd\n",
+			slab ? "slab" : "heap", count, seconds * 1e9 / count);
+}
+
+// opens an OSD as cOvgOsd does, creating a pixel buffer and waiting for it,
+// drawing a frame and flushing it, and closes it again by clearing, flushing
+// and destroying the surface. before, the idle thread polled every 20ms and
+// the commands closing the OSD were not signaled
+static bool BenchOsd(bool block, int runs)
+{
+	cOvgCmdQueue<cBenchCmd*> queue;
+	tConsumer c = { &queue, { 0, 0, true }, block ? 0 : 20, 0 };
+
+	seed = 1;
+	std::vector<int> frame;
+	unsigned int seq = 0;
+	double open = 0, openMax = 0, close = 0, closeMax = 0;
+
+	pthread_t thread;
+	pthread_create(&thread, 0, Consume, &c);
+
+	for (int i = 0; i < runs; i++)
+	{
+		usleep(20000 + Random() % 20000);
+
+		double t = Now();
+		cBenchMark *pixelBuffer = new cBenchMark(seq++);
+		queue.Put(pixelBuffer, true);
+		pixelBuffer->Wait();
+		delete pixelBuffer;
+
+		MakeFrame(frame);
+		for (unsigned int j = 0; j < frame.size() - 1; j++)
+			queue.Put(mix[frame[j]].create[true](seq++), false);
+
+		cBenchMark *flush = new cBenchMark(seq++);
+		queue.Put(flush, true);
+		t = flush->Wait() - t;
+		delete flush;
+		open += t;
+		openMax = t > openMax ? t : openMax;
+
+		usleep(20000 + Random() % 20000);
+
+		t = Now();
+		queue.Put(mix[6].create[true](seq++), false);
+		flush = new cBenchMark(seq++);
+		queue.Put(flush, block);
+		queue.Put(mix[12].create[true](seq++), false);
+		queue.Put(mix[13].create[true](seq++), block);
+		t = flush->Wait() - t;
+		delete flush;
+		close += t;
+		closeMax = t > closeMax ? t : closeMax;
+	}
+
+	// the thread idling with the OSD closed
+	int wakeups = c.wakeups;
+	usleep(1000000);
+	wakeups = c.wakeups - wakeups;
+
+	queue.Put(0, true);
+	pthread_join(thread, 0);
+	pool.CleanUp();
+
+	bool ok = c.renderer.ok && c.renderer.executed == seq;
+	printf("%-5s OSD open %6.3f ms (max %6.3f), close %6.3f ms "
+			"(max %6.3f), %3d wake-ups/s idle  %s\n",
+			block ? "block" : "poll", open * 1e3 / runs, openMax * 1e3,
+			close * 1e3 / runs, closeMax * 1e3, wakeups,
+			ok ? "ok" : "MISMATCH");
+
+	return ok;
+}
+
+/* ------------------------------------------------------------------------- */
+
+int main(int argc, char *argv[])
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 20000;
+	bool ok = true;
+
+	BenchAlloc(false, frames);
+	BenchAlloc(true, frames);
+
+	ok &= BenchReplay(false, frames);
+	ok &= BenchReplay(true, frames);
+
+	ok &= BenchOsd(false, 50);
+	ok &= BenchOsd(true, 50);
+
+	return ok ? 0 : 1;
+}
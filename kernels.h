@@ -0,0 +1,286 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+#ifndef KERNELS_H
+#define KERNELS_H
+
+#include <stdint.h>
+#include <math.h>
+
+#ifdef __ARM_NEON__
+#include <arm_neon.h>
+#endif
+
+// pixel conversion kernels of the OSD and sample conversion kernels of the
+// audio render. they only depend on the CPU, so they can be built and
+// measured on any host as well, see bench/kernelbench.c
+// the vector versions are picked at compile time (#ifdef __ARM_NEON__), there
+// is no detection at run time. builds for ARMv6 (Pi 1 and Zero) and hosts
+// without NEON use the scalar versions, which give the same results
+
+class cPixelKernels
+{
+public:
+
+	// look up a row of palette indices. palette must have 32 entries at
+	// least, unused ones set to zero. numColors is the number of colors in
+	// use, which selects the vector version, indices beyond only may refer
+	// to unused entries. there's no SSE version, the plugin only runs on the
+	// Pi, so it would only speed up the benchmark on the host
+	static void Expand(uint32_t *dst, const uint8_t *src, int n,
+			const uint32_t *palette, int numColors)
+	{
+#ifdef __ARM_NEON__
+		// up to 16 or 32 colors, e.g. for subtitles, each byte of the colors
+		// can be looked up in a table of 16 or 32 bytes, eight pixels at once
+		if (numColors <= 16)
+		{
+			uint8x16x4_t colors = vld4q_u8((const uint8_t *)palette);
+			uint8x8x2_t table[4];
+			for (int i = 0; i < 4; i++)
+			{
+				table[i].val[0] = vget_low_u8(colors.val[i]);
+				table[i].val[1] = vget_high_u8(colors.val[i]);
+			}
+
+			for (; n >= 8; n -= 8, src += 8, dst += 8)
+			{
+				uint8x8_t index = vld1_u8(src);
+				uint8x8x4_t out;
+				out.val[0] = vtbl2_u8(table[0], index);
+				out.val[1] = vtbl2_u8(table[1], index);
+				out.val[2] = vtbl2_u8(table[2], index);
+				out.val[3] = vtbl2_u8(table[3], index);
+				vst4_u8((uint8_t *)dst, out);
+			}
+		}
+		else if (numColors <= 32)
+		{
+			uint8x16x4_t low = vld4q_u8((const uint8_t *)palette);
+			uint8x16x4_t high = vld4q_u8((const uint8_t *)(palette + 16));
+			uint8x8x4_t table[4];
+			for (int i = 0; i < 4; i++)
+			{
+				table[i].val[0] = vget_low_u8(low.val[i]);
+				table[i].val[1] = vget_high_u8(low.val[i]);
+				table[i].val[2] = vget_low_u8(high.val[i]);
+				table[i].val[3] = vget_high_u8(high.val[i]);
+			}
+
+			for (; n >= 8; n -= 8, src += 8, dst += 8)
+			{
+				uint8x8_t index = vld1_u8(src);
+				uint8x8x4_t out;
+				out.val[0] = vtbl4_u8(table[0], index);
+				out.val[1] = vtbl4_u8(table[1], index);
+				out.val[2] = vtbl4_u8(table[2], index);
+				out.val[3] = vtbl4_u8(table[3], index);
+				vst4_u8((uint8_t *)dst, out);
+			}
+		}
+#endif
+		for (; n >= 4; n -= 4, src += 4, dst += 4)
+		{
+			dst[0] = palette[src[0]];
+			dst[1] = palette[src[1]];
+			dst[2] = palette[src[2]];
+			dst[3] = palette[src[3]];
+		}
+		for (; n > 0; n--)
+			*dst++ = palette[*src++];
+	}
+
+	// x / 255, rounded, for x up to 255 * 255
+	static inline uint32_t Div255(uint32_t x)
+	{
+		return (x + 128 + ((x + 128) >> 8)) >> 8;
+	}
+
+#ifdef __ARM_NEON__
+	static inline uint8x8_t Div255(uint16x8_t x)
+	{
+		return vrshrn_n_u16(vrsraq_n_u16(x, x, 8), 8);
+	}
+#endif
+
+	// blend a row of source pixels with layer alpha over premultiplied dst
+	static void BlendRow(uint32_t *dst, const uint32_t *src, int n, int alpha)
+	{
+#ifdef __ARM_NEON__
+		uint8x8_t layer = vdup_n_u8(alpha);
+		for (; n >= 8; n -= 8, src += 8, dst += 8)
+		{
+			uint8x8x4_t s = vld4_u8((const uint8_t *)src);
+			uint8x8x4_t d = vld4_u8((const uint8_t *)dst);
+
+			uint8x8_t a = alpha == 255 ? s.val[3] :
+					Div255(vmull_u8(s.val[3], layer));
+			uint8x8_t ia = vmvn_u8(a);
+
+			for (int c = 0; c < 3; c++)
+				d.val[c] = Div255(vmlal_u8(vmull_u8(s.val[c], a),
+						d.val[c], ia));
+
+			d.val[3] = vqadd_u8(a, Div255(vmull_u8(d.val[3], ia)));
+			vst4_u8((uint8_t *)dst, d);
+		}
+#endif
+		for (; n > 0; n--, src++, dst++)
+		{
+			uint32_t s = *src;
+			uint32_t a = s >> 24;
+			if (alpha != 255)
+				a = Div255(a * alpha);
+
+			if (!a)
+				continue;
+
+			if (a == 255)
+			{
+				*dst = s;
+				continue;
+			}
+
+			uint32_t ia = 255 - a;
+			uint32_t d = *dst;
+			*dst = (a + Div255((d >> 24) * ia)) << 24 |
+					Div255((s >> 16 & 0xff) * a + (d >> 16 & 0xff) * ia) << 16 |
+					Div255((s >>  8 & 0xff) * a + (d >>  8 & 0xff) * ia) <<  8 |
+					Div255((s       & 0xff) * a + (d       & 0xff) * ia);
+		}
+	}
+
+	// convert a row of premultiplied pixels back to straight alpha
+	static void Unpremultiply(uint32_t *p, int n)
+	{
+		const uint32_t *recip = Reciprocals();
+		for (; n > 0; n--, p++)
+		{
+			uint32_t a = *p >> 24;
+			if (a && a < 255)
+			{
+				uint32_t r = recip[a];
+				*p = a << 24 |
+					Clamp255(((*p >> 16 & 0xff) * r + 32768) >> 16) << 16 |
+					Clamp255(((*p >>  8 & 0xff) * r + 32768) >> 16) <<  8 |
+					Clamp255(((*p       & 0xff) * r + 32768) >> 16);
+			}
+		}
+	}
+
+private:
+
+	static inline uint32_t Clamp255(uint32_t x)
+	{
+		return x < 255 ? x : 255;
+	}
+
+	// 255 / a in 16.16 fixed point
+	static const uint32_t *Reciprocals(void)
+	{
+		static struct tTable
+		{
+			tTable()
+			{
+				r[0] = 0;
+				for (int a = 1; a < 256; a++)
+					r[a] = (255 << 16) / a;
+			}
+			uint32_t r[256];
+		} table;
+		return table.r;
+	}
+};
+
+class cPcmKernels
+{
+public:
+
+	// round half away from zero, as the NEON version does
+	static inline int16_t FloatToS16(float sample)
+	{
+		long s = lroundf(sample * 32768.0f);
+		return s < -32768 ? -32768 : s > 32767 ? 32767 : s;
+	}
+
+#ifdef __ARM_NEON__
+	// round half away from zero and saturate, same as the scalar version
+	static inline int16x4_t FloatToS16(float32x4_t samples)
+	{
+		const uint32x4_t sign = vdupq_n_u32(0x80000000);
+		const float32x4_t scale = vdupq_n_f32(32768.0f);
+
+		samples = vmulq_f32(samples, scale);
+		float32x4_t half = vreinterpretq_f32_u32(vorrq_u32(
+				vandq_u32(vreinterpretq_u32_f32(samples), sign),
+				vreinterpretq_u32_f32(vdupq_n_f32(0.5f))));
+
+		return vqmovn_s32(vcvtq_s32_f32(vaddq_f32(samples, half)));
+	}
+#endif
+
+	// planar float to interleaved signed 16 bit, same channel count
+	static void FltpToS16(int16_t *dst, const float **src,
+			int samples, int channels)
+	{
+		int i = 0;
+#ifdef __ARM_NEON__
+		if (channels == 2)
+		{
+			for (; i + 4 <= samples; i += 4, dst += 8)
+			{
+				int16x4x2_t out;
+				out.val[0] = FloatToS16(vld1q_f32(src[0] + i));
+				out.val[1] = FloatToS16(vld1q_f32(src[1] + i));
+				vst2_s16(dst, out);
+			}
+		}
+#endif
+		for (; i < samples; i++)
+			for (int ch = 0; ch < channels; ch++)
+				*dst++ = FloatToS16(src[ch][i]);
+	}
+
+	// planar float 5.1 or 5.0 down mix to interleaved signed 16 bit stereo,
+	// channels of the source tell whether there's an LFE channel to skip.
+	// uses the same coefficients as libswresample's default matrix: center
+	// and surround at -3dB, LFE dropped, normalized to avoid clipping
+	static void Fltp5xToS16Stereo(int16_t *dst, const float **src,
+			int samples, int channels)
+	{
+		const float front    = 1.0f / (1.0f + 2 * M_SQRT1_2);
+		const float surround = M_SQRT1_2 * front;
+
+		// FL FR FC (LFE) SL SR, or BL BR instead of SL SR
+		const float *fl = src[0], *fr = src[1], *c = src[2];
+		const float *sl = src[channels - 2], *sr = src[channels - 1];
+
+		int i = 0;
+#ifdef __ARM_NEON__
+		for (; i + 4 <= samples; i += 4, dst += 8)
+		{
+			float32x4_t mid = vmulq_n_f32(vld1q_f32(c + i), surround);
+			float32x4_t l = vmlaq_n_f32(mid, vld1q_f32(fl + i), front);
+			float32x4_t r = vmlaq_n_f32(mid, vld1q_f32(fr + i), front);
+			l = vmlaq_n_f32(l, vld1q_f32(sl + i), surround);
+			r = vmlaq_n_f32(r, vld1q_f32(sr + i), surround);
+
+			int16x4x2_t out;
+			out.val[0] = FloatToS16(l);
+			out.val[1] = FloatToS16(r);
+			vst2_s16(dst, out);
+		}
+#endif
+		for (; i < samples; i++)
+		{
+			float mid = c[i] * surround;
+			*dst++ = FloatToS16(fl[i] * front + mid + sl[i] * surround);
+			*dst++ = FloatToS16(fr[i] * front + mid + sr[i] * surround);
+		}
+	}
+};
+
+#endif
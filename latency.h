@@ -0,0 +1,202 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+#include <math.h>
+
+#include "tools.h"
+
+// speed correction for live mode in ppm
+// HDMI specification allows a tolerance of 1000ppm, however on the Raspberry Pi
+// it's limited to 175ppm to avoid audio drops one some A/V receivers, so the
+// full range is only used if latency is far away from its target. the normal
+// range is configured in setup (150ppm by default)
+#define LATENCY_MAX_CORRECTION_FAST 1000
+
+// PI controller gains, ppm per ms latency error and ppm per ms error and
+// second. a correction of c ppm changes latency by c/1000 ms per second, so
+// the loop is L'' + 0.001 * P * L' + 0.001 * I * L = 0. P = 4 gives a time
+// constant of 250s, I = 0.001 * P^2 / 2 a damping of 0.7, so a step settles
+// within about half an hour without oscillating, see bench/latencybench.c
+#define LATENCY_GAIN_P 4.0f
+#define LATENCY_GAIN_I 0.008f
+
+// default target is set this number of jitter deviations above the latency
+// measured after warm up
+#define LATENCY_JITTER_FACTOR 4
+
+// time constant in s the latency error is smoothed with before it's fed
+// into the controller. it's small compared to the loop's, but keeps bursts
+// of late packets, e.g. of network streams, from changing the clock speed
+#define LATENCY_ERROR_SMOOTHING 10.0f
+
+#define LATENCY_FILTER_PREROLL 16
+#define LATENCY_FILTER_WARMUP  32
+
+// Keeps the latency of live mode, the difference between PTS of arriving data
+// and STC, at its target by correcting the clock speed. Takes latency samples
+// only, so it can be exercised on any host, see bench/latencybench.c.
+
+class cLatencyController
+{
+public:
+
+	// smoothing is a time constant in s, 0 to control on the latency filtered
+	// per sample only
+	cLatencyController(float gainP = LATENCY_GAIN_P,
+			float gainI = LATENCY_GAIN_I,
+			float smoothing = LATENCY_ERROR_SMOOTHING) :
+		m_gainP(gainP),
+		m_gainI(gainI),
+		m_smoothing(smoothing)
+	{
+		Reset();
+	}
+
+	void Reset(void)
+	{
+		m_samples = - LATENCY_FILTER_PREROLL;
+		m_time = 0;
+		m_latency = 0;
+		m_jitter = 0;
+		m_target = 0;
+		m_error = 0;
+		m_integral = 0;
+		m_correction = 0;
+		m_posMaxCorrections = 0;
+		m_negMaxCorrections = 0;
+	}
+
+	// feed a latency sample in ms taken at the given time in ms, with the
+	// target set up (0 for automatic) and the normal correction range in ppm.
+	// returns the speed correction in ppm
+	int Update(int latency, int64_t time, int setupTarget,
+			int normalCorrection)
+	{
+		// skip samples while pipeline is filling up
+		if (m_samples < 0)
+		{
+			m_samples++;
+			return m_correction;
+		}
+
+		// low pass filtered latency and its mean deviation as jitter estimation
+		if (!m_samples)
+			m_latency = latency;
+
+		float deviation = latency - m_latency;
+		m_latency += deviation / 32;
+		m_jitter += (fabsf(deviation) - m_jitter) / 16;
+
+		// integrate over time, not samples, so the gain doesn't depend on the
+		// frame rates of the streams. a gap, e.g. after a stall, counts as
+		// one second at most
+		float dt = m_time && time > m_time ? (time - m_time) / 1000.0f : 0;
+		if (dt > 1.0f)
+			dt = 1.0f;
+		m_time = time;
+
+		if (m_samples < LATENCY_FILTER_WARMUP)
+		{
+			m_samples++;
+			return m_correction;
+		}
+
+		// automatic target is kept, even if overridden by setup, so it's
+		// available again as soon as setup target is reset to zero
+		if (!m_target)
+			m_target = m_latency + LATENCY_JITTER_FACTOR * m_jitter;
+
+		int target = Target(setupTarget);
+		if (m_samples == LATENCY_FILTER_WARMUP)
+		{
+			m_error = m_latency - target;
+			m_samples++;
+		}
+		m_error += (m_latency - target - m_error) *
+				(dt < m_smoothing ? dt / m_smoothing : 1);
+		float error = m_error;
+
+		// allow full correction range if latency is far away from target
+		int normal = Constrain(normalCorrection, 0, LATENCY_MAX_CORRECTION_FAST);
+		int maxCorrection = normal;
+		if (m_latency > 2.0f * target)
+		{
+			maxCorrection = LATENCY_MAX_CORRECTION_FAST;
+			if (m_correction <= normal)
+			{
+				m_posMaxCorrections++;
+				DBG("latency too big, speeding up...");
+			}
+		}
+		else if (m_latency < 0.5f * target)
+		{
+			maxCorrection = LATENCY_MAX_CORRECTION_FAST;
+			if (m_correction >= -normal)
+			{
+				m_negMaxCorrections++;
+				DBG("latency too small, slowing down...");
+			}
+		}
+
+		// anti wind-up: only integrate while not saturated or if the error
+		// leads back into range
+		float correction = m_gainP * error + m_integral;
+		if ((correction < maxCorrection || error < 0) &&
+				(correction > -maxCorrection || error > 0))
+			m_integral = Constrain(m_integral + m_gainI * error * dt,
+					(float)-normal, (float)normal);
+
+		correction = m_gainP * error + m_integral;
+		m_correction = Constrain((int)correction, -maxCorrection, maxCorrection);
+		return m_correction;
+	}
+
+	// nothing is reported until filter has settled
+	bool Valid(void) const           { return m_samples >= LATENCY_FILTER_WARMUP; }
+
+	int Latency(void) const          { return (int)m_latency; }
+	int Jitter(void) const           { return (int)m_jitter; }
+	int Error(void) const            { return (int)m_error; }
+	int Correction(void) const       { return m_correction; }
+	int PosMaxCorrections(void) const { return m_posMaxCorrections; }
+	int NegMaxCorrections(void) const { return m_negMaxCorrections; }
+
+	// target set up or the automatic one, which is 0 until it's known
+	int Target(int setupTarget) const
+	{
+		return setupTarget ? setupTarget : m_target;
+	}
+
+private:
+
+	template<class T> static T Constrain(T val, T min, T max)
+	{
+		return val < min ? min : val > max ? max : val;
+	}
+
+	float   m_gainP;
+	float   m_gainI;
+	float   m_smoothing;
+
+	int     m_samples;
+	int64_t m_time;
+	float   m_latency;
+	float   m_jitter;
+	int     m_target;
+
+	float   m_error;
+	float   m_integral;
+	int     m_correction;
+
+	int     m_posMaxCorrections;
+	int     m_negMaxCorrections;
+};
+
+#endif
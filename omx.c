@@ -4,8 +4,6 @@
  * $Id$
  */
 
-#include <queue>
-
 #include "omx.h"
 #include "display.h"
 
@@ -53,6 +51,9 @@ default: \
 	(s).eChannelMapping[1] = OMX_AUDIO_ChannelRF; \
 	break; }
 
+// number of pre-allocated event slots, must be a power of two
+#define OMX_EVENT_QUEUE_SIZE 64
+
 class cOmxEvents
 {
 
@@ -66,52 +67,97 @@ public:
 
 	struct Event
 	{
-		Event(eEvent _event, int _data)
-			: event(_event), data(_data) { };
 		eEvent 	event;
 		int		data;
+#ifdef DEBUG
+		uint64_t timestamp;
+#endif
 	};
 
 	cOmxEvents() :
-		m_signal(new cCondWait()),
-		m_mutex(new cMutex())
-	{ }
+		m_cond(new cCondVar()),
+		m_mutex(new cMutex()),
+		m_rdIdx(0),
+		m_wrIdx(0),
+		m_wakeup(false),
+		m_dropped(0)
+	{
+#ifdef DEBUG
+		memset(m_latency, 0, sizeof(m_latency));
+#endif
+	}
 
 	virtual ~cOmxEvents()
 	{
-		while (!m_events.empty())
+		delete m_cond;
+		delete m_mutex;
+	}
+
+	// block until an event arrives or Wakeup() has been called, returns
+	// false in the latter case
+	bool Wait(Event &event)
+	{
+		bool ret = false;
+		m_mutex->Lock();
+
+		while (m_rdIdx == m_wrIdx && !m_wakeup)
+			m_cond->Wait(*m_mutex);
+
+		if (m_rdIdx != m_wrIdx)
 		{
-			delete m_events.front();
-			m_events.pop();
+			event = m_events[m_rdIdx & (OMX_EVENT_QUEUE_SIZE - 1)];
+			m_rdIdx++;
+			ret = true;
+#ifdef DEBUG
+			AddLatency(Now() - event.timestamp);
+#endif
 		}
-		delete m_signal;
-		delete m_mutex;
+		else
+			m_wakeup = false;
+
+		m_mutex->Unlock();
+		return ret;
 	}
 
-	Event* Wait(void)
+	void Add(eEvent event, int data)
 	{
-		Event* event = 0;
-		while (true)
+		m_mutex->Lock();
+		if (m_wrIdx - m_rdIdx < OMX_EVENT_QUEUE_SIZE)
 		{
-			if (!m_events.empty())
-			{
-				m_mutex->Lock();
-				event = m_events.front();
-				m_events.pop();
-				m_mutex->Unlock();
-				break;
-			}
-			m_signal->Wait(10);
+			Event &slot = m_events[m_wrIdx & (OMX_EVENT_QUEUE_SIZE - 1)];
+			slot.event = event;
+			slot.data = data;
+#ifdef DEBUG
+			slot.timestamp = Now();
+#endif
+			m_wrIdx++;
+			m_cond->Broadcast();
 		}
-		return event;
+		else
+			m_dropped++;
+
+		m_mutex->Unlock();
+	}
+
+	void Wakeup(void)
+	{
+		m_mutex->Lock();
+		m_wakeup = true;
+		m_cond->Broadcast();
+		m_mutex->Unlock();
 	}
 
-	void Add(Event* event)
+	void LogStats(void)
 	{
 		m_mutex->Lock();
-		m_events.push(event);
+		if (m_dropped)
+			ELOG("dropped %u OMX events, queue full!", m_dropped);
+#ifdef DEBUG
+		DBG("OMX event latency: <50us: %u, <200us: %u, <1ms: %u, <5ms: %u, "
+				"<20ms: %u, >=20ms: %u", m_latency[0], m_latency[1],
+				m_latency[2], m_latency[3], m_latency[4], m_latency[5]);
+#endif
 		m_mutex->Unlock();
-		m_signal->Signal();
 	}
 
 private:
@@ -119,9 +165,34 @@ private:
 	cOmxEvents(const cOmxEvents&);
 	cOmxEvents& operator= (const cOmxEvents&);
 
-	cCondWait*	m_signal;
-	cMutex*		m_mutex;
-	std::queue<Event*> m_events;
+#ifdef DEBUG
+	static uint64_t Now(void)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+
+	void AddLatency(uint64_t us)
+	{
+		m_latency[
+			us <    50 ? 0 :
+			us <   200 ? 1 :
+			us <  1000 ? 2 :
+			us <  5000 ? 3 :
+			us < 20000 ? 4 : 5]++;
+	}
+
+	unsigned int m_latency[6];
+#endif
+
+	cCondVar*		m_cond;
+	cMutex*			m_mutex;
+	Event			m_events[OMX_EVENT_QUEUE_SIZE];
+	unsigned int	m_rdIdx;
+	unsigned int	m_wrIdx;
+	bool			m_wakeup;
+	unsigned int	m_dropped;
 };
 
 const char* cOmx::errStr(int err)
@@ -178,32 +249,30 @@ void cOmx::Action(void)
 {
 	while (Running())
 	{
-		cOmxEvents::Event* event = m_portEvents->Wait();
-		if (event)
+		cOmxEvents::Event event;
+		if (m_portEvents->Wait(event))
 		{
-			switch (event->event)
+			switch (event.event)
 			{
 			case cOmxEvents::ePortSettingsChanged:
 				if (m_handlePortEvents)
-					HandlePortSettingsChanged(event->data);
+					HandlePortSettingsChanged(event.data);
 				break;
 
 			case cOmxEvents::eConfigChanged:
-				if (event->data == OMX_IndexConfigBufferStall)
+				if (event.data == OMX_IndexConfigBufferStall)
 					if (IsBufferStall() && !IsClockFreezed() && m_onBufferStall)
 						m_onBufferStall(m_onBufferStallData);
 				break;
 
 			case cOmxEvents::eEndOfStream:
-				if (event->data == 90 && m_onEndOfStream)
+				if (event.data == 90 && m_onEndOfStream)
 					m_onEndOfStream(m_onEndOfStreamData);
 				break;
 
 			default:
 				break;
 			}
-
-			delete event;
 		}
 	}
 }
@@ -330,22 +399,19 @@ void cOmx::OnBufferEmpty(void *instance, COMPONENT_T *comp)
 void cOmx::OnPortSettingsChanged(void *instance, COMPONENT_T *comp, OMX_U32 data)
 {
 	cOmx* omx = static_cast <cOmx*> (instance);
-	omx->m_portEvents->Add(
-			new cOmxEvents::Event(cOmxEvents::ePortSettingsChanged, data));
+	omx->m_portEvents->Add(cOmxEvents::ePortSettingsChanged, data);
 }
 
 void cOmx::OnConfigChanged(void *instance, COMPONENT_T *comp, OMX_U32 data)
 {
 	cOmx* omx = static_cast <cOmx*> (instance);
-	omx->m_portEvents->Add(
-			new cOmxEvents::Event(cOmxEvents::eConfigChanged, data));
+	omx->m_portEvents->Add(cOmxEvents::eConfigChanged, data);
 }
 
 void cOmx::OnEndOfStream(void *instance, COMPONENT_T *comp, OMX_U32 data)
 {
 	cOmx* omx = static_cast <cOmx*> (instance);
-	omx->m_portEvents->Add(
-			new cOmxEvents::Event(cOmxEvents::eEndOfStream, data));
+	omx->m_portEvents->Add(cOmxEvents::eEndOfStream, data);
 }
 
 void cOmx::OnError(void *instance, COMPONENT_T *comp, OMX_U32 data)
@@ -364,6 +430,7 @@ cOmx::cOmx() :
 	m_freeVideoBuffers(true),
 	m_spareAudioBuffers(0),
 	m_spareVideoBuffers(0),
+	m_videoPacker(new cOmxVideoPacker(this)),
 	m_clockReference(eClockRefNone),
 	m_clockScale(0),
 	m_portEvents(new cOmxEvents()),
@@ -386,6 +453,7 @@ cOmx::cOmx() :
 
 cOmx::~cOmx()
 {
+	delete m_videoPacker;
 	delete m_portEvents;
 }
 
@@ -479,7 +547,12 @@ int cOmx::Init(void)
 int cOmx::DeInit(void)
 {
 	Cancel(-1);
-	m_portEvents->Add(0);
+	m_portEvents->Wakeup();
+
+	while (Active())
+		cCondWait::SleepMs(5);
+
+	m_portEvents->LogStats();
 
 	for (int i = 0; i < eNumTunnels; i++)
 		ilclient_disable_tunnel(&m_tun[i]);
@@ -809,6 +882,8 @@ void cOmx::StopVideo(void)
 {
 	Lock();
 
+	m_videoPacker->Clear();
+
 	// put video decoder into idle
 	ilclient_change_component_state(m_comp[eVideoDecoder], OMX_StateIdle);
 
@@ -888,6 +963,8 @@ void cOmx::FlushVideo(bool flushRender)
 {
 	Lock();
 
+	m_videoPacker->Clear();
+
 	if (OMX_SendCommand(ILC_GET_HANDLE(m_comp[eVideoDecoder]), OMX_CommandFlush, 130, NULL) != OMX_ErrorNone)
 		ELOG("failed to flush video decoder!");
 
@@ -1205,6 +1282,17 @@ OMX_BUFFERHEADERTYPE* cOmx::GetAudioBuffer(uint64_t pts)
 OMX_BUFFERHEADERTYPE* cOmx::GetVideoBuffer(uint64_t pts)
 {
 	Lock();
+
+	// keep order of already written data
+	m_videoPacker->Flush();
+	OMX_BUFFERHEADERTYPE* buf = AcquireVideoBuffer(pts);
+
+	Unlock();
+	return buf;
+}
+
+OMX_BUFFERHEADERTYPE* cOmx::AcquireVideoBuffer(uint64_t pts)
+{
 	OMX_BUFFERHEADERTYPE* buf = 0;
 	if (m_spareVideoBuffers)
 	{
@@ -1237,10 +1325,56 @@ OMX_BUFFERHEADERTYPE* cOmx::GetVideoBuffer(uint64_t pts)
 	else
 		m_freeVideoBuffers = false;
 
-	Unlock();
 	return buf;
 }
 
+void cOmx::ReleaseVideoBuffer(OMX_BUFFERHEADERTYPE *buf)
+{
+	// buffer has not been passed to the decoder, so keep its flags for the
+	// next buffer to be sent
+	if (buf->nFlags & OMX_BUFFERFLAG_STARTTIME)
+		m_setVideoStartTime = true;
+
+	if (buf->nFlags & OMX_BUFFERFLAG_DISCONTINUITY)
+		m_setVideoDiscontinuity = true;
+
+	buf->nFilledLen = 0;
+	buf->pAppPrivate = m_spareVideoBuffers;
+	m_spareVideoBuffers = buf;
+}
+
+bool cOmx::SubmitVideoBuffer(OMX_BUFFERHEADERTYPE *buf)
+{
+#ifdef DEBUG_BUFFERS
+	DumpBuffer(buf, "V");
+#endif
+
+	if (OMX_EmptyThisBuffer(ILC_GET_HANDLE(m_comp[eVideoDecoder]), buf)
+			!= OMX_ErrorNone)
+	{
+		ELOG("failed to empty OMX video buffer");
+		ReleaseVideoBuffer(buf);
+		return false;
+	}
+	return true;
+}
+
+int cOmx::WriteVideoData(const VideoFragment *fragments, int count,
+		bool endOfFrame)
+{
+	Lock();
+	int taken = m_videoPacker->Write(fragments, count, endOfFrame);
+	Unlock();
+	return taken;
+}
+
+void cOmx::SubmitPendingVideoData(void)
+{
+	Lock();
+	m_videoPacker->Flush();
+	Unlock();
+}
+
 #ifdef DEBUG_BUFFERS
 void cOmx::DumpBuffer(OMX_BUFFERHEADERTYPE *buf, const char *prefix)
 {
@@ -1305,24 +1439,7 @@ bool cOmx::EmptyVideoBuffer(OMX_BUFFERHEADERTYPE *buf)
 		return false;
 
 	Lock();
-	bool ret = true;
-#ifdef DEBUG_BUFFERS
-	DumpBuffer(buf, "V");
-#endif
-
-	if (OMX_EmptyThisBuffer(ILC_GET_HANDLE(m_comp[eVideoDecoder]), buf)
-			!= OMX_ErrorNone)
-	{
-		ELOG("failed to empty OMX video buffer");
-
-		if (buf->nFlags & OMX_BUFFERFLAG_STARTTIME)
-			m_setVideoStartTime = true;
-
-		buf->nFilledLen = 0;
-		buf->pAppPrivate = m_spareVideoBuffers;
-		m_spareVideoBuffers = buf;
-		ret = false;
-	}
+	bool ret = SubmitVideoBuffer(buf);
 	Unlock();
 	return ret;
 }
@@ -15,9 +15,11 @@ extern "C"
 #include "ilclient.h"
 }
 
+#include "omxpacker.h"
+
 class cOmxEvents;
 
-class cOmx : public cThread
+class cOmx : public cThread, private cOmxVideoPacker::cBufferSource
 {
 
 public:
@@ -51,6 +53,7 @@ public:
 	void StopClock();
 
 	void SetClockScale(OMX_S32 scale);
+	OMX_S32 GetClockScale(void) { return m_clockScale; }
 	bool IsClockFreezed(void) { return m_clockScale == 0; }
 	void SetCurrentReferenceTime(uint64_t pts);
 	unsigned int GetAudioLatency(void);
@@ -92,6 +95,15 @@ public:
 	bool EmptyAudioBuffer(OMX_BUFFERHEADERTYPE *buf);
 	bool EmptyVideoBuffer(OMX_BUFFERHEADERTYPE *buf);
 
+	typedef cOmxVideoPacker::Fragment VideoFragment;
+
+	// returns the number of bytes taken, see cOmxVideoPacker::Write()
+	int WriteVideoData(const VideoFragment *fragments, int count,
+			bool endOfFrame = false);
+
+	// pass video data kept back for filling up the last buffer to the decoder
+	void SubmitPendingVideoData(void);
+
 private:
 
 	virtual void Action(void);
@@ -145,6 +157,8 @@ private:
 	OMX_BUFFERHEADERTYPE* m_spareAudioBuffers;
 	OMX_BUFFERHEADERTYPE* m_spareVideoBuffers;
 
+	cOmxVideoPacker *m_videoPacker;
+
 	eClockReference	m_clockReference;
 	OMX_S32 m_clockScale;
 
@@ -160,6 +174,11 @@ private:
 	void (*m_onStreamStart)(void*);
 	void *m_onStreamStartData;
 
+	// cOmxVideoPacker::cBufferSource, to be called locked
+	virtual OMX_BUFFERHEADERTYPE* AcquireVideoBuffer(uint64_t pts);
+	virtual void ReleaseVideoBuffer(OMX_BUFFERHEADERTYPE *buf);
+	virtual bool SubmitVideoBuffer(OMX_BUFFERHEADERTYPE *buf);
+
 	void HandlePortSettingsChanged(unsigned int portId);
 	void SetBufferStallThreshold(int delayMs);
 	bool IsBufferStall(void);
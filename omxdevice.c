@@ -7,6 +7,7 @@
 #include "omxdevice.h"
 #include "omx.h"
 #include "audio.h"
+#include "latency.h"
 #include "display.h"
 #include "setup.h"
 
@@ -25,13 +26,6 @@ const int cOmxDevice::s_playbackSpeeds[eNumDirections][eNumPlaybackSpeeds] = {
 	{ S(0.0f), S(-0.125f), S(-0.25f), S(-0.5f), S(-1.0f), S(-2.0f), S(-4.0f), S(-12.0f) }
 };
 
-// speed correction factors for live mode
-// HDMI specification allows a tolerance of 1000ppm, however on the Raspberry Pi
-// it's limited to 175ppm to avoid audio drops one some A/V receivers
-const int cOmxDevice::s_liveSpeeds[eNumLiveSpeeds] = {
-	S(0.999f), S(0.99985f), S(1.000f), S(1.00015), S(1.001)
-};
-
 const uchar cOmxDevice::PesVideoHeader[14] = {
 	0x00, 0x00, 0x01, 0xe0, 0x00, 0x00, 0x80, 0x80, 0x05, 0x00, 0x00, 0x00, 0x00, 0x00
 };
@@ -43,7 +37,6 @@ cOmxDevice::cOmxDevice(void (*onPrimaryDevice)(void)) :
 	m_audio(new cRpiAudioDecoder(m_omx)),
 	m_mutex(new cMutex()),
 	m_videoCodec(cVideoCodec::eInvalid),
-	m_liveSpeed(eNoCorrection),
 	m_playbackSpeed(eNormal),
 	m_direction(eForward),
 	m_hasVideo(false),
@@ -54,10 +47,8 @@ cOmxDevice::cOmxDevice(void (*onPrimaryDevice)(void)) :
 	m_audioPts(0),
 	m_videoPts(0),
 	m_audioId(0),
-	m_latencySamples(0),
-	m_latencyTarget(0),
-	m_posMaxCorrections(0),
-	m_negMaxCorrections(0)
+	m_latency(new cLatencyController()),
+	m_scaleChanges(0)
 {
 }
 
@@ -67,6 +58,7 @@ cOmxDevice::~cOmxDevice()
 
 	delete m_omx;
 	delete m_audio;
+	delete m_latency;
 	delete m_mutex;
 }
 
@@ -374,38 +366,19 @@ int cOmxDevice::PlayVideo(const uchar *Data, int Length, bool EndOfFrame)
 		if (!m_hasAudio && Transferring() && pts)
 			UpdateLatency(pts);
 
-		// skip PES header, proceed with payload towards OMX
-		Length -= PesPayloadOffset(Data);
-		Data += PesPayloadOffset(Data);
-
-		while (Length > 0)
+		// skip PES header, proceed with payload towards OMX
+		if (Length > PesPayloadOffset(Data))
 		{
-			OMX_BUFFERHEADERTYPE *buf = m_omx->GetVideoBuffer(pts);
-			if (buf)
-			{
-				buf->nFilledLen = buf->nAllocLen < (unsigned)Length ?
-						buf->nAllocLen : Length;
-
-				memcpy(buf->pBuffer, Data, buf->nFilledLen);
-				Length -= buf->nFilledLen;
-				Data += buf->nFilledLen;
-
-				if (EndOfFrame && !Length)
-					buf->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
-
-				if (!m_omx->EmptyVideoBuffer(buf))
-				{
-					ret = 0;
-					ELOG("failed to pass buffer to video decoder!");
-					break;
-				}
-			}
-			else
-			{
+			cOmx::VideoFragment fragment;
+			fragment.data = Data + PesPayloadOffset(Data);
+			fragment.length = Length - PesPayloadOffset(Data);
+			fragment.pts = pts;
+
+			// let VDR repeat the packet only if nothing of it has been taken,
+			// data already taken must not be sent twice. the end of the
+			// packet may be kept back until more data follows
+			if (!m_omx->WriteVideoData(&fragment, 1, EndOfFrame))
 				ret = 0;
-				break;
-			}
-			pts = 0;
 		}
 	}
 	m_mutex->Unlock();
@@ -594,94 +567,68 @@ void cOmxDevice::UpdateLatency(int64_t pts)
 	if (!stc || pts <= stc)
 		return;
 
-	for (int i = LATENCY_FILTER_SIZE - 1; i > 0; i--)
-		m_latency[i] = m_latency[i - 1];
-	m_latency[0] = (pts - stc) / 90;
+	int correction = m_latency->Update((pts - stc) / 90, cTimeMs::Now(),
+			cRpiSetup::GetLatencyTarget(),
+			cRpiSetup::GetMaxLatencyCorrection());
 
-	if (m_latencySamples < LATENCY_FILTER_SIZE - 1)
-	{
-		m_latencySamples++;
+	if (!m_latency->Valid())
 		return;
-	}
+
+	// clock scale is 16.16 fixed point, so one step is ~15ppm. to avoid
+	// toggling between two neighboring values, only apply changes of at
+	// least two steps
+	OMX_S32 scale = S(1.0f) + (OMX_S32)(correction * 65536LL / 1000000);
+	if (abs(scale - m_omx->GetClockScale()) < 2)
+		return;
+
+	m_omx->SetClockScale(scale);
+	m_scaleChanges++;
 
 #ifdef DEBUG_LATENCY
-	eLiveSpeed oldSpeed = m_liveSpeed;
+	// scale changes with almost every sample, so log once a second at most
+	static cTimeMs logTimer;
+	if (logTimer.TimedOut())
+	{
+		logTimer.Set(1000);
+		DLOG("%s%s latency = %4dms, jitter = %3dms, target = %4dms, "
+				"error = %+4dms, corr = %+5dppm, max neg/pos corr = %d/%d, "
+				"changes = %d", m_hasAudio ? "A" : "-",  m_hasVideo ? "V" : "-",
+				m_latency->Latency(), m_latency->Jitter(),
+				m_latency->Target(cRpiSetup::GetLatencyTarget()),
+				m_latency->Error(), correction,
+				m_latency->NegMaxCorrections(),
+				m_latency->PosMaxCorrections(), m_scaleChanges);
+	}
 #endif
-	int average = 0;
+}
 
-	for (int i = 0; i < LATENCY_FILTER_SIZE; i++)
-		average += m_latency[i];
-	average = average / LATENCY_FILTER_SIZE;
+void cOmxDevice::GetLatency(int &latency, int &target, int &correction)
+{
+	m_mutex->Lock();
 
-	if (!m_latencyTarget)
-		m_latencyTarget = 1.4f * average;
+	// report nothing until filter has settled or if not in live mode
+	bool valid = Transferring() && m_latency->Valid();
 
-	if (average > 2.0f * m_latencyTarget)
-	{
-		if (m_liveSpeed < ePosMaxCorrection)
-		{
-			m_liveSpeed = ePosMaxCorrection;
-			m_posMaxCorrections++;
-			DBG("latency too big, speeding up...");
-		}
-	}
-	else if (average < 0.5f * m_latencyTarget)
-	{
-		if (m_liveSpeed > eNegMaxCorrection)
-		{
-			m_liveSpeed = eNegMaxCorrection;
-			m_negMaxCorrections++;
-			DBG("latency too small, slowing down...");
-		}
-	}
-	else if (average > 1.1f * m_latencyTarget)
-	{
-		if (m_liveSpeed < ePosMaxCorrection)
-			m_liveSpeed = ePosCorrection;
-	}
-	else if (average < 0.9f * m_latencyTarget)
-	{
-		if (m_liveSpeed > eNegMaxCorrection)
-			m_liveSpeed = eNegCorrection;
-	}
-	else if (average > m_latencyTarget)
-	{
-		if (m_liveSpeed < eNoCorrection)
-			m_liveSpeed = eNoCorrection;
-	}
-	else if (average < m_latencyTarget)
-	{
-		if (m_liveSpeed > eNoCorrection)
-			m_liveSpeed = eNoCorrection;
-	} else
-		m_liveSpeed = eNoCorrection;
+	latency = valid ? m_latency->Latency() : 0;
+	target = cRpiSetup::GetLatencyTarget();
+	if (!target && valid)
+		target = m_latency->Target(0);
 
-	m_omx->SetClockScale(s_liveSpeeds[m_liveSpeed]);
+	correction = m_latency->Correction();
 
-#ifdef DEBUG_LATENCY
-	if (oldSpeed != m_liveSpeed)
-	{
-		DLOG("%s%s latency = %4dms, target = %4dms, corr = %s, "
-				"max neg/pos corr = %d/%d",
-				m_hasAudio ? "A" : "-",  m_hasVideo ? "V" : "-",
-				average, m_latencyTarget,
-				m_liveSpeed == eNegMaxCorrection ? "--|  " :
-				m_liveSpeed == eNegCorrection    ? " -|  " :
-				m_liveSpeed == eNoCorrection     ? "  |  " :
-				m_liveSpeed == ePosCorrection    ? "  |+ " :
-				m_liveSpeed == ePosMaxCorrection ? "  |++" : "  ?  ",
-				m_negMaxCorrections, m_posMaxCorrections);
-	}
-#endif
+	m_mutex->Unlock();
+}
+
+void cOmxDevice::GetAudioQueueStats(int &queued, int &size, int &maxQueued,
+		int &underruns, bool reset)
+{
+	m_audio->GetQueueStats(queued, size, maxQueued, underruns, reset);
 }
 
 void cOmxDevice::ResetLatency(void)
 {
-	m_latencySamples = - LATENCY_FILTER_PREROLL;
-	m_latencyTarget = 0;
-	m_liveSpeed = eNoCorrection;
-	m_posMaxCorrections = 0;
-	m_negMaxCorrections = 0;
+	m_latency->Reset();
+	m_scaleChanges = 0;
 }
 
 void cOmxDevice::HandleBufferStall()
@@ -792,6 +739,17 @@ bool cOmxDevice::Poll(cPoller &Poller, int TimeoutMs)
 	return true;
 }
 
+bool cOmxDevice::Flush(int TimeoutMs)
+{
+	// no more data is to be expected for now, so pass what has been kept
+	// back for filling up the last buffer to the decoder
+	m_mutex->Lock();
+	if (m_hasVideo)
+		m_omx->SubmitPendingVideoData();
+	m_mutex->Unlock();
+	return true;
+}
+
 void cOmxDevice::MakePrimaryDevice(bool On)
 {
 	if (On && m_onPrimaryDevice)
@@ -13,6 +13,7 @@
 
 class cOmx;
 class cRpiAudioDecoder;
+class cLatencyController;
 class cMutex;
 
 class cOmxDevice : cDevice
@@ -67,6 +68,14 @@ public:
 	virtual void SetVolumeDevice(int Volume);
 
 	virtual bool Poll(cPoller &Poller, int TimeoutMs = 0);
+	virtual bool Flush(int TimeoutMs = 0);
+
+	// measured live latency and its target in ms, correction in ppm
+	void GetLatency(int &latency, int &target, int &correction);
+
+	// decoded audio frame queue, see cRpiAudioDecoder::GetQueueStats()
+	void GetAudioQueueStats(int &queued, int &size, int &maxQueued,
+			int &underruns, bool reset);
 
 protected:
 
@@ -106,25 +115,7 @@ protected:
 				speed == eFastest ? "fastest" : "unknown";
 	}
 
-	enum eLiveSpeed {
-		eNegMaxCorrection,
-		eNegCorrection,
-		eNoCorrection,
-		ePosCorrection,
-		ePosMaxCorrection,
-		eNumLiveSpeeds
-	};
-
-	static const char* LiveSpeedStr(eLiveSpeed corr) {
-		return	corr == eNegMaxCorrection ? "max negative" :
-				corr == eNegCorrection    ? "negative"     :
-				corr == eNoCorrection     ? "no"           :
-				corr == ePosCorrection    ? "positive"     :
-				corr == ePosMaxCorrection ? "max positive" : "unknown";
-	}
-
 	static const int s_playbackSpeeds[eNumDirections][eNumPlaybackSpeeds];
-	static const int s_liveSpeeds[eNumLiveSpeeds];
 
 	static const uchar PesVideoHeader[14];
 
@@ -165,7 +156,6 @@ private:
 
 	cVideoCodec::eCodec	m_videoCodec;
 
-	eLiveSpeed          m_liveSpeed;
 	ePlaybackSpeed      m_playbackSpeed;
 	eDirection          m_direction;
 
@@ -181,15 +171,8 @@ private:
 
 	uchar   m_audioId;
 
-#define LATENCY_FILTER_SIZE 8
-#define LATENCY_FILTER_PREROLL 16
-
-	int     m_latency[LATENCY_FILTER_SIZE];
-	int     m_latencySamples;
-	int     m_latencyTarget;
-
-	int     m_posMaxCorrections;
-	int     m_negMaxCorrections;
+	cLatencyController *m_latency;
+	int     m_scaleChanges;
 };
 
 #endif
@@ -0,0 +1,204 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+#ifndef OMX_PACKER_H
+#define OMX_PACKER_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Packs video data into the input buffers of the video decoder. The last,
+// partially filled buffer is kept pending across calls, so small PES packets
+// share a buffer. It's passed on once it's full, when data with a new PTS
+// arrives, at the end of a frame or when flushed.
+// Only depends on the buffer fields of OMX_BUFFERHEADERTYPE, which needs to
+// be declared by the includer, so it can be exercised on any host, see
+// bench/omxbench.c.
+
+class cOmxVideoPacker
+{
+public:
+
+	// provides and consumes the decoder's input buffers
+	class cBufferSource
+	{
+	public:
+
+		virtual ~cBufferSource() { }
+
+		// returns an empty buffer carrying the given PTS, NULL if there
+		// is none available
+		virtual OMX_BUFFERHEADERTYPE* AcquireVideoBuffer(uint64_t pts) = 0;
+
+		// takes back a buffer which has not been passed to the decoder
+		virtual void ReleaseVideoBuffer(OMX_BUFFERHEADERTYPE *buf) = 0;
+
+		// passes a buffer to the decoder, a failed buffer is released
+		virtual bool SubmitVideoBuffer(OMX_BUFFERHEADERTYPE *buf) = 0;
+	};
+
+	struct Fragment
+	{
+		const unsigned char *data;
+		unsigned int length;
+		uint64_t pts;
+	};
+
+	cOmxVideoPacker(cBufferSource *source) :
+		m_source(source),
+		m_pending(0)
+	{ }
+
+	~cOmxVideoPacker()
+	{
+		Clear();
+	}
+
+	// copy fragments to buffers, returns the number of bytes taken, which
+	// have either been passed to the decoder or are kept in the pending
+	// buffer. fragments are taken completely or not at all
+	int Write(const Fragment *fragments, int count, bool endOfFrame = false)
+	{
+		int taken = 0;
+
+		for (int i = 0; i < count; i++)
+		{
+			const unsigned char *data = fragments[i].data;
+			unsigned int length = fragments[i].length;
+			uint64_t pts = fragments[i].pts;
+
+			// a buffer only carries a single time stamp, so data with PTS
+			// needs to start with a new buffer
+			if (pts && !Flush())
+				break;
+
+			// fill pending buffer first and keep all filled buffers in a list
+			// until the fragment has been copied completely, so it can be
+			// withdrawn if we run out of buffers
+			OMX_BUFFERHEADERTYPE *buf = m_pending;
+			OMX_BUFFERHEADERTYPE *head = 0, *tail = 0;
+			unsigned int pendingLength = buf ? buf->nFilledLen : 0;
+
+			while (length)
+			{
+				if (!buf)
+				{
+					buf = m_source->AcquireVideoBuffer(pts);
+					if (!buf)
+						break;
+					pts = 0;
+				}
+
+				unsigned int len = buf->nAllocLen - buf->nFilledLen;
+				if (len > length)
+					len = length;
+
+				memcpy(buf->pBuffer + buf->nFilledLen, data, len);
+				buf->nFilledLen += len;
+				data += len;
+				length -= len;
+
+				if (buf->nFilledLen == buf->nAllocLen)
+				{
+					buf->pAppPrivate = 0;
+					if (tail)
+						tail->pAppPrivate = buf;
+					else
+						head = buf;
+					tail = buf;
+					buf = 0;
+				}
+			}
+
+			if (length)
+			{
+				// out of buffers, withdraw what has been copied so far
+				while (head)
+				{
+					OMX_BUFFERHEADERTYPE *next =
+						static_cast <OMX_BUFFERHEADERTYPE*>(head->pAppPrivate);
+					head->pAppPrivate = 0;
+					if (head != m_pending)
+						m_source->ReleaseVideoBuffer(head);
+					head = next;
+				}
+				if (m_pending)
+					m_pending->nFilledLen = pendingLength;
+				break;
+			}
+
+			m_pending = buf;
+			taken += fragments[i].length;
+
+			bool frameComplete = endOfFrame && i == count - 1;
+			if (frameComplete)
+			{
+				if (m_pending)
+					m_pending->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+				else if (tail)
+					tail->nFlags |= OMX_BUFFERFLAG_ENDOFFRAME;
+			}
+
+			// pass on filled buffers, the data of a failed one is lost, but
+			// must not be sent again either
+			bool ok = true;
+			while (head)
+			{
+				OMX_BUFFERHEADERTYPE *next =
+						static_cast <OMX_BUFFERHEADERTYPE*>(head->pAppPrivate);
+				head->pAppPrivate = 0;
+				if (!ok)
+					m_source->ReleaseVideoBuffer(head);
+				else
+					ok = m_source->SubmitVideoBuffer(head);
+				head = next;
+			}
+
+			if (!ok)
+			{
+				Clear();
+				break;
+			}
+
+			// don't hold back the end of a complete frame
+			if (frameComplete)
+				Flush();
+		}
+		return taken;
+	}
+
+	// pass the pending buffer on to the decoder
+	bool Flush(void)
+	{
+		OMX_BUFFERHEADERTYPE *buf = m_pending;
+		m_pending = 0;
+		return buf ? m_source->SubmitVideoBuffer(buf) : true;
+	}
+
+	// drop the pending buffer, e.g. when the decoder gets flushed
+	void Clear(void)
+	{
+		if (m_pending)
+			m_source->ReleaseVideoBuffer(m_pending);
+		m_pending = 0;
+	}
+
+	// number of bytes waiting in the pending buffer
+	unsigned int Pending(void)
+	{
+		return m_pending ? m_pending->nFilledLen : 0;
+	}
+
+private:
+
+	cOmxVideoPacker(const cOmxVideoPacker&);
+	cOmxVideoPacker& operator= (const cOmxVideoPacker&);
+
+	cBufferSource *m_source;
+	OMX_BUFFERHEADERTYPE *m_pending;
+};
+
+#endif
@@ -0,0 +1,637 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+#ifndef OVG_FONT_H
+#define OVG_FONT_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <vector>
+
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+#include "rasterizer.h"
+#include "tools.h"
+
+// Glyph conversion and text layout of the OpenVG OSD. Only depends on
+// FreeType, so the software font path can be exercised on any host, see
+// bench/fontbench.c. Creating OpenVG fonts is left to cOvgFont.
+
+#define CHAR_HEIGHT (1 << 14)
+#define OVG_STRING_CACHE_SIZE 256 // shaped strings per font
+
+// segment types of glyph outlines, which have the values of OpenVG's
+// VGPathSegment, so outlines can be passed to vgAppendPathData() as they are
+enum eOvgSegment {
+	eOvgClosePath = 0,
+	eOvgMoveTo    = 2,
+	eOvgLineTo    = 4,
+	eOvgQuadTo    = 10,
+	eOvgCubicTo   = 12
+};
+
+/* ------------------------------------------------------------------------- */
+
+// hash table with open addressing and linear probing, key 0 is reserved
+
+template<class T> class cOvgHash
+{
+public:
+
+	cOvgHash(int size = 8) : m_size(0), m_used(0), m_keys(0), m_values(0)
+	{
+		Resize(size);
+	}
+
+	~cOvgHash()
+	{
+		delete[] m_keys;
+		delete[] m_values;
+	}
+
+	T *Find(uint key) const
+	{
+		for (uint i = Hash(key) & (m_size - 1); m_keys[i];
+				i = (i + 1) & (m_size - 1))
+			if (m_keys[i] == key)
+				return &m_values[i];
+
+		return 0;
+	}
+
+	void Insert(uint key, const T &value)
+	{
+		// keep load factor below 3/4
+		if ((m_used + 1) * 4 > m_size * 3)
+			Resize(m_size * 2);
+
+		uint i = Hash(key) & (m_size - 1);
+		while (m_keys[i] && m_keys[i] != key)
+			i = (i + 1) & (m_size - 1);
+
+		if (!m_keys[i])
+			m_used++;
+
+		m_keys[i] = key;
+		m_values[i] = value;
+	}
+
+	void Remove(uint key)
+	{
+		uint i = Hash(key) & (m_size - 1);
+		while (m_keys[i] && m_keys[i] != key)
+			i = (i + 1) & (m_size - 1);
+
+		if (!m_keys[i])
+			return;
+
+		m_keys[i] = 0;
+		m_used--;
+
+		// re-insert the rest of the cluster to keep probe chains intact
+		for (uint j = (i + 1) & (m_size - 1); m_keys[j];
+				j = (j + 1) & (m_size - 1))
+		{
+			uint k = m_keys[j];
+			m_keys[j] = 0;
+			m_used--;
+			Insert(k, m_values[j]);
+		}
+	}
+
+	void Clear(void)
+	{
+		memset(m_keys, 0, sizeof(uint) * m_size);
+		m_used = 0;
+	}
+
+private:
+
+	cOvgHash(const cOvgHash&);
+	cOvgHash& operator= (const cOvgHash&);
+
+	static uint Hash(uint key)
+	{
+		key ^= key >> 16;
+		key *= 0x45d9f3b;
+		key ^= key >> 16;
+		return key;
+	}
+
+	void Resize(int size)
+	{
+		int oldSize = m_size;
+		uint *oldKeys = m_keys;
+		T *oldValues = m_values;
+
+		m_size = size;
+		m_used = 0;
+		m_keys = new uint[m_size];
+		m_values = new T[m_size];
+		memset(m_keys, 0, sizeof(uint) * m_size);
+
+		for (int i = 0; i < oldSize; i++)
+			if (oldKeys[i])
+				Insert(oldKeys[i], oldValues[i]);
+
+		delete[] oldKeys;
+		delete[] oldValues;
+	}
+
+	int   m_size;
+	int   m_used;
+	uint *m_keys;
+	T    *m_values;
+};
+
+/* ------------------------------------------------------------------------- */
+
+// glyphs containing kerning cache, based on VDR's implementation
+
+class cOvgGlyph
+{
+public:
+
+	cOvgGlyph(uint charCode, float advanceX, float advanceY) :
+		m_charCode(charCode), m_advanceX(advanceX), m_advanceY(advanceY) { }
+
+	virtual ~cOvgGlyph() { }
+
+	uint  CharCode(void) { return m_charCode; }
+	float AdvanceX(void) { return m_advanceX; }
+	float AdvanceY(void) { return m_advanceY; }
+
+	bool GetKerningCache(uint prevSym, float &kerning)
+	{
+		if (float *k = m_kerningCache.Find(prevSym))
+		{
+			kerning = *k;
+			return true;
+		}
+		return false;
+	}
+
+	void SetKerningCache(uint prevSym, float kerning)
+	{
+		m_kerningCache.Insert(prevSym, kerning);
+	}
+
+	// the software backend draws glyphs from their outline
+	void SetOutline(const std::vector<unsigned char> &segments,
+			const std::vector<short> &coord)
+	{
+		m_segments = segments;
+		m_coord = coord;
+	}
+
+	// append outline in units of CHAR_HEIGHT to path
+	void AppendOutline(cRasterPath &path) const
+	{
+		const short *c = m_coord.size() ? &m_coord[0] : 0;
+		for (unsigned int i = 0; i < m_segments.size(); i++)
+		{
+			switch (m_segments[i])
+			{
+			case eOvgMoveTo:
+				path.MoveTo(c[0], c[1]);
+				c += 2;
+				break;
+			case eOvgLineTo:
+				path.LineTo(c[0], c[1]);
+				c += 2;
+				break;
+			case eOvgQuadTo:
+				path.QuadTo(c[0], c[1], c[2], c[3]);
+				c += 4;
+				break;
+			case eOvgCubicTo:
+				path.CubicTo(c[0], c[1], c[2], c[3], c[4], c[5]);
+				c += 6;
+				break;
+			case eOvgClosePath:
+				path.Close();
+				break;
+			}
+		}
+	}
+
+private:
+
+	uint m_charCode;
+
+	float m_advanceX;
+	float m_advanceY;
+
+	cOvgHash<float> m_kerningCache;
+
+	std::vector<unsigned char> m_segments;
+	std::vector<short> m_coord;
+};
+
+/* ------------------------------------------------------------------------- */
+
+// shaped string, created and cached by cOvgFontFace
+
+class cOvgString
+{
+public:
+
+	      int           Length(void)     { return  m_glyphIds.size(); }
+	      float         Width(void)      { return  m_width;           }
+	      float         Height(void)     { return  m_height;          }
+	      float         Descender(void)  { return  m_descender;       }
+	const unsigned int *GlyphIds(void)   { return &m_glyphIds[0];     }
+	const float        *Kerning(void)    { return &m_kerning[0];      }
+
+private:
+
+	friend class cOvgFontFace;
+
+	cOvgString(const uint *symbols, uint key, float height, float descender) :
+		m_key(key), m_width(0.0f), m_height(height), m_descender(descender),
+		m_prev(0), m_next(0)
+	{
+		for (int i = 0; symbols[i]; i++)
+			m_symbols.push_back(symbols[i]);
+	}
+
+	~cOvgString() { }
+
+	bool Matches(const uint *symbols) const
+	{
+		for (unsigned int i = 0; i < m_symbols.size(); i++)
+			if (m_symbols[i] != symbols[i])
+				return false;
+
+		return !symbols[m_symbols.size()];
+	}
+
+	// approximate memory used by this string
+	int Size(void) const
+	{
+		return sizeof(cOvgString) +
+				m_symbols.capacity() * sizeof(uint) +
+				m_glyphIds.capacity() * sizeof(unsigned int) +
+				m_kerning.capacity() * sizeof(float);
+	}
+
+	std::vector<uint> m_symbols;
+	std::vector<unsigned int> m_glyphIds;
+	std::vector<float> m_kerning;
+
+	uint m_key;
+
+	float m_width;
+	float m_height;
+	float m_descender;
+
+	// LRU list of the font's string cache
+	cOvgString *m_prev;
+	cOvgString *m_next;
+};
+
+/* ------------------------------------------------------------------------- */
+
+// FreeType face with the glyphs converted so far and a cache of shaped
+// strings. glyphs keep their outlines for the software backend, unless
+// CreateGlyph() is overridden
+
+class cOvgFontFace
+{
+public:
+
+	// empty face, which has no glyphs
+	cOvgFontFace(void) :
+		m_height(0.0f),
+		m_descender(0.0f),
+		m_face(0),
+		m_glyphIndex(256),
+		m_stringIndex(OVG_STRING_CACHE_SIZE * 2),
+		m_first(0),
+		m_last(0),
+		m_numStrings(0),
+		m_stringHits(0),
+		m_stringMisses(0),
+		m_stringBytes(0)
+	{ }
+
+	cOvgFontFace(FT_Library lib, const char *fileName) :
+		m_height(0.0f),
+		m_descender(0.0f),
+		m_face(0),
+		m_glyphIndex(256),
+		m_stringIndex(OVG_STRING_CACHE_SIZE * 2),
+		m_first(0),
+		m_last(0),
+		m_numStrings(0),
+		m_stringHits(0),
+		m_stringMisses(0),
+		m_stringBytes(0)
+	{
+		if (FT_New_Face(lib, fileName, 0, &m_face))
+		{
+			ELOG("failed to open %s!", fileName);
+			m_face = 0;
+			return;
+		}
+
+		FT_Set_Char_Size(m_face, 0, CHAR_HEIGHT, 0, 0);
+		m_height = (float)(m_face->size->metrics.height) / CHAR_HEIGHT;
+		m_descender = (float)(abs(m_face->size->metrics.descender)) /
+				CHAR_HEIGHT;
+	}
+
+	virtual ~cOvgFontFace()
+	{
+		while (m_first)
+		{
+			cOvgString *string = m_first;
+			m_first = string->m_next;
+			delete string;
+		}
+		for (unsigned int i = 0; i < m_glyphs.size(); i++)
+			delete m_glyphs[i];
+
+		if (m_face)
+			FT_Done_Face(m_face);
+	}
+
+	cOvgGlyph* Glyph(uint charCode) const
+	{
+		if (cOvgGlyph **g = m_glyphIndex.Find(charCode))
+			return *g;
+
+		cOvgGlyph *glyph = ConvertChar(charCode);
+		if (glyph)
+			AddGlyph(glyph);
+
+		return glyph;
+	}
+
+	float Kerning(cOvgGlyph *glyph, uint prevSym) const
+	{
+		float kerning = 0.0f;
+		if (glyph && prevSym && m_face)
+		{
+			if (!glyph->GetKerningCache(prevSym, kerning))
+			{
+				FT_Vector delta;
+				FT_UInt cur = FT_Get_Char_Index(m_face,	glyph->CharCode());
+				FT_UInt prev = FT_Get_Char_Index(m_face, prevSym);
+				FT_Get_Kerning(m_face, prev, cur, FT_KERNING_DEFAULT, &delta);
+
+				kerning = (float)delta.x / CHAR_HEIGHT;
+				glyph->SetKerningCache(prevSym, kerning);
+			}
+		}
+		return kerning;
+	}
+
+	// returns the shaped string from the cache or creates a new one,
+	// strings are owned by the font and must not be deleted
+
+	cOvgString *String(const uint *symbols) const
+	{
+		uint key = StringHash(symbols);
+		while (cOvgString **s = m_stringIndex.Find(key))
+		{
+			if ((*s)->Matches(symbols))
+			{
+				// move to front of LRU list
+				UnlinkString(*s);
+				LinkString(*s);
+				m_stringHits++;
+				return *s;
+			}
+			if (!++key)
+				key = 1;
+		}
+
+		if (m_numStrings >= OVG_STRING_CACHE_SIZE)
+		{
+			cOvgString *last = m_last;
+			m_stringIndex.Remove(last->m_key);
+			m_stringBytes -= last->Size();
+			UnlinkString(last);
+			delete last;
+		}
+
+		cOvgString *string = new cOvgString(symbols, key,
+				m_height, m_descender);
+
+		uint prevSym = 0;
+		for (int i = 0; symbols[i]; i++)
+			if (cOvgGlyph *g = Glyph(symbols[i]))
+			{
+				float kerning = 0.0f;
+				if (prevSym)
+				{
+					kerning = Kerning(g, prevSym);
+					string->m_kerning.push_back(kerning);
+				}
+				string->m_width += g->AdvanceX() + kerning;
+				string->m_glyphIds.push_back(symbols[i]);
+				prevSym = symbols[i];
+			}
+
+		LinkString(string);
+		m_stringIndex.Insert(key, string);
+		m_stringBytes += string->Size();
+		m_stringMisses++;
+
+		return string;
+	}
+
+	float Height(void)    { return m_height;    }
+	float Descender(void) { return m_descender; }
+
+	// string cache statistics
+	int StringHits(void) const   { return m_stringHits;   }
+	int StringMisses(void) const { return m_stringMisses; }
+	int StringBytes(void) const  { return m_stringBytes;  }
+
+protected:
+
+	// creates the glyph of a converted outline
+	virtual cOvgGlyph *CreateGlyph(uint charCode, float advanceX,
+			float advanceY, const std::vector<unsigned char> &segments,
+			const std::vector<short> &coord) const
+	{
+		cOvgGlyph *glyph = new cOvgGlyph(charCode, advanceX, advanceY);
+		glyph->SetOutline(segments, coord);
+		return glyph;
+	}
+
+	// called for every outline converted from the face
+	virtual void StoreGlyph(uint charCode, float advanceX, float advanceY,
+			const std::vector<unsigned char> &segments,
+			const std::vector<short> &coord) const { }
+
+	bool HasGlyph(uint charCode) const
+	{
+		return m_glyphIndex.Find(charCode) != 0;
+	}
+
+	void AddGlyph(cOvgGlyph *glyph) const
+	{
+		m_glyphs.push_back(glyph);
+		m_glyphIndex.Insert(glyph->CharCode(), glyph);
+	}
+
+	float m_height;
+	float m_descender;
+	FT_Face m_face;
+
+private:
+
+	cOvgFontFace(const cOvgFontFace&);
+	cOvgFontFace& operator= (const cOvgFontFace&);
+
+	static uint StringHash(const uint *symbols)
+	{
+		uint hash = 2166136261u;
+		while (*symbols)
+			hash = (hash ^ *symbols++) * 16777619u;
+
+		return hash ? hash : 1;
+	}
+
+	void LinkString(cOvgString *string) const
+	{
+		string->m_prev = 0;
+		string->m_next = m_first;
+		if (m_first)
+			m_first->m_prev = string;
+		else
+			m_last = string;
+		m_first = string;
+		m_numStrings++;
+	}
+
+	void UnlinkString(cOvgString *string) const
+	{
+		if (string->m_prev)
+			string->m_prev->m_next = string->m_next;
+		else
+			m_first = string->m_next;
+		if (string->m_next)
+			string->m_next->m_prev = string->m_prev;
+		else
+			m_last = string->m_prev;
+		m_numStrings--;
+	}
+
+	cOvgGlyph *ConvertChar(uint charCode) const
+	{
+		if (!m_face)
+			return 0;
+
+		FT_UInt glyphIndex = FT_Get_Char_Index(m_face, charCode);
+		if (FT_Load_Glyph(m_face, glyphIndex, FT_LOAD_DEFAULT))
+			return 0;
+
+		std::vector<unsigned char> segments;
+		std::vector<short> coord;
+		ConvertOutline(&m_face->glyph->outline, segments, coord);
+
+		float advanceX = (float)(m_face->glyph->advance.x) / CHAR_HEIGHT;
+		float advanceY = (float)(m_face->glyph->advance.y) / CHAR_HEIGHT;
+
+		StoreGlyph(charCode, advanceX, advanceY, segments, coord);
+		return CreateGlyph(charCode, advanceX, advanceY, segments, coord);
+	}
+
+	// convert freetype outline to OpenVG path segments and coordinates,
+	// based on Raspberry Pi's vgfont library
+
+	static void ConvertOutline(FT_Outline *outline,
+			std::vector<unsigned char> &segments, std::vector<short> &coord)
+	{
+		if (outline->n_contours == 0)
+			return;
+
+		segments.reserve(256);
+		coord.reserve(1024);
+
+		FT_Vector *points = outline->points;
+		const char *tags = outline->tags;
+		const short* contour = outline->contours;
+		short nCont = outline->n_contours;
+
+		for (short point = 0; nCont != 0; contour++, nCont--)
+		{
+			short nextContour = *contour + 1;
+			bool firstTag = true;
+			char lastTag = 0;
+			short firstPoint = point;
+
+			for (; point < nextContour; point++)
+			{
+				char tag = tags[point];
+				FT_Vector fpoint = points[point];
+				if (firstTag)
+				{
+					segments.push_back(eOvgMoveTo);
+					firstTag = false;
+				}
+				else if (tag & 0x1)
+				{
+					if (lastTag & 0x1)
+						segments.push_back(eOvgLineTo);
+					else if (lastTag & 0x2)
+						segments.push_back(eOvgCubicTo);
+					else
+						segments.push_back(eOvgQuadTo);
+				}
+				else
+				{
+					if (!(tag & 0x2) && !(lastTag & 0x1))
+					{
+						segments.push_back(eOvgQuadTo);
+						int coord_size = coord.size();
+
+						short x = (coord[coord_size-2] + fpoint.x) >> 1;
+						short y = (coord[coord_size-1] + fpoint.y) >> 1;
+
+						coord.push_back(x);
+						coord.push_back(y);
+					}
+				}
+				lastTag = tag;
+				coord.push_back(fpoint.x);
+				coord.push_back(fpoint.y);
+			}
+			if (!(lastTag & 0x1))
+			{
+				if (lastTag & 0x2)
+					segments.push_back(eOvgCubicTo);
+				else
+					segments.push_back(eOvgQuadTo);
+
+				coord.push_back(points[firstPoint].x);
+				coord.push_back(points[firstPoint].y);
+			}
+			segments.push_back(eOvgClosePath);
+		}
+	}
+
+	mutable std::vector<cOvgGlyph *> m_glyphs;
+	mutable cOvgHash<cOvgGlyph *> m_glyphIndex;
+
+	mutable cOvgHash<cOvgString *> m_stringIndex;
+	mutable cOvgString *m_first;
+	mutable cOvgString *m_last;
+	mutable int m_numStrings;
+
+	mutable int m_stringHits;
+	mutable int m_stringMisses;
+	mutable int m_stringBytes;
+};
+
+#endif
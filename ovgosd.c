@@ -5,8 +5,12 @@
  */
 
 #include <vector>
-#include <queue>
 #include <algorithm>
+#include <new>
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -16,98 +20,135 @@
 #include <EGL/egl.h>
 #include <GLES/gl.h>
 
+#include <vdr/plugin.h>
+
 #include "ovgosd.h"
 #include "display.h"
+#include "kernels.h"
+#include "ovgfont.h"
+#include "ovgqueue.h"
+#include "rasterizer.h"
 #include "omxdevice.h"
 #include "setup.h"
 #include "tools.h"
 
-/* ------------------------------------------------------------------------- */
+#define OVG_WARMUP_STEP       8   // glyphs converted per idle cycle
+#define OVG_GLYPH_CACHE_MAGIC 0x4f564701
+#define OVG_GLYPH_MAX_SEGMENTS 4096 // larger outlines are not cached
 
-// glyphs containing kerning cache, based on VDR's implementation
+// font of the OSD, loaded and converted by the OpenVG thread, which creates an
+// OpenVG font unless software rendering is selected
 
-class cOvgGlyph : public cListObject
+class cOvgFont : public cOvgFontFace, public cListObject
 {
 public:
 
-	cOvgGlyph(uint charCode, VGfloat advanceX, VGfloat advanceY) :
-		m_charCode(charCode), m_advanceX(advanceX), m_advanceY(advanceY) { }
-
-	virtual ~cOvgGlyph() { }
+	// returns a unique id for the given font name, may be called from any
+	// thread and is meant to be used by the OSD before queuing commands
 
-	uint    CharCode(void) { return m_charCode; }
-	VGfloat AdvanceX(void) { return m_advanceX; }
-	VGfloat AdvanceY(void) { return m_advanceY; }
-
-	bool GetKerningCache(uint prevSym, VGfloat &kerning)
+	static int Intern(const char *name)
 	{
-		for (int i = m_kerningCache.Size(); --i > 0; )
-			if (m_kerningCache[i].m_prevSym == prevSym)
-			{
-				kerning = m_kerningCache[i].m_kerning;
-				return true;
-			}
+		cMutexLock lock(&s_mutex);
 
-		return false;
-	}
+		// resolve hash collisions by probing subsequent keys
+		uint key = NameHash(name);
+		while (int *id = s_nameIds.Find(key))
+		{
+			if (!strcmp(s_names[*id], name))
+				return *id;
 
-	void SetKerningCache(uint prevSym, VGfloat kerning)
-	{
-		m_kerningCache.Append(tKerning(prevSym, kerning));
+			if (!++key)
+				key = 1;
+		}
+		s_names.Append(strdup(name));
+		s_nameIds.Insert(key, s_names.Size() - 1);
+		return s_names.Size() - 1;
 	}
 
-private:
+	// request glyphs of the common character set of a font to be converted
+	// in advance, may be called from any thread
 
-	struct tKerning
+	static void Preload(const char *name)
 	{
-	public:
+		int nameId = Intern(name);
 
-		tKerning(uint prevSym, VGfloat kerning = 0.0f)
-		{
-			m_prevSym = prevSym;
-			m_kerning = kerning;
-		}
-
-		uint m_prevSym;
-		VGfloat m_kerning;
-	};
+		cMutexLock lock(&s_mutex);
+		if (s_preload.IndexOf(nameId) < 0)
+			s_preload.Append(nameId);
+	}
 
-	uint m_charCode;
+	// convert some glyphs of the fonts to be preloaded, called by the OVG
+	// thread when idle, returns false if there's nothing left to do
 
-	VGfloat m_advanceX;
-	VGfloat m_advanceY;
+	static bool WarmUp(void)
+	{
+		int nameId;
+		{
+			cMutexLock lock(&s_mutex);
+			if (!s_preload.Size())
+				return false;
 
-	cVector<tKerning> m_kerningCache;
-};
+			nameId = s_preload[0];
+		}
 
-/* ------------------------------------------------------------------------- */
+		cOvgFont *font = Get(nameId);
+		for (int i = 0; i < OVG_WARMUP_STEP && font; i++)
+		{
+			uint charCode = WarmUpChar(s_warmUpPos);
+			if (!charCode)
+			{
+				DLOG("[OpenVG] %s warmed up", font->Name());
+				cMutexLock lock(&s_mutex);
+				s_preload.Remove(0);
+				s_warmUpPos = 0;
+				break;
+			}
+			font->Glyph(charCode);
+			s_warmUpPos++;
+		}
+		return true;
+	}
 
-#define CHAR_HEIGHT (1 << 14)
+	// set directory where converted glyph outlines are stored
+	static void SetCacheDirectory(const char *dir)
+	{
+		s_cacheDir = dir;
+	}
 
-class cOvgFont : public cListObject
-{
-public:
+	// fonts of the software backend keep the glyph outlines instead of
+	// creating OpenVG fonts, must be set before any font is loaded
+	static void SetSoftware(bool software)
+	{
+		s_software = software;
+	}
 
-	static cOvgFont *Get(const char *name)
+	static cOvgFont *Get(int nameId)
 	{
 		if (!s_fonts)
 			Init();
 
-		cOvgFont *font;
-		for (font = s_fonts->First(); font; font = s_fonts->Next(font))
-			if (!strcmp(font->Name(), name))
-				return font;
+		if (cOvgFont **f = s_fontIndex->Find(nameId + 1))
+			return *f;
+
+		cString name;
+		{
+			cMutexLock lock(&s_mutex);
+			if (nameId < 0 || nameId >= s_names.Size())
+				return 0;
+			name = s_names[nameId];
+		}
 
-		font = 0;
+		cOvgFont *font = 0;
 		bool retry = true;
 		while (!font)
 		{
 			font = new cOvgFont(s_ftLib, name);
-			if (vgGetError() == VG_OUT_OF_MEMORY_ERROR)
+			if (!s_software && vgGetError() == VG_OUT_OF_MEMORY_ERROR)
 			{
 				delete font;
 				font = 0;
 				s_fonts->Clear();
+				s_fontIndex->Clear();
 				if (!retry)
 				{
 					ELOG("[OpenVG] out of memory - failed to load font!");
@@ -118,53 +159,51 @@ public:
 			}
 		}
 		s_fonts->Add(font);
+		s_fontIndex->Insert(nameId + 1, font);
 		return font;
 	}
 
 	static void CleanUp(void)
 	{
+		LogStringCache();
+
 		delete s_fonts;
 		s_fonts = 0;
 
+		delete s_fontIndex;
+		s_fontIndex = 0;
+
 		if (FT_Done_FreeType(s_ftLib))
 			ELOG("failed to deinitialize FreeType library!");
 	}
 
-	cOvgGlyph* Glyph(uint charCode) const
+	// returns the shaped string, see cOvgFontFace::String()
+	cOvgString *String(const uint *symbols) const
 	{
-		cOvgGlyph *glyph = 0;
-		for (glyph = m_glyphs.First(); glyph; glyph = m_glyphs.Next(glyph))
-			if (glyph->CharCode() == charCode)
-				return glyph;
-
-		glyph = ConvertChar(charCode);
-		if (glyph)
-			m_glyphs.Add(glyph);
+		int misses = StringMisses();
+		cOvgString *string = cOvgFontFace::String(symbols);
+		if (StringMisses() != misses && !(StringMisses() & 0xff))
+			LogStringCache();
 
-		return glyph;
+		return string;
 	}
 
-	VGfloat Kerning(cOvgGlyph *glyph, uint prevSym) const
+	static void LogStringCache(void)
 	{
-		VGfloat kerning = 0.0f;
-		if (glyph && prevSym)
-		{
-			if (!glyph->GetKerningCache(prevSym, kerning))
+		int hits = 0, lookups = 0, bytes = 0;
+		if (s_fonts)
+			for (cOvgFont *font = s_fonts->First(); font;
+					font = s_fonts->Next(font))
 			{
-				FT_Vector delta;
-				FT_UInt cur = FT_Get_Char_Index(m_face,	glyph->CharCode());
-				FT_UInt prev = FT_Get_Char_Index(m_face, prevSym);
-				FT_Get_Kerning(m_face, prev, cur, FT_KERNING_DEFAULT, &delta);
-
-				kerning = (VGfloat)delta.x / CHAR_HEIGHT;
-				glyph->SetKerningCache(prevSym, kerning);
+				hits += font->StringHits();
+				lookups += font->StringHits() + font->StringMisses();
+				bytes += font->StringBytes();
 			}
-		}
-		return kerning;
+
+		DBG("[OpenVG] string cache: %d lookups, %d%% hits, %d kB",
+				lookups, lookups ? hits * 100 / lookups : 0, bytes / 1024);
 	}
 
-	VGfloat     Height(void)    { return  m_height;    }
-	VGfloat     Descender(void) { return  m_descender; }
 	VGFont      Font(void)      { return  m_font;      }
 	const char* Name(void)      { return *m_name;      }
 
@@ -173,241 +212,279 @@ private:
 	cOvgFont(void) :
 		m_font(VG_INVALID_HANDLE),
 		m_name(""),
-		m_height(0.0f),
-		m_descender(0.0f),
-		m_face(0)
+		m_cache(0)
 	{ }
 
 	cOvgFont(FT_Library lib, const char *name) :
-		m_name(name)
+		cOvgFontFace(lib, name),
+		m_font(VG_INVALID_HANDLE),
+		m_name(name),
+		m_cache(0)
 	{
 		ILOG("loading %s ...", *m_name);
 
-		if (FT_New_Face(lib, name, 0, &m_face))
-			ELOG("failed to open %s!", name);
-
-		m_font = vgCreateFont(m_face->num_glyphs);
-		if (m_font == VG_INVALID_HANDLE)
+		if (!s_software && m_face)
 		{
-			ELOG("failed to allocate new OVG font!");
-			return;
+			m_font = vgCreateFont(m_face->num_glyphs);
+			if (m_font == VG_INVALID_HANDLE)
+			{
+				ELOG("failed to allocate new OVG font!");
+				return;
+			}
 		}
 
-		FT_Set_Char_Size(m_face, 0, CHAR_HEIGHT, 0, 0);
-		m_height = (VGfloat)(m_face->size->metrics.height) / CHAR_HEIGHT;
-		m_descender = (VGfloat)(abs(m_face->size->metrics.descender)) /
-				CHAR_HEIGHT;
-#if 0
-		FT_UInt glyphIndex;
-		FT_ULong ch = FT_Get_First_Char(m_face, &glyphIndex);
-
-		while (ch != 0)
-		{
-			if (FT_Load_Glyph(m_face, glyphIndex, FT_LOAD_DEFAULT))
-				break;
-
-			FT_Outline *ot = &m_face->glyph->outline;
-			VGPath path = ConvertOutline(ot);
-
-			VGfloat origin[] = { 0.0f, 0.0f };
-			VGfloat esc[] = {
-					(VGfloat)(m_face->glyph->advance.x) / CHAR_HEIGHT,
-					(VGfloat)(m_face->glyph->advance.y) / CHAR_HEIGHT
-			};
-
-			vgSetGlyphToPath(m_font, ch, path, VG_FALSE, origin, esc);
-
-			m_glyphs.Add(new cOvgGlyph(ch, esc[0], esc[1]));
-
-			if (path != VG_INVALID_HANDLE)
-				vgDestroyPath(path);
-
-			ch = FT_Get_Next_Char(m_face, ch, &glyphIndex);
-		}
-#endif
+		OpenCache();
 	}
 
 	~cOvgFont()
 	{
-		vgDestroyFont(m_font);
-		FT_Done_Face(m_face);
+		if (m_cache)
+			fclose(m_cache);
+
+		if (m_font != VG_INVALID_HANDLE)
+			vgDestroyFont(m_font);
 	}
 
 	static void Init(void)
 	{
 		s_fonts = new cList<cOvgFont>;
+		s_fontIndex = new cOvgHash<cOvgFont *>(16);
 		if (FT_Init_FreeType(&s_ftLib))
 			ELOG("failed to initialize FreeType library!");
 	}
 
-	cOvgGlyph *ConvertChar(uint charCode) const
+	// FNV-1a, never returns the reserved key 0
+	static uint NameHash(const char *name)
 	{
-		FT_UInt glyphIndex = FT_Get_Char_Index(m_face, charCode);
-		if (FT_Load_Glyph(m_face, glyphIndex, FT_LOAD_DEFAULT))
-			return 0;
+		uint hash = 2166136261u;
+		while (*name)
+			hash = (hash ^ (unsigned char)*name++) * 16777619u;
 
-		FT_Outline *ot = &m_face->glyph->outline;
-		VGPath path = ConvertOutline(ot);
+		return hash ? hash : 1;
+	}
 
-		VGfloat origin[] = { 0.0f, 0.0f };
-		VGfloat esc[] = {
-				(VGfloat)(m_face->glyph->advance.x) / CHAR_HEIGHT,
-				(VGfloat)(m_face->glyph->advance.y) / CHAR_HEIGHT
+	// identifies a font file by its name, size and modification time, which
+	// avoids reading the whole file when loading the font
+	static uint FileHash(const char *fileName)
+	{
+		uint hash = NameHash(fileName);
+		struct stat st;
+		if (stat(fileName, &st) == 0)
+		{
+			uint64_t values[2] = { (uint64_t)st.st_size,
+					(uint64_t)st.st_mtime };
+
+			const unsigned char *p = (const unsigned char *)values;
+			for (unsigned int i = 0; i < sizeof(values); i++)
+				hash = (hash ^ p[i]) * 16777619u;
+		}
+		return hash;
+	}
+
+	// Latin-1 and common punctuation, returns 0 past the end
+	static uint WarmUpChar(int index)
+	{
+		static const uint ranges[][2] = {
+			{ 0x0020, 0x007e }, { 0x00a0, 0x00ff }, { 0x2013, 0x2014 },
+			{ 0x2018, 0x201e }, { 0x2026, 0x2026 }, { 0x20ac, 0x20ac }
 		};
 
-		vgSetGlyphToPath(m_font, charCode, path, VG_FALSE, origin, esc);
-		if (path != VG_INVALID_HANDLE)
-			vgDestroyPath(path);
+		for (unsigned int i = 0; i < sizeof(ranges) / sizeof(ranges[0]); i++)
+		{
+			int n = ranges[i][1] - ranges[i][0] + 1;
+			if (index < n)
+				return ranges[i][0] + index;
 
-		return new cOvgGlyph(charCode, esc[0], esc[1]);
+			index -= n;
+		}
+		return 0;
 	}
 
-	// convert freetype outline to OpenVG path,
-	// based on Raspberry Pi's vgfont library
+	// the glyph cache file contains a header followed by a record per
+	// glyph with its advance and the converted outline data
 
-	VGPath ConvertOutline(FT_Outline *outline) const
+	struct tCacheHeader
 	{
-		if (outline->n_contours == 0)
-			return VG_INVALID_HANDLE;
+		uint magic;
+		uint charHeight;
+	};
 
-		std::vector<VGubyte> segments;
-		std::vector<VGshort> coord;
-		segments.reserve(256);
-		coord.reserve(1024);
+	struct tCacheRecord
+	{
+		uint charCode;
+		VGfloat advanceX;
+		VGfloat advanceY;
+		uint numSegments;
+		uint numCoords;
+	};
 
-		FT_Vector *points = outline->points;
-		const char *tags = outline->tags;
-		const short* contour = outline->contours;
-		short nCont = outline->n_contours;
+	// load glyphs converted earlier and open cache file for appending
+	void OpenCache(void)
+	{
+		if (!*s_cacheDir)
+			return;
 
-		for (short point = 0; nCont != 0; contour++, nCont--)
-		{
-			short nextContour = *contour + 1;
-			bool firstTag = true;
-			char lastTag = 0;
-			short firstPoint = point;
+		cString fileName = cString::sprintf("%s/glyphs-%08x.cache",
+				*s_cacheDir, FileHash(m_name));
 
-			for (; point < nextContour; point++)
+		bool valid = false;
+		int numGlyphs = 0;
+		long size = 0;
+
+		if (FILE *f = fopen(fileName, "r"))
+		{
+			tCacheHeader header;
+			if (fread(&header, sizeof(header), 1, f) == 1 &&
+					header.magic == OVG_GLYPH_CACHE_MAGIC &&
+					header.charHeight == CHAR_HEIGHT)
 			{
-				char tag = tags[point];
-				FT_Vector fpoint = points[point];
-				if (firstTag)
+				valid = true;
+				size = ftell(f);
+
+				std::vector<unsigned char> segments;
+				std::vector<short> coord;
+				tCacheRecord rec;
+
+				// a record of bogus size is treated like an incomplete one,
+				// a cubic segment takes six coordinates at most
+				while (fread(&rec, sizeof(rec), 1, f) == 1 &&
+						rec.numSegments <= OVG_GLYPH_MAX_SEGMENTS &&
+						rec.numCoords <= 6 * rec.numSegments)
 				{
-					segments.push_back(VG_MOVE_TO);
-					firstTag = false;
-				}
-				else if (tag & 0x1)
-				{
-					if (lastTag & 0x1)
-						segments.push_back(VG_LINE_TO);
-					else if (lastTag & 0x2)
-						segments.push_back(VG_CUBIC_TO);
-					else
-						segments.push_back(VG_QUAD_TO);
-				}
-				else
-				{
-					if (!(tag & 0x2) && !(lastTag & 0x1))
+					segments.resize(rec.numSegments);
+					coord.resize(rec.numCoords);
+
+					if ((rec.numSegments && fread(&segments[0],
+							sizeof(unsigned char), rec.numSegments, f) !=
+									rec.numSegments) ||
+						(rec.numCoords && fread(&coord[0],
+							sizeof(short), rec.numCoords, f) !=
+									rec.numCoords))
+						break;
+
+					if (!HasGlyph(rec.charCode))
 					{
-						segments.push_back(VG_QUAD_TO);
-						int coord_size = coord.size();
-
-						VGshort x = (coord[coord_size-2] + fpoint.x) >> 1;
-						VGshort y = (coord[coord_size-1] + fpoint.y) >> 1;
-
-						coord.push_back(x);
-						coord.push_back(y);
+						AddGlyph(CreateGlyph(rec.charCode,
+								rec.advanceX, rec.advanceY, segments, coord));
+						numGlyphs++;
 					}
+					size = ftell(f);
 				}
-				lastTag = tag;
-				coord.push_back(fpoint.x);
-				coord.push_back(fpoint.y);
 			}
-			if (!(lastTag & 0x1))
-			{
-				if (lastTag & 0x2)
-					segments.push_back(VG_CUBIC_TO);
-				else
-					segments.push_back(VG_QUAD_TO);
+			fclose(f);
+		}
 
-				coord.push_back(points[firstPoint].x);
-				coord.push_back(points[firstPoint].y);
+		if (valid)
+		{
+			// drop incomplete record of an interrupted write
+			if (truncate(fileName, size) < 0)
+				valid = false;
+			else
+				m_cache = fopen(fileName, "a");
+
+			DLOG("[OpenVG] loaded %d glyphs from %s", numGlyphs, *fileName);
+		}
+
+		if (!valid)
+		{
+			m_cache = fopen(fileName, "w");
+			tCacheHeader header = { OVG_GLYPH_CACHE_MAGIC, CHAR_HEIGHT };
+			if (m_cache && fwrite(&header, sizeof(header), 1, m_cache) != 1)
+			{
+				fclose(m_cache);
+				m_cache = 0;
 			}
-			segments.push_back(VG_CLOSE_PATH);
 		}
 
-		VGPath path = vgCreatePath(VG_PATH_FORMAT_STANDARD,
-				VG_PATH_DATATYPE_S_16, 1.0f / (VGfloat)CHAR_HEIGHT, 0.0f,
-				segments.size(), coord.size(), VG_PATH_CAPABILITY_APPEND_TO);
+		if (!m_cache)
+			ELOG("[OpenVG] failed to open glyph cache %s!", *fileName);
+	}
 
-		if (path != VG_INVALID_HANDLE)
-			vgAppendPathData(path, segments.size(), &segments[0], &coord[0]);
+	// append converted outline to the glyph cache file
+	virtual void StoreGlyph(uint charCode, float advanceX, float advanceY,
+			const std::vector<unsigned char> &segments,
+			const std::vector<short> &coord) const
+	{
+		if (!m_cache || segments.size() > OVG_GLYPH_MAX_SEGMENTS)
+			return;
+
+		tCacheRecord rec = { charCode, advanceX, advanceY,
+				(uint)segments.size(), (uint)coord.size() };
 
-		return path;
+		if (fwrite(&rec, sizeof(rec), 1, m_cache) != 1 ||
+				(segments.size() && fwrite(&segments[0], sizeof(unsigned char),
+						segments.size(), m_cache) != segments.size()) ||
+				(coord.size() && fwrite(&coord[0], sizeof(short),
+						coord.size(), m_cache) != coord.size()))
+		{
+			ELOG("[OpenVG] failed to write glyph cache!");
+			fclose(m_cache);
+			m_cache = 0;
+		}
 	}
 
-	VGFont m_font;
-	cString m_name;
-	VGfloat m_height;
-	VGfloat m_descender;
+	// glyphs of OpenVG fonts are drawn by the GPU, the outline is not kept
+	virtual cOvgGlyph *CreateGlyph(uint charCode, float advanceX,
+			float advanceY, const std::vector<unsigned char> &segments,
+			const std::vector<short> &coord) const
+	{
+		if (s_software)
+			return cOvgFontFace::CreateGlyph(charCode, advanceX, advanceY,
+					segments, coord);
 
-	mutable cList<cOvgGlyph> m_glyphs;
+		VGPath path = VG_INVALID_HANDLE;
+		if (segments.size())
+		{
+			path = vgCreatePath(VG_PATH_FORMAT_STANDARD,
+					VG_PATH_DATATYPE_S_16, 1.0f / (VGfloat)CHAR_HEIGHT, 0.0f,
+					segments.size(), coord.size(),
+					VG_PATH_CAPABILITY_APPEND_TO);
 
-	FT_Face m_face;
+			if (path != VG_INVALID_HANDLE)
+				vgAppendPathData(path, segments.size(), &segments[0],
+						&coord[0]);
+		}
 
-	static FT_Library s_ftLib;
-	static cList<cOvgFont> *s_fonts;
-};
+		VGfloat origin[] = { 0.0f, 0.0f };
+		VGfloat esc[] = { advanceX, advanceY };
 
-FT_Library cOvgFont::s_ftLib = 0;
-cList<cOvgFont> *cOvgFont::s_fonts = 0;
+		vgSetGlyphToPath(m_font, charCode, path, VG_FALSE, origin, esc);
+		if (path != VG_INVALID_HANDLE)
+			vgDestroyPath(path);
 
-/* ------------------------------------------------------------------------- */
+		return new cOvgGlyph(charCode, advanceX, advanceY);
+	}
 
-class cOvgString
-{
-public:
+	VGFont m_font;
+	cString m_name;
+	mutable FILE *m_cache;
 
-	cOvgString(const unsigned int *symbols, cOvgFont *font) :
-		m_width(0.0f), m_height(font->Height()), m_descender(font->Descender()),
-		m_font(font)
-	{
-		uint prevSym = 0;
-		for (int i = 0; symbols[i]; i++)
-			if (cOvgGlyph *g = font->Glyph(symbols[i]))
-			{
-				VGfloat kerning = 0.0f;
-				if (prevSym)
-				{
-					kerning = m_font->Kerning(g, prevSym);
-					m_kerning.push_back(kerning);
-				}
-				m_width += g->AdvanceX() + kerning;
-				m_glyphIds.push_back(symbols[i]);
-				prevSym = symbols[i];
-			}
-	}
+	static FT_Library s_ftLib;
+	static cList<cOvgFont> *s_fonts;
+	static cOvgHash<cOvgFont *> *s_fontIndex;
 
-	~cOvgString() { }
+	static cMutex s_mutex; // protects name table and preload list
+	static cStringList s_names;
+	static cOvgHash<int> s_nameIds;
 
-	      VGFont   Font(void)         { return  m_font->Font();    }
-	      VGint    Length(void)       { return  m_glyphIds.size(); }
-	      VGfloat  Width(void)        { return  m_width;           }
-	      VGfloat  Height(void)       { return  m_height;          }
-	      VGfloat  Descender(void)    { return  m_descender;       }
-	const VGuint  *GlyphIds(void)     { return &m_glyphIds[0];     }
-	const VGfloat *Kerning(void)      { return &m_kerning[0];      }
+	static cVector<int> s_preload;
+	static int s_warmUpPos;
+	static cString s_cacheDir;
+	static bool s_software;
+};
 
-private:
+FT_Library cOvgFont::s_ftLib = 0;
+cList<cOvgFont> *cOvgFont::s_fonts = 0;
+cOvgHash<cOvgFont *> *cOvgFont::s_fontIndex = 0;
 
-	std::vector<VGuint> m_glyphIds;
-	std::vector<VGfloat> m_kerning;
+cMutex cOvgFont::s_mutex;
+cStringList cOvgFont::s_names;
+cOvgHash<int> cOvgFont::s_nameIds(16);
 
-	VGfloat m_width;
-	VGfloat m_height;
-	VGfloat m_descender;
-	cOvgFont *m_font;
-};
+cVector<int> cOvgFont::s_preload;
+int cOvgFont::s_warmUpPos = 0;
+cString cOvgFont::s_cacheDir;
+bool cOvgFont::s_software = false;
 
 /* ------------------------------------------------------------------------- */
 
@@ -420,9 +497,9 @@ public:
 		vgDrawPath(path, VG_FILL_PATH);
 	}
 
-	static void Draw(cOvgString *string)
+	static void Draw(VGFont font, cOvgString *string)
 	{
-		vgDrawGlyphs(string->Font(), string->Length(), string->GlyphIds(),
+		vgDrawGlyphs(font, string->Length(), string->GlyphIds(),
 				string->Kerning(), NULL, VG_FILL_PATH, VG_TRUE);
 	}
 
@@ -651,20 +728,780 @@ public:
 
 /* ------------------------------------------------------------------------- */
 
+// state of the software backend, see cOvgThread. the window is a surface in
+// system memory, which is written to a PAM file at each flush if a directory
+// is given, so the OSD can be compared pixel by pixel
+
+#define OVG_SOFT_MAX_IMAGE_SIZE 4096
+#define OVG_SOFT_LOG_FRAMES     256 // flushes between statistics
+
+class cOvgSoft
+{
+public:
+
+	cOvgSoft(const char *dumpDir) :
+		window(0),
+		m_dumpDir(dumpDir),
+		m_frames(0),
+		m_busyUs(0)
+	{ }
+
+	cRasterSurface *window;
+	cRasterPath path;
+
+	static uint64_t NowUs(void)
+	{
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	}
+
+	void AddBusyTime(uint64_t us)
+	{
+		m_busyUs += us;
+	}
+
+	void Flush(void)
+	{
+		if (*m_dumpDir)
+			Dump(cString::sprintf("%s/osd-%06d.pam", *m_dumpDir, m_frames));
+
+		if (!(++m_frames % OVG_SOFT_LOG_FRAMES))
+		{
+			DLOG("[OpenVG] software OSD: %d frames, %d us per frame",
+					m_frames, (int)(m_busyUs / OVG_SOFT_LOG_FRAMES));
+			m_busyUs = 0;
+		}
+	}
+
+private:
+
+	void Dump(const char *fileName)
+	{
+		FILE *f = fopen(fileName, "w");
+		if (!f)
+		{
+			ELOG("[OpenVG] failed to open %s!", fileName);
+			return;
+		}
+
+		fprintf(f, "P7\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\n"
+				"TUPLTYPE RGB_ALPHA\nENDHDR\n",
+				window->Width(), window->Height());
+
+		std::vector<uint8_t> row(window->Width() * 4);
+		for (int y = 0; y < window->Height(); y++)
+		{
+			const uint32_t *p = window->Data() + y * window->Width();
+			for (int x = 0; x < window->Width(); x++)
+			{
+				row[4 * x + 0] = p[x] >> 16;
+				row[4 * x + 1] = p[x] >> 8;
+				row[4 * x + 2] = p[x];
+				row[4 * x + 3] = p[x] >> 24;
+			}
+			if (row.size() && fwrite(&row[0], row.size(), 1, f) != 1)
+			{
+				ELOG("[OpenVG] failed to write %s!", fileName);
+				break;
+			}
+		}
+		fclose(f);
+	}
+
+	cString m_dumpDir;
+	int m_frames;
+	uint64_t m_busyUs;
+};
+
+/* ------------------------------------------------------------------------- */
+
+// images are uploaded asynchronously. an image is either resident in GPU
+// memory or, if it has been evicted or couldn't be allocated, its pixel data
+// is kept until it's drawn again
+
 struct tOvgImageRef
 {
 	VGImage image;
-	bool used;
+	tColor *argb;
+	int width;
+	int height;
+	int index;
+	tOvgImageRef *nextFree;
+	tOvgImageRef *lruPrev;
+	tOvgImageRef *lruNext;
+	class cOvgAtlasPage *page;
+	cRect cell;
+};
+
+/* ------------------------------------------------------------------------- */
+
+// small images are packed into shared atlas pages and drawn as child images
+// of them. pages are divided into shelves of equal height, rounded up to
+// OVG_ATLAS_SHELF_STEP rows. freed cells are merged with their free
+// neighbours and given back to the shelf or split again by images fitting
+// into them. a page is destroyed once its last image is released. pages are
+// accounted to the image cache budget by their full size
+
+#define OVG_ATLAS_PAGE_SIZE  512
+#define OVG_ATLAS_PAGE_BYTES (OVG_ATLAS_PAGE_SIZE * OVG_ATLAS_PAGE_SIZE * 4)
+#define OVG_ATLAS_MAX_PAGES  16
+#define OVG_ATLAS_MAX_IMAGE  96 // max. width and height of images to pack
+#define OVG_ATLAS_SHELF_STEP 8
+
+class cOvgAtlasPage
+{
+public:
+
+	cOvgAtlasPage(VGImage image) :
+		m_image(image),
+		m_shelfTop(0),
+		m_numImages(0)
+	{ }
+
+	~cOvgAtlasPage()
+	{
+		vgDestroyImage(m_image);
+	}
+
+	VGImage Allocate(int w, int h, cRect &cell)
+	{
+		int height = (h + OVG_ATLAS_SHELF_STEP - 1) /
+				OVG_ATLAS_SHELF_STEP * OVG_ATLAS_SHELF_STEP;
+
+		for (int i = 0; i < m_freeCells.Size(); i++)
+			if (m_freeCells[i].Height() == height &&
+					m_freeCells[i].Width() >= w)
+			{
+				cRect free = m_freeCells[i];
+				m_freeCells.Remove(i);
+				if (free.Width() > w)
+					m_freeCells.Append(cRect(free.X() + w, free.Y(),
+							free.Width() - w, height));
+
+				cell.Set(free.X(), free.Y(), w, height);
+				return Child(cell, w, h);
+			}
+
+		for (int i = 0; i < m_shelves.Size(); i++)
+			if (m_shelves[i].Height() == height &&
+					OVG_ATLAS_PAGE_SIZE - m_shelves[i].Width() >= w)
+			{
+				cell.Set(m_shelves[i].Width(), m_shelves[i].Y(), w, height);
+				m_shelves[i].SetWidth(m_shelves[i].Width() + w);
+				return Child(cell, w, h);
+			}
+
+		if (OVG_ATLAS_PAGE_SIZE - m_shelfTop < height)
+			return VG_INVALID_HANDLE;
+
+		// shelves are stored with their used width
+		m_shelves.Append(cRect(0, m_shelfTop, w, height));
+		cell.Set(0, m_shelfTop, w, height);
+		m_shelfTop += height;
+		return Child(cell, w, h);
+	}
+
+	// returns true if the page is empty
+	bool Release(VGImage child, const cRect &cell)
+	{
+		vgDestroyImage(child);
+		if (--m_numImages)
+		{
+			Free(cell);
+			return false;
+		}
+
+		m_freeCells.Clear();
+		m_shelves.Clear();
+		m_shelfTop = 0;
+		return true;
+	}
+
+	int NumImages(void) { return m_numImages; }
+
+private:
+
+	VGImage Child(const cRect &cell, int w, int h)
+	{
+		VGImage child = vgChildImage(m_image, cell.X(), cell.Y(), w, h);
+		if (child == VG_INVALID_HANDLE)
+			Free(cell);
+		else
+			m_numImages++;
+
+		return child;
+	}
+
+	// merge cell with its free neighbours on the shelf, give it back to the
+	// shelf if it's at its end and drop empty shelves at the top
+	void Free(cRect cell)
+	{
+		for (int i = 0; i < m_freeCells.Size(); )
+			if (m_freeCells[i].Y() == cell.Y() &&
+					(m_freeCells[i].Right() + 1 == cell.Left() ||
+					cell.Right() + 1 == m_freeCells[i].Left()))
+			{
+				cell.Combine(m_freeCells[i]);
+				m_freeCells.Remove(i);
+				i = 0;
+			}
+			else
+				i++;
+
+		for (int i = 0; i < m_shelves.Size(); i++)
+			if (m_shelves[i].Y() == cell.Y())
+			{
+				if (cell.Right() + 1 == m_shelves[i].Width())
+					m_shelves[i].SetWidth(cell.Left());
+				else
+					m_freeCells.Append(cell);
+				break;
+			}
+
+		while (m_shelves.Size() && !m_shelves[m_shelves.Size() - 1].Width())
+		{
+			m_shelfTop -= m_shelves[m_shelves.Size() - 1].Height();
+			m_shelves.Remove(m_shelves.Size() - 1);
+		}
+	}
+
+	VGImage m_image;
+	cVector<cRect> m_shelves;
+	cVector<cRect> m_freeCells;
+	int m_shelfTop;
+	int m_numImages;
+};
+
+class cOvgAtlas
+{
+public:
+
+	// place image into an atlas page, returns false if it's too large or
+	// no page has room for it. a new page is only created if allowed
+	static bool Allocate(tOvgImageRef *image, bool newPage)
+	{
+		if (image->width > OVG_ATLAS_MAX_IMAGE ||
+				image->height > OVG_ATLAS_MAX_IMAGE)
+			return false;
+
+		for (int i = 0; i < OVG_ATLAS_MAX_PAGES; i++)
+		{
+			if (!s_pages[i])
+			{
+				if (!newPage)
+					continue;
+
+				VGImage page = vgCreateImage(VG_sARGB_8888, OVG_ATLAS_PAGE_SIZE,
+						OVG_ATLAS_PAGE_SIZE, VG_IMAGE_QUALITY_BETTER);
+				if (page == VG_INVALID_HANDLE)
+				{
+					vgGetError();
+					return false;
+				}
+				s_pages[i] = new cOvgAtlasPage(page);
+				s_numPages++;
+				newPage = false;
+				DBG("[OpenVG] created atlas page %d", i);
+			}
+
+			image->image = s_pages[i]->Allocate(
+					image->width, image->height, image->cell);
+
+			if (image->image != VG_INVALID_HANDLE)
+			{
+				image->page = s_pages[i];
+				return true;
+			}
+			vgGetError();
+		}
+		return false;
+	}
+
+	static void Release(tOvgImageRef *image)
+	{
+		for (int i = 0; i < OVG_ATLAS_MAX_PAGES; i++)
+			if (s_pages[i] == image->page)
+			{
+				if (s_pages[i]->Release(image->image, image->cell))
+				{
+					delete s_pages[i];
+					s_pages[i] = 0;
+					s_numPages--;
+					DBG("[OpenVG] destroyed atlas page %d", i);
+				}
+				break;
+			}
+
+		image->page = 0;
+	}
+
+	// GPU memory used by all pages
+	static int Bytes(void) { return s_numPages * OVG_ATLAS_PAGE_BYTES; }
+
+	static void CleanUp(void)
+	{
+		for (int i = 0; i < OVG_ATLAS_MAX_PAGES; i++)
+		{
+			if (s_pages[i])
+				DLOG("[OpenVG] atlas page %d: %d images",
+						i, s_pages[i]->NumImages());
+
+			delete s_pages[i];
+			s_pages[i] = 0;
+		}
+		s_numPages = 0;
+	}
+
+private:
+
+	static cOvgAtlasPage *s_pages[OVG_ATLAS_MAX_PAGES];
+	static int s_numPages;
+};
+
+cOvgAtlasPage *cOvgAtlas::s_pages[OVG_ATLAS_MAX_PAGES] = { 0 };
+int cOvgAtlas::s_numPages = 0;
+
+/* ------------------------------------------------------------------------- */
+
+// LRU list of images resident in GPU memory, which is limited by the OSD
+// image cache budget. only to be used by the OpenVG thread
+
+class cOvgImageCache
+{
+public:
+
+	// upload pixel data to a new VG image, returns false if it doesn't fit
+	static bool Upload(tOvgImageRef *image, const tColor *argb)
+	{
+		int size = image->width * image->height * sizeof(tColor);
+		int budget = cRpiSetup::GetOsdImageCacheSize() * 1024 * 1024;
+		if (size > budget)
+			return false;
+
+		while (Bytes() + size > budget && Evict()) ;
+
+		if (!cOvgAtlas::Allocate(image,
+				Bytes() + OVG_ATLAS_PAGE_BYTES <= budget))
+			image->image = vgCreateImage(VG_sARGB_8888,
+					image->width, image->height, VG_IMAGE_QUALITY_BETTER);
+
+		// out of GPU memory before budget is reached, make some room
+		while (image->image == VG_INVALID_HANDLE && Evict())
+		{
+			vgGetError();
+			image->image = vgCreateImage(VG_sARGB_8888,
+					image->width, image->height, VG_IMAGE_QUALITY_BETTER);
+		}
+
+		if (image->image == VG_INVALID_HANDLE)
+			return false;
+
+		vgImageSubData(image->image, argb, image->width * sizeof(tColor),
+				VG_sARGB_8888, 0, 0, image->width, image->height);
+
+		Link(image);
+		if (!image->page)
+			s_bytes += size;
+		return true;
+	}
+
+	// mark a resident image as recently used
+	static void Touch(tOvgImageRef *image)
+	{
+		Unlink(image);
+		Link(image);
+		s_hits++;
+	}
+
+	// upload an evicted image again
+	static bool Reload(tOvgImageRef *image)
+	{
+		if (!Upload(image, image->argb))
+			return false;
+
+		free(image->argb);
+		image->argb = 0;
+		s_reloads++;
+		return true;
+	}
+
+	static void Remove(tOvgImageRef *image)
+	{
+		if (image->image == VG_INVALID_HANDLE)
+			return;
+
+		Unlink(image);
+		if (image->page)
+			cOvgAtlas::Release(image);
+		else
+		{
+			vgDestroyImage(image->image);
+			s_bytes -= image->width * image->height * sizeof(tColor);
+		}
+		image->image = VG_INVALID_HANDLE;
+	}
+
+	static void Log(void)
+	{
+		DLOG("[OpenVG] image cache: %d kB (%d kB atlas pages), %d hits, "
+				"%d reloads, %d evictions", Bytes() / 1024,
+				cOvgAtlas::Bytes() / 1024, s_hits, s_reloads, s_evictions);
+	}
+
+	// free GPU memory of the least recently used image by moving it back to
+	// system memory. images of an atlas page only free memory together, so
+	// the whole page is evicted
+	static bool Evict(void)
+	{
+		tOvgImageRef *image = s_lruTail;
+		if (!image)
+			return false;
+
+		if (!image->page)
+			return Evict(image);
+
+		const cOvgAtlasPage *page = image->page;
+		for (tOvgImageRef *next = 0; image; image = next)
+		{
+			next = image->lruPrev;
+			if (image->page == page && !Evict(image))
+				return false;
+		}
+		return true;
+	}
+
+private:
+
+	// GPU memory used by images and atlas pages
+	static int Bytes(void) { return s_bytes + cOvgAtlas::Bytes(); }
+
+	static bool Evict(tOvgImageRef *image)
+	{
+		image->argb = MALLOC(tColor, image->width * image->height);
+		if (!image->argb)
+			return false;
+
+		vgGetImageSubData(image->image, image->argb,
+				image->width * sizeof(tColor), VG_sARGB_8888,
+				0, 0, image->width, image->height);
+
+		Remove(image);
+		s_evictions++;
+
+		DBG("[OpenVG] evicted %dpx x %dpx image, %d kB in use",
+				image->width, image->height, Bytes() / 1024);
+		return true;
+	}
+
+private:
+
+	static void Link(tOvgImageRef *image)
+	{
+		image->lruPrev = 0;
+		image->lruNext = s_lruHead;
+		if (s_lruHead)
+			s_lruHead->lruPrev = image;
+		else
+			s_lruTail = image;
+		s_lruHead = image;
+	}
+
+	static void Unlink(tOvgImageRef *image)
+	{
+		if (image->lruPrev)
+			image->lruPrev->lruNext = image->lruNext;
+		else
+			s_lruHead = image->lruNext;
+
+		if (image->lruNext)
+			image->lruNext->lruPrev = image->lruPrev;
+		else
+			s_lruTail = image->lruPrev;
+
+		image->lruPrev = image->lruNext = 0;
+	}
+
+	static tOvgImageRef *s_lruHead;
+	static tOvgImageRef *s_lruTail;
+
+	static int s_bytes;
+	static int s_hits;
+	static int s_reloads;
+	static int s_evictions;
+};
+
+tOvgImageRef *cOvgImageCache::s_lruHead = 0;
+tOvgImageRef *cOvgImageCache::s_lruTail = 0;
+
+int cOvgImageCache::s_bytes = 0;
+int cOvgImageCache::s_hits = 0;
+int cOvgImageCache::s_reloads = 0;
+int cOvgImageCache::s_evictions = 0;
+
+/* ------------------------------------------------------------------------- */
+
+// pool of scratch images for transient uploads and saved regions. images are
+// allocated in size classes of OVG_SCRATCH_GRANULARITY pixels and handed out
+// as child images of the requested size. larger images, e.g. of full screen
+// updates, are created for each request. only to be used by the OpenVG thread
+
+#define OVG_SCRATCH_GRANULARITY 64
+#define OVG_SCRATCH_MAX_IMAGES  16
+#define OVG_SCRATCH_MAX_POOLED  (1024 * 1024) // max. bytes of a pooled image
+#define OVG_SCRATCH_MAX_BYTES   (16 * 1024 * 1024)
+#define OVG_SCRATCH_IDLE_TIME   5000  // ms until unused images are freed
+#define OVG_SCRATCH_LOG_TIME    10000 // ms between statistics
+
+class cOvgScratch
+{
+public:
+
+	// get an image of w x h pixels, which has to be returned with Release()
+	static VGImage Acquire(int w, int h)
+	{
+		int cw = Round(w);
+		int ch = Round(h);
+
+		if (cw * ch * (int)sizeof(tColor) > OVG_SCRATCH_MAX_POOLED)
+			return CreatePlain(w, h);
+
+		tEntry *entry = 0;
+		for (int i = 0; i < OVG_SCRATCH_MAX_IMAGES && !entry; i++)
+			if (!s_entries[i].used && s_entries[i].image != VG_INVALID_HANDLE
+					&& s_entries[i].width == cw && s_entries[i].height == ch)
+				entry = &s_entries[i];
+
+		if (entry)
+			s_reused++;
+		else
+		{
+			s_created++;
+			if (!(entry = Create(cw, ch)) ||
+					entry->image == VG_INVALID_HANDLE)
+				return CreatePlain(w, h);
+		}
+
+		if (w == cw && h == ch)
+		{
+			entry->used = true;
+			return entry->image;
+		}
+
+		if (entry->child == VG_INVALID_HANDLE ||
+				entry->childWidth != w || entry->childHeight != h)
+		{
+			if (entry->child != VG_INVALID_HANDLE)
+				vgDestroyImage(entry->child);
+
+			entry->child = vgChildImage(entry->image, 0, 0, w, h);
+			entry->childWidth = w;
+			entry->childHeight = h;
+
+			if (entry->child == VG_INVALID_HANDLE)
+			{
+				vgGetError();
+				return CreatePlain(w, h);
+			}
+		}
+		entry->used = true;
+		return entry->child;
+	}
+
+	static void Release(VGImage image)
+	{
+		for (int i = 0; i < OVG_SCRATCH_MAX_IMAGES; i++)
+			if (s_entries[i].used && (s_entries[i].image == image ||
+					s_entries[i].child == image))
+			{
+				s_entries[i].used = false;
+				s_entries[i].lastUsed = cTimeMs::Now();
+				return;
+			}
+
+		// image was not pooled
+		vgDestroyImage(image);
+	}
+
+	// free unused images, either all or the ones idle for a while, returns
+	// true if any image has been freed
+	static bool Trim(bool all)
+	{
+		bool trimmed = false;
+		uint64_t now = cTimeMs::Now();
+		for (int i = 0; i < OVG_SCRATCH_MAX_IMAGES; i++)
+			if (!s_entries[i].used && s_entries[i].image != VG_INVALID_HANDLE
+					&& (all || now - s_entries[i].lastUsed >
+						OVG_SCRATCH_IDLE_TIME))
+			{
+				Destroy(&s_entries[i]);
+				trimmed = true;
+			}
+
+		if (s_logTimer.Elapsed() > OVG_SCRATCH_LOG_TIME)
+		{
+			if (s_reused != s_loggedReused)
+				DBG("[OpenVG] scratch images: %d allocations/s avoided, "
+						"%d created, %d kB pooled",
+						(int)((s_reused - s_loggedReused) * 1000LL /
+								s_logTimer.Elapsed()),
+						s_created, s_bytes / 1024);
+
+			s_loggedReused = s_reused;
+			s_logTimer.Set();
+		}
+		return trimmed;
+	}
+
+	// ms until Trim(false) frees the next unused image, 0 if there's none
+	static int NextTrim(void)
+	{
+		int next = 0;
+		uint64_t now = cTimeMs::Now();
+		for (int i = 0; i < OVG_SCRATCH_MAX_IMAGES; i++)
+			if (!s_entries[i].used && s_entries[i].image != VG_INVALID_HANDLE)
+			{
+				int left = max((int)(s_entries[i].lastUsed +
+						OVG_SCRATCH_IDLE_TIME - now), 1);
+				if (!next || left < next)
+					next = left;
+			}
+
+		return next;
+	}
+
+	static void CleanUp(void)
+	{
+		DLOG("[OpenVG] scratch images: %d reused, %d created",
+				s_reused, s_created);
+
+		for (int i = 0; i < OVG_SCRATCH_MAX_IMAGES; i++)
+			if (s_entries[i].image != VG_INVALID_HANDLE)
+				Destroy(&s_entries[i]);
+	}
+
+private:
+
+	struct tEntry
+	{
+		VGImage image;
+		VGImage child;
+		int width;
+		int height;
+		int childWidth;
+		int childHeight;
+		bool used;
+		uint64_t lastUsed;
+	};
+
+	static int Round(int size)
+	{
+		return (size + OVG_SCRATCH_GRANULARITY - 1) /
+				OVG_SCRATCH_GRANULARITY * OVG_SCRATCH_GRANULARITY;
+	}
+
+	// create an image which is not pooled. if GPU memory is exhausted, all
+	// unused pooled images are freed before trying once more
+	static VGImage CreatePlain(int w, int h)
+	{
+		VGImage image = vgCreateImage(VG_sARGB_8888, w, h,
+				VG_IMAGE_QUALITY_BETTER);
+
+		if (image == VG_INVALID_HANDLE)
+		{
+			vgGetError();
+			if (Trim(true))
+				image = vgCreateImage(VG_sARGB_8888, w, h,
+						VG_IMAGE_QUALITY_BETTER);
+		}
+		return image;
+	}
+
+	// create a pooled image, make room by freeing the least recently used
+	// ones. returns 0 if it can't be pooled
+	static tEntry *Create(int w, int h)
+	{
+		int size = w * h * sizeof(tColor);
+		if (size > OVG_SCRATCH_MAX_BYTES)
+			return 0;
+
+		tEntry *entry = 0;
+		while (!entry || s_bytes + size > OVG_SCRATCH_MAX_BYTES)
+		{
+			tEntry *lru = 0;
+			entry = 0;
+			for (int i = 0; i < OVG_SCRATCH_MAX_IMAGES; i++)
+			{
+				if (s_entries[i].image == VG_INVALID_HANDLE)
+					entry = &s_entries[i];
+				else if (!s_entries[i].used &&
+						(!lru || s_entries[i].lastUsed < lru->lastUsed))
+					lru = &s_entries[i];
+			}
+
+			if (entry && s_bytes + size <= OVG_SCRATCH_MAX_BYTES)
+				break;
+
+			if (!lru)
+				return 0;
+
+			Destroy(lru);
+		}
+
+		entry->image = vgCreateImage(VG_sARGB_8888, w, h,
+				VG_IMAGE_QUALITY_BETTER);
+
+		if (entry->image != VG_INVALID_HANDLE)
+		{
+			entry->width = w;
+			entry->height = h;
+			s_bytes += size;
+		}
+		else
+			vgGetError();
+
+		return entry;
+	}
+
+	static void Destroy(tEntry *entry)
+	{
+		if (entry->child != VG_INVALID_HANDLE)
+			vgDestroyImage(entry->child);
+
+		vgDestroyImage(entry->image);
+		s_bytes -= entry->width * entry->height * sizeof(tColor);
+
+		entry->image = VG_INVALID_HANDLE;
+		entry->child = VG_INVALID_HANDLE;
+		entry->used = false;
+	}
+
+	static tEntry s_entries[OVG_SCRATCH_MAX_IMAGES];
+
+	static int s_bytes;
+	static int s_reused;
+	static int s_created;
+	static int s_loggedReused;
+	static cTimeMs s_logTimer;
 };
 
+cOvgScratch::tEntry cOvgScratch::s_entries[OVG_SCRATCH_MAX_IMAGES];
+
+int cOvgScratch::s_bytes = 0;
+int cOvgScratch::s_reused = 0;
+int cOvgScratch::s_created = 0;
+int cOvgScratch::s_loggedReused = 0;
+cTimeMs cOvgScratch::s_logTimer;
+
 /* ------------------------------------------------------------------------- */
 
 class cOvgSavedRegion
 {
 public:
 
-	cOvgSavedRegion() : image(VG_INVALID_HANDLE), rect(cRect()) { }
+	cOvgSavedRegion() : image(VG_INVALID_HANDLE), pixels(0), rect(cRect()) { }
 	VGImage image;
+	cRasterSurface *pixels;
 	cRect rect;
 };
 
@@ -677,12 +1514,25 @@ public:
 	cOvgRenderTarget(int _width = 0, int _height = 0) :
 		surface(EGL_NO_SURFACE),
 		image(VG_INVALID_HANDLE),
+		pixels(0),
 		width(_width),
-		height(_height),
-		initialized(false) { }
+		height(_height) { }
 
 	virtual ~cOvgRenderTarget() { }
 
+	// surface to draw into with the software backend
+	cRasterSurface *Surface(cOvgSoft *soft)
+	{
+		// if this is the window, check for an update after OSD reset
+		if (!pixels)
+		{
+			width = soft->window->Width();
+			height = soft->window->Height();
+			return soft->window;
+		}
+		return pixels;
+	}
+
 	static bool MakeDefault(cEgl *egl)
 	{
 		if (eglMakeCurrent(egl->display, egl->surface, egl->surface,
@@ -720,11 +1570,11 @@ public:
 		return true;
 	}
 
-	EGLSurface surface;
-	VGImage    image;
-	int        width;
-	int        height;
-	bool       initialized;
+	EGLSurface      surface;
+	VGImage         image;
+	cRasterSurface *pixels;
+	int             width;
+	int             height;
 
 private:
 
@@ -734,6 +1584,151 @@ private:
 
 /* ------------------------------------------------------------------------- */
 
+// completion fence for commands whose result is waited for. it's shared by
+// the waiting thread and the command and deleted with the last reference, so
+// the command can still signal, even if the waiting thread already timed out
+class cOvgFence
+{
+public:
+
+	cOvgFence() : m_signaled(false), m_refs(2) { }
+
+	bool Wait(int timeoutMs)
+	{
+		cTimeMs timer;
+		m_mutex.Lock();
+		while (!m_signaled && timer.Elapsed() < (uint64_t)timeoutMs)
+			m_cond.TimedWait(m_mutex, timeoutMs - timer.Elapsed());
+
+		bool signaled = m_signaled;
+		m_mutex.Unlock();
+
+		Release();
+		return signaled;
+	}
+
+	void Signal(void)
+	{
+		m_mutex.Lock();
+		m_signaled = true;
+		m_cond.Broadcast();
+		m_mutex.Unlock();
+
+		Release();
+	}
+
+private:
+
+	~cOvgFence() { }
+
+	void Release(void)
+	{
+		m_mutex.Lock();
+		bool last = !--m_refs;
+		m_mutex.Unlock();
+
+		if (last)
+			delete this;
+	}
+
+	cMutex m_mutex;
+	cCondVar m_cond;
+	bool m_signaled;
+	int m_refs;
+
+	cOvgFence(const cOvgFence&);
+	cOvgFence& operator= (const cOvgFence&);
+};
+
+// pixel buffer shared by an OSD and the commands drawing from it. the OSD
+// keeps its reference and reuses the buffer once no command holds it anymore,
+// so the pixels are handed to the OpenVG thread without copying them
+class cOvgPixelBuffer
+{
+public:
+
+	cOvgPixelBuffer() : m_data(0), m_size(0), m_refs(1) { }
+
+	tColor *Data(void) { return m_data; }
+
+	bool Busy(void)
+	{
+		cMutexLock MutexLock(&m_mutex);
+		return m_refs > 1;
+	}
+
+	// make room for at least size pixels, discarding the current content
+	bool Reserve(int size)
+	{
+		if (size <= m_size)
+			return true;
+
+		free(m_data);
+		m_data = MALLOC(tColor, size);
+		m_size = m_data ? size : 0;
+		if (!m_data)
+			return false;
+
+		s_allocs++;
+		s_allocBytes += size * sizeof(tColor);
+		return true;
+	}
+
+	cOvgPixelBuffer *Ref(int pixels)
+	{
+		m_mutex.Lock();
+		m_refs++;
+		m_mutex.Unlock();
+
+		s_handOffs++;
+		s_handOffBytes += pixels * sizeof(tColor);
+		return this;
+	}
+
+	void Release(void)
+	{
+		m_mutex.Lock();
+		bool last = !--m_refs;
+		m_mutex.Unlock();
+
+		if (last)
+			delete this;
+	}
+
+	static void Log(void)
+	{
+		DLOG("[OpenVG] pixel buffers: %d allocations (%d kB), "
+				"%d hand-offs (%d kB)",
+				s_allocs, (int)(s_allocBytes / 1024),
+				s_handOffs, (int)(s_handOffBytes / 1024));
+	}
+
+private:
+
+	~cOvgPixelBuffer()
+	{
+		free(m_data);
+	}
+
+	cMutex m_mutex;
+	tColor *m_data;
+	int m_size;
+	int m_refs;
+
+	static int s_allocs;
+	static uint64_t s_allocBytes;
+	static int s_handOffs;
+	static uint64_t s_handOffBytes;
+
+	cOvgPixelBuffer(const cOvgPixelBuffer&);
+	cOvgPixelBuffer& operator= (const cOvgPixelBuffer&);
+};
+
+int cOvgPixelBuffer::s_allocs = 0;
+uint64_t cOvgPixelBuffer::s_allocBytes = 0;
+int cOvgPixelBuffer::s_handOffs = 0;
+uint64_t cOvgPixelBuffer::s_handOffBytes = 0;
+
 class cOvgCmd
 {
 public:
@@ -742,18 +1737,40 @@ public:
 	virtual ~cOvgCmd() { }
 
 	virtual bool Execute(cEgl *egl) = 0;
+	virtual bool Execute(cOvgSoft *soft) = 0;
 	virtual const char* Description(void) = 0;
 
+	// commands are recycled, see cOvgSlabPool
+	static void *operator new(size_t size)
+	{
+		return s_pool.Alloc(size);
+	}
+
+	static void operator delete(void *ptr, size_t size)
+	{
+		s_pool.Free(ptr, size);
+	}
+
+	// must only be called when there are no commands left
+	static void CleanUp(void)
+	{
+		s_pool.CleanUp();
+	}
+
 protected:
 
 	cOvgRenderTarget *m_target;
 
 private:
 
+	static cOvgSlabPool s_pool;
+
 	cOvgCmd(const cOvgCmd&);
 	cOvgCmd& operator= (const cOvgCmd&);
 };
 
+cOvgSlabPool cOvgCmd::s_pool;
+
 class cOvgCmdFlush : public cOvgCmd
 {
 public:
@@ -771,6 +1788,12 @@ public:
 		eglSwapBuffers(egl->display, m_target->surface);
 		return true;
 	}
+
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		soft->Flush();
+		return true;
+	}
 };
 
 class cOvgCmdReset : public cOvgCmd
@@ -789,6 +1812,15 @@ public:
 			cOvgFont::CleanUp();
 			cOvgPaintBox::CleanUp();
 		}
+		cOvgScratch::Trim(true);
+		return false;
+	}
+
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		if (m_cleanup)
+			cOvgFont::CleanUp();
+
 		return false;
 	}
 
@@ -801,7 +1833,13 @@ class cOvgCmdCreatePixelBuffer : public cOvgCmd
 {
 public:
 
-	cOvgCmdCreatePixelBuffer(cOvgRenderTarget *target) : cOvgCmd(target) { }
+	cOvgCmdCreatePixelBuffer(cOvgRenderTarget *target, cOvgFence *fence) :
+		cOvgCmd(target), m_fence(fence) { }
+
+	virtual ~cOvgCmdCreatePixelBuffer()
+	{
+		m_fence->Signal();
+	}
 
 	virtual const char* Description(void) { return "CreatePixelBuffer"; }
 
@@ -810,6 +1848,15 @@ public:
 		m_target->image = vgCreateImage(VG_sARGB_8888, m_target->width,
 				m_target->height, VG_IMAGE_QUALITY_BETTER);
 
+		// pixmaps take precedence over scratch and stored images
+		while (m_target->image == VG_INVALID_HANDLE &&
+				(cOvgScratch::Trim(true) || cOvgImageCache::Evict()))
+		{
+			vgGetError();
+			m_target->image = vgCreateImage(VG_sARGB_8888, m_target->width,
+					m_target->height, VG_IMAGE_QUALITY_BETTER);
+		}
+
 		if (m_target->image == VG_INVALID_HANDLE)
 			ELOG("[OpenVG] failed to allocate %dpx x %dpx pixel buffer!",
 					m_target->width, m_target->height);
@@ -838,9 +1885,27 @@ public:
 				}
 			}
 		}
-		m_target->initialized = true;
 		return true;
 	}
+
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		m_target->pixels = new cRasterSurface(m_target->width,
+				m_target->height);
+
+		if (!m_target->pixels->IsValid())
+		{
+			ELOG("[OpenVG] failed to allocate %dpx x %dpx pixel buffer!",
+					m_target->width, m_target->height);
+			delete m_target->pixels;
+			m_target->pixels = 0;
+		}
+		return true;
+	}
+
+private:
+
+	cOvgFence *m_fence;
 };
 
 class cOvgCmdDestroySurface : public cOvgCmd
@@ -868,6 +1933,13 @@ public:
 		delete m_target;
 		return true;
 	}
+
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		delete m_target->pixels;
+		delete m_target;
+		return true;
+	}
 };
 
 class cOvgCmdClear : public cOvgCmd
@@ -875,7 +1947,11 @@ class cOvgCmdClear : public cOvgCmd
 public:
 
 	cOvgCmdClear(cOvgRenderTarget *target, tColor color = clrTransparent) :
-		cOvgCmd(target), m_color(color) { }
+		cOvgCmd(target), m_rect(cRect::Null), m_color(color) { }
+
+	cOvgCmdClear(cOvgRenderTarget *target, const cRect &rect,
+			tColor color = clrTransparent) :
+		cOvgCmd(target), m_rect(rect), m_color(color) { }
 
 	virtual const char* Description(void) { return "Clear"; }
 
@@ -892,12 +1968,28 @@ public:
 		};
 
 	    vgSetfv(VG_CLEAR_COLOR, 4, color);
-	    vgClear(0, 0, m_target->width, m_target->height);
+		if (m_rect.IsEmpty())
+			vgClear(0, 0, m_target->width, m_target->height);
+		else
+			vgClear(m_rect.X(), m_target->height - m_rect.Y() - m_rect.Height(),
+					m_rect.Width(), m_rect.Height());
+		return true;
+	}
+
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		cRasterSurface *surface = m_target->Surface(soft);
+		if (m_rect.IsEmpty())
+			surface->Fill(0, 0, surface->Width(), surface->Height(), m_color);
+		else
+			surface->Fill(m_rect.X(), m_rect.Y(),
+					m_rect.Width(), m_rect.Height(), m_color);
 		return true;
 	}
 
 private:
 
+	cRect  m_rect;
 	tColor m_color;
 };
 
@@ -918,12 +2010,14 @@ public:
 			return false;
 
 		if (m_savedRegion->image != VG_INVALID_HANDLE)
-			vgDestroyImage(m_savedRegion->image);
+		{
+			cOvgScratch::Release(m_savedRegion->image);
+			m_savedRegion->image = VG_INVALID_HANDLE;
+		}
 
 		if (m_w && m_h)
 		{
-			m_savedRegion->image = vgCreateImage(VG_sARGB_8888,
-					m_w, m_h, VG_IMAGE_QUALITY_BETTER);
+			m_savedRegion->image = cOvgScratch::Acquire(m_w, m_h);
 
 			if (m_savedRegion->image == VG_INVALID_HANDLE)
 			{
@@ -938,6 +2032,32 @@ public:
 		return true;
 	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		cRasterSurface *surface = m_target->Surface(soft);
+
+		delete m_savedRegion->pixels;
+		m_savedRegion->pixels = 0;
+
+		if (m_w && m_h)
+		{
+			cRasterSurface *pixels = new cRasterSurface(m_w, m_h);
+			if (!pixels->IsValid())
+			{
+				ELOG("failed to allocate image!");
+				delete pixels;
+				return true;
+			}
+
+			pixels->Draw(-m_x, -m_y, *surface, 0, 0,
+					surface->Width(), surface->Height());
+
+			m_savedRegion->pixels = pixels;
+			m_savedRegion->rect.Set(m_x, m_y, m_w, m_h);
+		}
+		return true;
+	}
+
 private:
 
 	int m_x;
@@ -970,6 +2090,17 @@ public:
 		return true;
 	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		cRasterSurface *surface = m_target->Surface(soft);
+		if (m_savedRegion && m_savedRegion->pixels)
+			surface->Draw(m_savedRegion->rect.X(), m_savedRegion->rect.Y(),
+					*m_savedRegion->pixels, 0, 0,
+					m_savedRegion->rect.Width(), m_savedRegion->rect.Height());
+
+		return true;
+	}
+
 private:
 
 	cOvgSavedRegion *m_savedRegion;
@@ -989,8 +2120,18 @@ public:
 		if (m_savedRegion)
 		{
 			if (m_savedRegion->image != VG_INVALID_HANDLE)
-				vgDestroyImage(m_savedRegion->image);
+				cOvgScratch::Release(m_savedRegion->image);
+
+			delete m_savedRegion;
+		}
+		return true;
+	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		if (m_savedRegion)
+		{
+			delete m_savedRegion->pixels;
 			delete m_savedRegion;
 		}
 		return true;
@@ -1030,6 +2171,16 @@ public:
 		return true;
 	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		cRasterSurface *surface = m_target->Surface(soft);
+		if (m_alphablend)
+			surface->Blend(m_x, m_y, m_color);
+		else
+			surface->Fill(m_x, m_y, 1, 1, m_color);
+		return true;
+	}
+
 private:
 
 	int m_x;
@@ -1065,6 +2216,12 @@ public:
 		return true;
 	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		m_target->Surface(soft)->Fill(m_x, m_y, m_w, m_h, m_color);
+		return true;
+	}
+
 private:
 
 	int m_x;
@@ -1102,6 +2259,16 @@ public:
 		return true;
 	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		// map unit square with y pointing up to the rectangle
+		soft->path.Clear();
+		soft->path.SetTransform(m_w, 0.0f, 0.0f, -m_h, m_x, m_y + m_h);
+		soft->path.Ellipse(m_quadrants);
+		m_target->Surface(soft)->Fill(soft->path, m_color);
+		return true;
+	}
+
 private:
 
 	int m_x;
@@ -1121,68 +2288,164 @@ public:
 		cOvgCmd(target), m_x(x), m_y(y), m_w(w), m_h(h), m_type(type),
 		m_color(color) { }
 
-	virtual const char* Description(void) { return "DrawSlope"; }
+	virtual const char* Description(void) { return "DrawSlope"; }
+
+	virtual bool Execute(cEgl *egl)
+	{
+		if (!m_target->MakeCurrent(egl))
+			return false;
+
+		vgSeti(VG_MATRIX_MODE, VG_MATRIX_PATH_USER_TO_SURFACE);
+		vgSeti(VG_BLEND_MODE, VG_BLEND_SRC);
+
+		vgLoadIdentity();
+		vgTranslate(m_x, m_target->height - m_h - m_y);
+		vgScale(m_w, m_h);
+
+		cOvgPaintBox::SetColor(m_color);
+		cOvgPaintBox::Draw(cOvgPaintBox::Slope(m_type));
+		return true;
+	}
+
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		soft->path.Clear();
+		soft->path.SetTransform(m_w, 0.0f, 0.0f, -m_h, m_x, m_y + m_h);
+		soft->path.Slope(m_type);
+		m_target->Surface(soft)->Fill(soft->path, m_color);
+		return true;
+	}
+
+private:
+
+	int m_x;
+	int m_y;
+	int m_w;
+	int m_h;
+	int m_type;
+	tColor m_color;
+};
+
+class cOvgCmdDrawText : public cOvgCmd
+{
+public:
+
+	cOvgCmdDrawText(cOvgRenderTarget *target,
+			int x, int y, unsigned int *symbols, int fontId,
+			int fontSize, tColor colorFg,	tColor colorBg, int w, int h,
+			int alignment) :
+		cOvgCmd(target), m_x(x), m_y(y), m_w(w), m_h(h),
+		m_symbols(symbols), m_fontId(fontId), m_fontSize(fontSize),
+		m_colorFg(colorFg), m_colorBg(colorBg),	m_alignment(alignment) { }
+
+	virtual ~cOvgCmdDrawText()
+	{
+		free(m_symbols);
+	}
+
+	virtual const char* Description(void) { return "DrawText"; }
+
+	virtual bool Execute(cEgl *egl)
+	{
+		if (!m_target->MakeCurrent(egl))
+			return false;
+
+		cOvgFont *font = cOvgFont::Get(m_fontId);
+		if (!font)
+			return false;
+
+		cOvgString *string = font->String(m_symbols);
+
+		VGfloat offsetX, offsetY;
+		cRect clip = Layout(string, offsetX, offsetY);
+
+		vgSeti(VG_BLEND_MODE, VG_BLEND_SRC);
+		vgSeti(VG_MATRIX_MODE, VG_MATRIX_GLYPH_USER_TO_SURFACE);
+
+		vgLoadIdentity();
+		vgTranslate(m_x + offsetX,
+				m_target->height - m_y - m_fontSize - offsetY + 1);
+		vgScale(m_fontSize, m_fontSize);
+
+		VGfloat origin[2] = { 0.0f, 0.0f };
+		vgSetfv(VG_GLYPH_ORIGIN, 2, origin);
+
+		cOvgPaintBox::SetScissoring(clip.X(),
+				m_target->height - clip.Bottom() - 1,
+				clip.Width(), clip.Height());
+
+		if (m_colorBg != clrTransparent)
+		{
+			VGfloat color[4] = {
+					(m_colorBg >> 16 & 0xff) / 255.0f,
+					(m_colorBg >>  8 & 0xff) / 255.0f,
+					(m_colorBg       & 0xff) / 255.0f,
+					(m_colorBg >> 24 & 0xff) / 255.0f
+			};
+		    vgSetfv(VG_CLEAR_COLOR, 4, color);
+		    vgClear(0, 0, m_target->width, m_target->height);
+		}
+
+		if (string->Length())
+		{
+			cOvgPaintBox::SetColor(m_colorFg);
+			cOvgPaintBox::Draw(font->Font(), string);
+		}
+
+		cOvgPaintBox::SetScissoring();
+		return true;
+	}
 
-	virtual bool Execute(cEgl *egl)
+	virtual bool Execute(cOvgSoft *soft)
 	{
-		if (!m_target->MakeCurrent(egl))
+		cRasterSurface *surface = m_target->Surface(soft);
+
+		cOvgFont *font = cOvgFont::Get(m_fontId);
+		if (!font)
 			return false;
 
-		vgSeti(VG_MATRIX_MODE, VG_MATRIX_PATH_USER_TO_SURFACE);
-		vgSeti(VG_BLEND_MODE, VG_BLEND_SRC);
+		cOvgString *string = font->String(m_symbols);
 
-		vgLoadIdentity();
-		vgTranslate(m_x, m_target->height - m_h - m_y);
-		vgScale(m_w, m_h);
+		VGfloat offsetX, offsetY;
+		cRect clip = Layout(string, offsetX, offsetY);
 
-		cOvgPaintBox::SetColor(m_color);
-		cOvgPaintBox::Draw(cOvgPaintBox::Slope(m_type));
-		return true;
-	}
+		if (m_colorBg != clrTransparent)
+			surface->Fill(clip.X(), clip.Y(), clip.Width(), clip.Height(),
+					m_colorBg);
 
-private:
+		// place glyph outlines along the base line, with y pointing down
+		VGfloat scale = (VGfloat)m_fontSize / CHAR_HEIGHT;
+		VGfloat x = m_x + offsetX;
+		VGfloat y = m_y + m_fontSize + offsetY - 1;
 
-	int m_x;
-	int m_y;
-	int m_w;
-	int m_h;
-	int m_type;
-	tColor m_color;
-};
+		soft->path.Clear();
+		for (int i = 0; i < string->Length(); i++)
+		{
+			cOvgGlyph *glyph = font->Glyph(string->GlyphIds()[i]);
+			if (!glyph)
+				continue;
 
-class cOvgCmdDrawText : public cOvgCmd
-{
-public:
+			soft->path.SetTransform(scale, 0.0f, 0.0f, -scale, x, y);
+			glyph->AppendOutline(soft->path);
 
-	cOvgCmdDrawText(cOvgRenderTarget *target,
-			int x, int y, unsigned int *symbols, cString *fontName,
-			int fontSize, tColor colorFg,	tColor colorBg, int w, int h,
-			int alignment) :
-		cOvgCmd(target), m_x(x), m_y(y), m_w(w), m_h(h),
-		m_symbols(symbols), m_fontName(fontName), m_fontSize(fontSize),
-		m_colorFg(colorFg), m_colorBg(colorBg),	m_alignment(alignment) { }
+			x += glyph->AdvanceX() * m_fontSize;
+			if (i + 1 < string->Length())
+				x += string->Kerning()[i] * m_fontSize;
+		}
 
-	virtual ~cOvgCmdDrawText()
-	{
-		free(m_symbols);
-		delete m_fontName;
+		surface->Fill(soft->path, m_colorFg,
+				clip.X(), clip.Y(), clip.Width(), clip.Height());
+		return true;
 	}
 
-	virtual const char* Description(void) { return "DrawText"; }
+private:
 
-	virtual bool Execute(cEgl *egl)
+	// offset of the string within the text box and the area to draw to, with
+	// y pointing down
+	cRect Layout(cOvgString *string, VGfloat &offsetX, VGfloat &offsetY)
 	{
-		if (!m_target->MakeCurrent(egl))
-			return false;
-
-		cOvgFont *font = cOvgFont::Get(*m_fontName);
-		if (!font)
-			return false;
-
-		cOvgString *string = new cOvgString(m_symbols, font);
-
-		VGfloat offsetX = 0;
-		VGfloat offsetY = 0;
+		offsetX = 0;
+		offsetY = 0;
 		VGfloat width = string->Width() * (VGfloat)m_fontSize;
 		VGfloat height = string->Height() * (VGfloat)m_fontSize;
 		VGfloat descender = string->Descender() * (VGfloat)m_fontSize;
@@ -1222,58 +2485,21 @@ public:
 			}
 		}
 
-		vgSeti(VG_BLEND_MODE, VG_BLEND_SRC);
-		vgSeti(VG_MATRIX_MODE, VG_MATRIX_GLYPH_USER_TO_SURFACE);
-
-		// some magic offset to conform with VDR's text rendering
-		offsetY -= 0.06f * m_fontSize;
-
-		vgLoadIdentity();
-		vgTranslate(m_x + offsetX,
-				m_target->height - m_y - m_fontSize - offsetY + 1);
-		vgScale(m_fontSize, m_fontSize);
-
-		VGfloat origin[2] = { 0.0f, 0.0f };
-		vgSetfv(VG_GLYPH_ORIGIN, 2, origin);
-
-		cOvgPaintBox::SetScissoring(
-				m_w ? m_x : m_x + floor(offsetX),
-				m_h ? m_target->height - m_y - m_h : m_target->height - m_y -
-						m_fontSize - floor(descender) + 1,
+		cRect clip(m_w ? m_x : m_x + floor(offsetX), m_y,
 				m_w ? m_w : floor(width) + 1,
 				m_h ? m_h : m_fontSize + floor(descender) - 1);
 
-		if (m_colorBg != clrTransparent)
-		{
-			VGfloat color[4] = {
-					(m_colorBg >> 16 & 0xff) / 255.0f,
-					(m_colorBg >>  8 & 0xff) / 255.0f,
-					(m_colorBg       & 0xff) / 255.0f,
-					(m_colorBg >> 24 & 0xff) / 255.0f
-			};
-		    vgSetfv(VG_CLEAR_COLOR, 4, color);
-		    vgClear(0, 0, m_target->width, m_target->height);
-		}
-
-		if (string->Length())
-		{
-			cOvgPaintBox::SetColor(m_colorFg);
-			cOvgPaintBox::Draw(string);
-		}
-
-		cOvgPaintBox::SetScissoring();
-		delete string;
-		return true;
+		// some magic offset to conform with VDR's text rendering
+		offsetY -= 0.06f * m_fontSize;
+		return clip;
 	}
 
-private:
-
 	int m_x;
 	int m_y;
 	int m_w;
 	int m_h;
 	unsigned int *m_symbols;
-	cString *m_fontName;
+	int m_fontId;
 	int m_fontSize;
 	tColor m_colorFg;
 	tColor m_colorBg;
@@ -1316,6 +2542,15 @@ public:
 		return true;
 	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		cRasterSurface *surface = m_target->Surface(soft);
+		if (m_source->pixels)
+			surface->Draw(m_dx, m_dy, *m_source->pixels, m_sx, m_sy,
+					m_w, m_h, m_alpha, true);
+		return true;
+	}
+
 private:
 
 	cOvgRenderTarget *m_source;
@@ -1387,6 +2622,15 @@ public:
 		return true;
 	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		cRasterSurface *surface = m_target->Surface(soft);
+		if (m_source->pixels)
+			surface->DrawPattern(m_dx, m_dy, m_w, m_h, *m_source->pixels,
+					m_dx - m_sx, m_dy - m_sy, m_alpha);
+		return true;
+	}
+
 private:
 
 	cOvgRenderTarget *m_source;
@@ -1420,6 +2664,15 @@ public:
 		return true;
 	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		cRasterSurface *surface = m_target->Surface(soft);
+		if (m_source->pixels)
+			surface->Draw(m_dx, m_dy, *m_source->pixels, m_sx, m_sy,
+					m_w, m_h);
+		return true;
+	}
+
 private:
 
 	cOvgRenderTarget *m_source;
@@ -1452,6 +2705,12 @@ public:
 		return true;
 	}
 
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		m_target->Surface(soft)->Move(m_dx, m_dy, m_sx, m_sy, m_w, m_h);
+		return true;
+	}
+
 private:
 
 	int m_dx;
@@ -1478,20 +2737,29 @@ public:
 
 	virtual bool Execute(cEgl *egl)
 	{
-		m_image->image = vgCreateImage(VG_sARGB_8888, m_w, m_h,
-				VG_IMAGE_QUALITY_BETTER);
+		m_image->width = m_w;
+		m_image->height = m_h;
 
-		if (m_image->image != VG_INVALID_HANDLE)
-			vgImageSubData(m_image->image, m_argb, m_w * sizeof(tColor),
-					VG_sARGB_8888, 0, 0, m_w, m_h);
-		else
+		if (!cOvgImageCache::Upload(m_image, m_argb))
 		{
-			m_image->used = false;
+			// keep pixel data to draw the image without GPU memory
 			ELOG("[OpenVG] failed to allocate %dpx x %dpx image!", m_w, m_h);
+			m_image->argb = m_argb;
+			m_argb = 0;
 		}
 		return true;
 	}
 
+	// images stay in system memory
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		m_image->width = m_w;
+		m_image->height = m_h;
+		m_image->argb = m_argb;
+		m_argb = 0;
+		return true;
+	}
+
 private:
 
 	tOvgImageRef *m_image;
@@ -1511,10 +2779,16 @@ public:
 
 	virtual bool Execute(cEgl *egl)
 	{
-		if (m_image->image != VG_INVALID_HANDLE)
-			vgDestroyImage(m_image->image);
+		cOvgImageCache::Remove(m_image);
+		free(m_image->argb);
+		m_image->argb = 0;
+		return true;
+	}
 
-		m_image->used = false;
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		free(m_image->argb);
+		m_image->argb = 0;
 		return true;
 	}
 
@@ -1527,7 +2801,8 @@ class cOvgCmdDrawImage : public cOvgCmd
 {
 public:
 
-	cOvgCmdDrawImage(cOvgRenderTarget *target, VGImage *image, int x, int y) :
+	cOvgCmdDrawImage(cOvgRenderTarget *target, tOvgImageRef *image,
+			int x, int y) :
 		cOvgCmd(target), m_image(image), m_x(x), m_y(y) { }
 
 	virtual const char* Description(void) { return "DrawImage"; }
@@ -1537,7 +2812,22 @@ public:
 		if (!m_target->MakeCurrent(egl))
 			return false;
 
-		VGint height = vgGetParameteri(*m_image, VG_IMAGE_HEIGHT);
+		if (m_image->image != VG_INVALID_HANDLE)
+			cOvgImageCache::Touch(m_image);
+		else if (m_image->argb)
+			cOvgImageCache::Reload(m_image);
+
+		// image could not be uploaded, write pixels bottom-up instead
+		if (m_image->image == VG_INVALID_HANDLE)
+		{
+			if (m_image->argb)
+				vgWritePixels(m_image->argb +
+						(m_image->height - 1) * m_image->width,
+						-m_image->width * sizeof(tColor), VG_sARGB_8888,
+						m_x, m_target->height - m_image->height - m_y,
+						m_image->width, m_image->height);
+			return true;
+		}
 
 		vgSeti(VG_MATRIX_MODE, VG_MATRIX_IMAGE_USER_TO_SURFACE);
 		vgSeti(VG_IMAGE_MODE, VG_DRAW_IMAGE_NORMAL);
@@ -1545,15 +2835,25 @@ public:
 		vgSeti(VG_BLEND_MODE, VG_BLEND_SRC);
 
 		vgLoadIdentity();
-		vgTranslate(m_x, m_target->height - height - m_y);
+		vgTranslate(m_x, m_target->height - m_image->height - m_y);
+
+		vgDrawImage(m_image->image);
+		return true;
+	}
 
-		vgDrawImage(*m_image);
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		cRasterSurface *surface = m_target->Surface(soft);
+		if (m_image->argb)
+			surface->Draw(m_x, m_y, m_image->argb, m_image->width,
+					m_image->width, m_image->height, 0, 0,
+					m_image->width, m_image->height);
 		return true;
 	}
 
 protected:
 
-	VGImage *m_image;
+	tOvgImageRef *m_image;
 	int m_x;
 	int m_y;
 };
@@ -1566,11 +2866,23 @@ public:
 			int x, int y, int w, int h, tColor *argb,
 			bool overlay = false, double scaleX = 1.0f, double scaleY = 1.0f) :
 		cOvgCmd(target), m_x(x), m_y(y), m_w(w), m_h(h), m_argb(argb),
-		m_overlay(overlay), m_scaleX(scaleX), m_scaleY(scaleY) { }
+		m_buffer(0), m_overlay(overlay), m_scaleX(scaleX), m_scaleY(scaleY) { }
+
+	// draw from offset of a shared pixel buffer, which is released instead
+	// of freed
+	cOvgCmdDrawBitmap(cOvgRenderTarget *target,
+			int x, int y, int w, int h, cOvgPixelBuffer *buffer,
+			int offset = 0) :
+		cOvgCmd(target), m_x(x), m_y(y), m_w(w), m_h(h),
+		m_argb(buffer->Data() + offset), m_buffer(buffer->Ref(w * h)),
+		m_overlay(false), m_scaleX(1.0f), m_scaleY(1.0f) { }
 
 	virtual ~cOvgCmdDrawBitmap()
 	{
-		free(m_argb);
+		if (m_buffer)
+			m_buffer->Release();
+		else
+			free(m_argb);
 	}
 
 	virtual const char* Description(void) { return "DrawBitmap"; }
@@ -1602,8 +2914,7 @@ public:
 		vgTranslate(x, y - m_target->height);
 		vgScale(m_scaleX, m_scaleY);
 
-		VGImage image = vgCreateImage(VG_sARGB_8888, w, h,
-				VG_IMAGE_QUALITY_BETTER);
+		VGImage image = cOvgScratch::Acquire(w, h);
 
 		if (image == VG_INVALID_HANDLE)
 		{
@@ -1618,7 +2929,19 @@ public:
 				m_w * sizeof(tColor), VG_sARGB_8888, 0, 0, w, h);
 		vgDrawImage(image);
 
-		vgDestroyImage(image);
+		cOvgScratch::Release(image);
+		return true;
+	}
+
+	virtual bool Execute(cOvgSoft *soft)
+	{
+		cRasterSurface *surface = m_target->Surface(soft);
+		if (m_scaleX == 1.0f && m_scaleY == 1.0f)
+			surface->Draw(m_x, m_y, m_argb, m_w, m_w, m_h, 0, 0, m_w, m_h,
+					ALPHA_OPAQUE, m_overlay);
+		else
+			surface->DrawScaled(m_x, m_y, m_argb, m_w, m_w, m_h,
+					m_scaleX, m_scaleY, m_overlay);
 		return true;
 	}
 
@@ -1629,6 +2952,7 @@ protected:
 	int m_w;
 	int m_h;
 	tColor *m_argb;
+	cOvgPixelBuffer *m_buffer;
 	bool m_overlay;
 	double m_scaleX;
 	double m_scaleY;
@@ -1636,18 +2960,25 @@ protected:
 
 /* ------------------------------------------------------------------------- */
 
-#define OVG_MAX_OSDIMAGES 256
-#define OVG_CMDQUEUE_SIZE 2048
+#define OVG_IMAGE_CHUNK_SIZE 256 // image handles allocated at once
+#define OVG_MAX_IMAGE_CHUNKS 64
+#define OVG_OOM_FALLBACK_TIME 60 // s to use raw OSD after GPU ran out of memory
+
+// the commands are executed either with OpenVG or, if software rendering is
+// selected, by the CPU rasterizer into a surface in system memory
 
 class cOvgThread : public cThread
 {
 public:
 
-	cOvgThread() :
-		cThread("ovgthread"), m_wait(new cCondWait()), m_stalled(false)
+	cOvgThread(bool software = false, const char *dumpDir = "") :
+		cThread("ovgthread"),
+		m_software(software),
+		m_dumpDir(dumpDir),
+		m_numImageChunks(0),
+		m_freeImages(0),
+		m_outOfMemory(0)
 	{
-		for (int i = 0; i < OVG_MAX_OSDIMAGES; i++)
-			m_images[i].used = false;
 
 		Start();
 	}
@@ -1660,29 +2991,34 @@ public:
 		while (Active())
 			cCondWait::SleepMs(50);
 
-		delete m_wait;
+		// drop commands which have not been executed anymore
+		cOvgCmd *cmd;
+		while (m_commands.Get(cmd))
+			delete cmd;
+
+		cOvgCmd::CleanUp();
+
+		for (int i = 0; i < m_numImageChunks; i++)
+			delete[] m_images[i];
 	}
 
+	// commands are passed through a ring buffer, see cOvgCmdQueue
 	void DoCmd(cOvgCmd* cmd, bool signal = false)
 	{
-		while (m_stalled)
-			cCondWait::SleepMs(10);
-
-		Lock();
-		m_commands.push(cmd);
-		Unlock();
-
-		if (m_commands.size() > OVG_CMDQUEUE_SIZE)
-		{
-			m_stalled = true;
+		if (m_commands.Put(cmd, signal))
 			ILOG("[OpenVG] command queue stalled!");
-		}
+	}
 
-		if (signal || m_stalled)
-			m_wait->Signal();
+	// wake up the OpenVG thread to execute commands queued unsignaled
+	void Wake(void)
+	{
+		m_commands.Signal();
 	}
 
-	virtual int StoreImageData(const cImage &image)
+	// images are uploaded asynchronously by the OpenVG thread, so the handle
+	// can be used right away. when storing several images, the thread may be
+	// signaled with the last one only
+	virtual int StoreImageData(const cImage &image, bool signal = true)
 	{
 		if (image.Width() > m_maxImageSize.Width() ||
 				image.Height() > m_maxImageSize.Height())
@@ -1708,30 +3044,22 @@ public:
 				memcpy(argb, image.Data(),
 						sizeof(tColor) * image.Width() * image.Height());
 
-				tOvgImageRef *imageRef = GetImageRef(imageHandle);
-				DoCmd(new cOvgCmdStoreImage(imageRef,
-						image.Width(), image.Height(), argb), true);
-
-				cTimeMs timer(5000);
-				while (imageRef->used && imageRef->image == VG_INVALID_HANDLE
-						&& !timer.TimedOut())
-					cCondWait::SleepMs(2);
-
-				if (imageRef->image == VG_INVALID_HANDLE)
-				{
-					ELOG("failed to store OSD image! (%s)",	timer.TimedOut() ?
-							"timed out" : "allocation failed");
-					DropImageData(imageHandle);
-					imageHandle = 0;
-				}
+				DoCmd(new cOvgCmdStoreImage(GetImageRef(imageHandle),
+						image.Width(), image.Height(), argb), signal);
 			}
 		}
 		return imageHandle;
 	}
 
+	// the handle may be reused right away, since the image is dropped by the
+	// OpenVG thread before any later command gets executed
 	virtual void DropImageData(int imageHandle)
 	{
-		DoCmd(new cOvgCmdDropImage(GetImageRef(imageHandle)));
+		if (tOvgImageRef *image = GetImageRef(imageHandle))
+		{
+			DoCmd(new cOvgCmdDropImage(image), true);
+			FreeImageHandle(imageHandle);
+		}
 	}
 
 	virtual const cSize &MaxImageSize(void) const
@@ -1739,43 +3067,81 @@ public:
 		return m_maxImageSize;
 	}
 
+	// true if GPU memory has been exhausted recently, new OSDs should be
+	// rendered by VDR then
+	bool IsOutOfMemory(void)
+	{
+		return m_outOfMemory &&
+				time(NULL) - m_outOfMemory < OVG_OOM_FALLBACK_TIME;
+	}
+
 	tOvgImageRef *GetImageRef(int imageHandle)
 	{
 		int i = -imageHandle - 1;
-		if (0 <= i && i < OVG_MAX_OSDIMAGES)
-			return &m_images[i];
-
+		if (0 <= i && i < m_numImageChunks * OVG_IMAGE_CHUNK_SIZE)
+			return &m_images[i / OVG_IMAGE_CHUNK_SIZE]
+							[i % OVG_IMAGE_CHUNK_SIZE];
 		return 0;
 	}
 
 protected:
 
+	// the handle table grows by chunks, so references stay valid
 	virtual int GetFreeImageHandle(void)
 	{
 		Lock();
-		int imageHandle = 0;
-		for (int i = 0; i < OVG_MAX_OSDIMAGES && !imageHandle; i++)
-			if (!m_images[i].used)
+		if (!m_freeImages && m_numImageChunks < OVG_MAX_IMAGE_CHUNKS)
+		{
+			tOvgImageRef *chunk = new tOvgImageRef[OVG_IMAGE_CHUNK_SIZE];
+			for (int i = OVG_IMAGE_CHUNK_SIZE; i--; )
 			{
-				m_images[i].used = true;
-				m_images[i].image = VG_INVALID_HANDLE;
-				imageHandle = -i - 1;
+				chunk[i].image = VG_INVALID_HANDLE;
+				chunk[i].argb = 0;
+				chunk[i].width = 0;
+				chunk[i].height = 0;
+				chunk[i].index = m_numImageChunks * OVG_IMAGE_CHUNK_SIZE + i;
+				chunk[i].lruPrev = 0;
+				chunk[i].lruNext = 0;
+				chunk[i].page = 0;
+				chunk[i].nextFree = m_freeImages;
+				m_freeImages = &chunk[i];
 			}
+			m_images[m_numImageChunks] = chunk;
+			__sync_synchronize();
+			m_numImageChunks++;
+		}
+
+		int imageHandle = 0;
+		if (tOvgImageRef *image = m_freeImages)
+		{
+			m_freeImages = image->nextFree;
+			imageHandle = -image->index - 1;
+		}
 		Unlock();
 		return imageHandle;
 	}
 
 	virtual void FreeImageHandle(int imageHandle)
 	{
-		int i = -imageHandle - 1;
-		if (i >= 0 && i < OVG_MAX_OSDIMAGES)
-			m_images[i].used = false;
+		if (tOvgImageRef *image = GetImageRef(imageHandle))
+		{
+			Lock();
+			image->nextFree = m_freeImages;
+			m_freeImages = image;
+			Unlock();
+		}
 	}
 
 	virtual void Action(void)
 	{
 		DLOG("cOvgThread() thread started");
 
+		if (m_software)
+		{
+			SoftwareAction();
+			return;
+		}
+
 		cEgl egl;
 		egl.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
 
@@ -1856,32 +3222,7 @@ protected:
 			vgSetfv(VG_CLEAR_COLOR, 4, color);
 			vgClear(0, 0, egl.window.width, egl.window.height);
 
-			bool reset = false;
-			while (!reset)
-			{
-				if (m_commands.empty())
-					m_wait->Wait(20);
-				else
-				{
-					Lock();
-					cOvgCmd* cmd = m_commands.front();
-					m_commands.pop();
-					Unlock();
-
-					reset = cmd ? !cmd->Execute(&egl) : true;
-
-					VGErrorCode err = vgGetError();
-					if (cmd && err != VG_NO_ERROR)
-						ELOG("[OpenVG] %s error: %s",
-								cmd->Description(), errStr(err));
-
-					//ELOG("[OpenVG] %s", cmd->Description());
-					delete cmd;
-
-					if (m_stalled && m_commands.size() < OVG_CMDQUEUE_SIZE / 2)
-						m_stalled = false;
-				}
-			}
+			ProcessCommands(&egl, 0);
 
 			if (eglDestroySurface(egl.display, egl.surface) == EGL_FALSE)
 				ELOG("[EGL] failed to destroy surface: %s!",
@@ -1893,9 +3234,16 @@ protected:
 			DLOG("cOvgThread() thread reset");
 		}
 
-		for (int i = 0; i < OVG_MAX_OSDIMAGES; i++)
-			if (m_images[i].used)
-				vgDestroyImage(m_images[i].image);
+		for (int i = 0; i < m_numImageChunks * OVG_IMAGE_CHUNK_SIZE; i++)
+		{
+			tOvgImageRef *image = GetImageRef(-i - 1);
+			cOvgImageCache::Remove(image);
+			free(image->argb);
+			image->argb = 0;
+		}
+		cOvgImageCache::Log();
+		cOvgAtlas::CleanUp();
+		cOvgScratch::CleanUp();
 
 		cOvgFont::CleanUp();
 		cOvgPaintBox::CleanUp();
@@ -1909,6 +3257,90 @@ protected:
 
 private:
 
+	void SoftwareAction(void)
+	{
+		ILOG("[OpenVG] using software rendering%s%s",
+				*m_dumpDir ? ", writing frames to " : "", *m_dumpDir);
+
+		cOvgSoft soft(m_dumpDir);
+		cOvgFont::SetSoftware(true);
+		m_maxImageSize.Set(OVG_SOFT_MAX_IMAGE_SIZE, OVG_SOFT_MAX_IMAGE_SIZE);
+
+		while (Running())
+		{
+			int width, height;
+			cRpiDisplay::GetSize(width, height);
+			soft.window = new cRasterSurface(width, height);
+
+			ProcessCommands(0, &soft);
+
+			delete soft.window;
+			soft.window = 0;
+			DLOG("cOvgThread() thread reset");
+		}
+
+		for (int i = 0; i < m_numImageChunks * OVG_IMAGE_CHUNK_SIZE; i++)
+		{
+			tOvgImageRef *image = GetImageRef(-i - 1);
+			free(image->argb);
+			image->argb = 0;
+		}
+		cOvgFont::CleanUp();
+
+		DLOG("cOvgThread() thread ended");
+	}
+
+	// execute commands with either backend until one requests a reset
+	void ProcessCommands(cEgl *egl, cOvgSoft *soft)
+	{
+		bool reset = false;
+		while (!reset)
+		{
+			cOvgCmd *cmd;
+			if (!m_commands.Get(cmd))
+			{
+				// use idle time to prepare glyphs, then sleep until signaled
+				// or unused scratch images are due to be freed
+				if (!cOvgFont::WarmUp())
+				{
+					int timeout = 0;
+					if (egl)
+					{
+						cOvgScratch::Trim(false);
+						timeout = cOvgScratch::NextTrim();
+					}
+					m_commands.Wait(timeout);
+				}
+			}
+			else
+			{
+				if (!cmd)
+					reset = true;
+				else if (soft)
+				{
+					uint64_t start = cOvgSoft::NowUs();
+					reset = !cmd->Execute(soft);
+					soft->AddBusyTime(cOvgSoft::NowUs() - start);
+				}
+				else
+				{
+					reset = !cmd->Execute(egl);
+
+					VGErrorCode err = vgGetError();
+					if (err != VG_NO_ERROR)
+						ELOG("[OpenVG] %s error: %s",
+								cmd->Description(), errStr(err));
+
+					if (err == VG_OUT_OF_MEMORY_ERROR)
+						m_outOfMemory = time(NULL);
+				}
+
+				//ELOG("[OpenVG] %s", cmd->Description());
+				delete cmd;
+			}
+		}
+	}
+
 	static const char* errStr(VGErrorCode error)
 	{
 		return
@@ -1924,17 +3356,75 @@ private:
 						"unknown error";
 	}
 
-	std::queue<cOvgCmd*> m_commands;
-	cCondWait *m_wait;
-	bool m_stalled;
+	bool m_software;
+	cString m_dumpDir;
 
-	tOvgImageRef m_images[OVG_MAX_OSDIMAGES];
+	cOvgCmdQueue<cOvgCmd*> m_commands;
+
+	tOvgImageRef *m_images[OVG_MAX_IMAGE_CHUNKS];
+	volatile int m_numImageChunks;
+	tOvgImageRef *m_freeImages;
+
+	volatile time_t m_outOfMemory;
 
 	cSize m_maxImageSize;
 };
 
 /* ------------------------------------------------------------------------- */
 
+// conversion of VDR's palette based bitmaps to ARGB
+
+class cOvgBitmap
+{
+public:
+
+	// returns the pixels of the given bitmap area, to be freed by the caller
+	static tColor *Argb(const cBitmap &bitmap, int x1, int y1, int x2, int y2,
+			tColor colorFg = 0, tColor colorBg = 0, bool overlay = false)
+	{
+		int w = x2 - x1 + 1;
+		int h = y2 - y1 + 1;
+		tColor *argb = MALLOC(tColor, w * h);
+		if (!argb)
+			return 0;
+
+		// apply special colors to a copy of the palette, the palette has no
+		// colors at all, if none has been allocated yet
+		int numColors = 1 << bitmap.Bpp();
+		tColor palette[256];
+		int n = 0;
+		const tColor *colors = bitmap.Colors(n);
+		memset(palette, 0, sizeof(palette));
+		if (colors)
+			memcpy(palette, colors, sizeof(tColor) * min(n, numColors));
+
+		if (colorFg || colorBg)
+		{
+			palette[0] = colorBg;
+			palette[1] = colorFg;
+		}
+		if (overlay)
+			palette[0] = clrTransparent;
+
+		// only colors in use count for picking the vector version, e.g. 8 bit
+		// subtitles often use few of them. indices beyond refer to zero
+		// entries of the palette
+		int usedColors = max(min(n, numColors), 2);
+		for (int y = 0; y < h; y++)
+			cPixelKernels::Expand(argb + y * w, bitmap.Data(x1, y1 + y), w,
+					palette, usedColors);
+
+		return argb;
+	}
+};
+
+/* ------------------------------------------------------------------------- */
+
+// maximum number of commands held back per pixmap and of pixels drawn as one
+// bitmap, see cOvgPixmap::Submit()
+#define OVG_PIXMAP_BATCH_SIZE 256
+#define OVG_PIXEL_RUN_SIZE    64
+
 class cOvgPixmap : public cPixmap
 {
 public:
@@ -1944,12 +3434,22 @@ public:
 		cPixmap(Layer, ViewPort, DrawPort),
 		m_ovg(ovg),
 		m_buffer(buffer),
-		m_dirty(false)
+		m_dirty(false),
+		m_visible(false),
+		m_hasRect(false),
+		m_rectColor(0),
+		m_numPixels(0),
+		m_coalesced(0)
 	{ }
 
 	virtual ~cOvgPixmap()
 	{
-		m_ovg->DoCmd(new cOvgCmdDestroySurface(m_buffer));
+		// batched commands would only draw into the buffer to be destroyed
+		for (std::vector<tBatchedCmd>::iterator it = m_batch.begin();
+				it != m_batch.end(); ++it)
+			delete it->cmd;
+
+		m_ovg->DoCmd(new cOvgCmdDestroySurface(m_buffer), true);
 	}
 
 	virtual void SetAlpha(int Alpha)
@@ -1984,7 +3484,8 @@ public:
 	virtual void Clear(void)
 	{
 		LOCK_PIXMAPS;
-		m_ovg->DoCmd(new cOvgCmdClear(m_buffer));
+		Submit(new cOvgCmdClear(m_buffer), cRect(cPoint(0, 0),
+				DrawPort().Size()), true);
 		SetDirty();
 		MarkDrawPortDirty(DrawPort());
 	}
@@ -1992,7 +3493,8 @@ public:
 	virtual void Fill(tColor Color)
 	{
 		LOCK_PIXMAPS;
-		m_ovg->DoCmd(new cOvgCmdClear(m_buffer, Color));
+		Submit(new cOvgCmdClear(m_buffer, Color), cRect(cPoint(0, 0),
+				DrawPort().Size()), true);
 		SetDirty();
 		MarkDrawPortDirty(DrawPort());
 	}
@@ -2007,8 +3509,9 @@ public:
 		memcpy(argb, Image.Data(),
 				sizeof(tColor) * Image.Width() * Image.Height());
 
-		m_ovg->DoCmd(new cOvgCmdDrawBitmap(m_buffer, Point.X(), Point.Y(),
-				Image.Width(), Image.Height(), argb, false));
+		Submit(new cOvgCmdDrawBitmap(m_buffer, Point.X(), Point.Y(),
+				Image.Width(), Image.Height(), argb, false),
+				cRect(Point, Image.Size()), true);
 
 		SetDirty();
 		MarkDrawPortDirty(cRect(Point, cSize(Image.Width(),
@@ -2017,22 +3520,44 @@ public:
 
 	virtual void DrawImage(const cPoint &Point, int ImageHandle)
 	{
+		LOCK_PIXMAPS;
+		// submitted immediately, since the image may be dropped any time
 		if (ImageHandle < 0 && m_ovg->GetImageRef(ImageHandle))
-			m_ovg->DoCmd(new cOvgCmdDrawImage(m_buffer,
-					&m_ovg->GetImageRef(ImageHandle)->image,
-					Point.X(), Point.Y()));
+			Submit(new cOvgCmdDrawImage(m_buffer,
+					m_ovg->GetImageRef(ImageHandle),
+					Point.X(), Point.Y()), cRect::Null, false, true);
 		else
 			if (cRpiOsdProvider::GetImageData(ImageHandle))
 				DrawImage(Point, *cRpiOsdProvider::GetImageData(ImageHandle));
 
 		SetDirty();
+		MarkDrawPortDirty(DrawPort());
 	}
 
 	virtual void DrawPixel(const cPoint &Point, tColor Color)
 	{
 		LOCK_PIXMAPS;
-		m_ovg->DoCmd(new cOvgCmdDrawPixel(m_buffer, Point.X(), Point.Y(),
-				Color, Layer() == 0 && !IS_OPAQUE(Color)));
+		FlushRectangle();
+
+		if (Layer() == 0 && !IS_OPAQUE(Color))
+		{
+			FlushPixels();
+			Queue(new cOvgCmdDrawPixel(m_buffer, Point.X(), Point.Y(),
+					Color, true), cRect(Point, cSize(1, 1)));
+		}
+		else
+		{
+			// collect horizontal runs of pixels to be drawn as one bitmap
+			if (m_numPixels && (m_numPixels == OVG_PIXEL_RUN_SIZE ||
+					Point.Y() != m_pixelsPos.Y() ||
+					Point.X() != m_pixelsPos.X() + m_numPixels))
+				FlushPixels();
+
+			if (!m_numPixels)
+				m_pixelsPos = Point;
+
+			m_pixels[m_numPixels++] = Color;
+		}
 
 		SetDirty();
 		MarkDrawPortDirty(Point);
@@ -2042,23 +3567,15 @@ public:
 			tColor ColorFg = 0, tColor ColorBg = 0, bool Overlay = false)
 	{
 		LOCK_PIXMAPS;
-		bool specialColors = ColorFg || ColorBg;
-		tColor *argb = MALLOC(tColor, Bitmap.Width() * Bitmap.Height());
+		tColor *argb = cOvgBitmap::Argb(Bitmap, 0, 0,
+				Bitmap.Width() - 1, Bitmap.Height() - 1,
+				ColorFg, ColorBg, Overlay);
 		if (!argb)
 			return;
 
-		tColor *p = argb;
-		for (int py = 0; py < Bitmap.Height(); py++)
-			for (int px = 0; px < Bitmap.Width(); px++)
-			{
-				tIndex index = *Bitmap.Data(px, py);
-				*p++ = (!index && Overlay) ? clrTransparent : (specialColors ?
-						(index == 0 ? ColorBg :	index == 1 ? ColorFg :
-								Bitmap.Color(index)) : Bitmap.Color(index));
-			}
-
-		m_ovg->DoCmd(new cOvgCmdDrawBitmap(m_buffer, Point.X(), Point.Y(),
-				Bitmap.Width(), Bitmap.Height(), argb, Overlay));
+		Submit(new cOvgCmdDrawBitmap(m_buffer, Point.X(), Point.Y(),
+				Bitmap.Width(), Bitmap.Height(), argb, Overlay),
+				cRect(Point, cSize(Bitmap.Width(), Bitmap.Height())), !Overlay);
 
 		SetDirty();
 		MarkDrawPortDirty(cRect(Point, cSize(Bitmap.Width(),
@@ -2069,16 +3586,12 @@ public:
 			double FactorX, double FactorY, bool AntiAlias = false)
 	{
 		LOCK_PIXMAPS;
-		tColor *argb = MALLOC(tColor, Bitmap.Width() * Bitmap.Height());
+		tColor *argb = cOvgBitmap::Argb(Bitmap, 0, 0,
+				Bitmap.Width() - 1, Bitmap.Height() - 1);
 		if (!argb)
 			return;
 
-		tColor *p = argb;
-		for (int py = 0; py < Bitmap.Height(); py++)
-			for (int px = 0; px < Bitmap.Width(); px++)
-				*p++ = Bitmap.Color(*Bitmap.Data(px, py));
-
-		m_ovg->DoCmd(new cOvgCmdDrawBitmap(m_buffer, Point.X(), Point.Y(),
+		Submit(new cOvgCmdDrawBitmap(m_buffer, Point.X(), Point.Y(),
 				Bitmap.Width(), Bitmap.Height(), argb, false,
 				FactorX, FactorY));
 
@@ -2104,21 +3617,40 @@ public:
 		else
 			symbols[0] = 0;
 
-		m_ovg->DoCmd(new cOvgCmdDrawText(m_buffer, Point.X(), Point.Y(),
-				symbols, new cString(Font->FontName()), Font->Size(),
-				ColorFg, ColorBg, Width, Height, Alignment));
+		cRect rect(Point.X(), Point.Y(),
+				Width ? Width : DrawPort().Width() - Point.X(),
+				Height ? Height : DrawPort().Height() - Point.Y());
+
+		Submit(new cOvgCmdDrawText(m_buffer, Point.X(), Point.Y(),
+				symbols, cOvgFont::Intern(Font->FontName()), Font->Size(),
+				ColorFg, ColorBg, Width, Height, Alignment), rect);
 
 		SetDirty();
-		MarkDrawPortDirty(cRect(Point.X(), Point.Y(),
-				Width ? Width : DrawPort().Width() - Point.X(),
-				Height ? Height : DrawPort().Height() - Point.Y()));
+		MarkDrawPortDirty(rect);
 	}
 
 	virtual void DrawRectangle(const cRect &Rect, tColor Color)
 	{
 		LOCK_PIXMAPS;
-		m_ovg->DoCmd(new cOvgCmdDrawRectangle(m_buffer,
-				Rect.X(), Rect.Y(),	Rect.Width(), Rect.Height(), Color));
+		FlushPixels();
+
+		// merge with previous rectangle of same color if they share an edge
+		if (m_hasRect && m_rectColor == Color && Adjacent(m_rect, Rect))
+		{
+			int x = min(m_rect.X(), Rect.X());
+			int y = min(m_rect.Y(), Rect.Y());
+			m_rect.Set(x, y,
+					max(m_rect.X() + m_rect.Width(), Rect.X() + Rect.Width()) - x,
+					max(m_rect.Y() + m_rect.Height(), Rect.Y() + Rect.Height()) - y);
+			m_coalesced++;
+		}
+		else
+		{
+			FlushRectangle();
+			m_hasRect = true;
+			m_rect = Rect;
+			m_rectColor = Color;
+		}
 
 		SetDirty();
 		MarkDrawPortDirty(Rect);
@@ -2127,9 +3659,9 @@ public:
 	virtual void DrawEllipse(const cRect &Rect, tColor Color, int Quadrants = 0)
 	{
 		LOCK_PIXMAPS;
-		m_ovg->DoCmd(new cOvgCmdDrawEllipse(m_buffer,
+		Submit(new cOvgCmdDrawEllipse(m_buffer,
 				Rect.X(), Rect.Y(),	Rect.Width(), Rect.Height(),
-				Color, Quadrants));
+				Color, Quadrants), Rect);
 
 		SetDirty();
 		MarkDrawPortDirty(Rect);
@@ -2138,8 +3670,9 @@ public:
 	virtual void DrawSlope(const cRect &Rect, tColor Color, int Type)
 	{
 		LOCK_PIXMAPS;
-		m_ovg->DoCmd(new cOvgCmdDrawSlope(m_buffer,
-				Rect.X(), Rect.Y(),	Rect.Width(), Rect.Height(), Color, Type));
+		Submit(new cOvgCmdDrawSlope(m_buffer,
+				Rect.X(), Rect.Y(),	Rect.Width(), Rect.Height(), Color, Type),
+				Rect);
 
 		SetDirty();
 		MarkDrawPortDirty(Rect);
@@ -2154,9 +3687,12 @@ public:
 
 		if (const cOvgPixmap *pm = dynamic_cast<const cOvgPixmap *>(Pixmap))
 		{
-			m_ovg->DoCmd(new cOvgCmdRenderPixels(m_buffer, pm->m_buffer,
+			// source needs to be complete and must not change before it's read
+			const_cast<cOvgPixmap *>(pm)->SubmitBatch();
+			Submit(new cOvgCmdRenderPixels(m_buffer, pm->m_buffer,
 					Dest.X(), Dest.Y(), Source.X(), Source.Y(),
-					Source.Width(), Source.Height(), pm->Alpha()));
+					Source.Width(), Source.Height(), pm->Alpha()),
+					cRect::Null, false, true);
 
 			SetDirty();
 			MarkDrawPortDirty(DrawPort());
@@ -2169,9 +3705,11 @@ public:
 		LOCK_PIXMAPS;
 		if (const cOvgPixmap *pm = dynamic_cast<const cOvgPixmap *>(Pixmap))
 		{
-			m_ovg->DoCmd(new cOvgCmdCopyPixels(m_buffer, pm->m_buffer,
+			const_cast<cOvgPixmap *>(pm)->SubmitBatch();
+			Submit(new cOvgCmdCopyPixels(m_buffer, pm->m_buffer,
 					Dest.X(), Dest.Y(), Source.X(), Source.Y(),
-					Source.Width(), Source.Height()));
+					Source.Width(), Source.Height()),
+					cRect::Null, false, true);
 
 			SetDirty();
 			MarkDrawPortDirty(DrawPort());
@@ -2189,8 +3727,10 @@ public:
 
 		if (Dest != s.Point())
 		{
-			m_ovg->DoCmd(new cOvgCmdMovePixels(m_buffer, Dest.X(), Dest.Y(),
-					s.X(), s.Y(), s.Width(), s.Height()));
+			// moving reads back the buffer, so nothing before can be dropped
+			Submit(new cOvgCmdMovePixels(m_buffer, Dest.X(), Dest.Y(),
+					s.X(), s.Y(), s.Width(), s.Height()),
+					cRect::Null, false, true);
 
 			if (pan)
 				SetDrawPortPoint(DrawPort().Point().Shifted(s.Point() -	Dest),
@@ -2217,18 +3757,29 @@ public:
 		cRect d = ViewPort().Shifted(left, top);
 		cPoint s = -DrawPort().Point();
 
+		SubmitBatch();
 		m_ovg->DoCmd(new cOvgCmdCopyPixels(target, m_buffer,
 				d.X(), d.Y(), s.X(), s.Y(), d.Width(), d.Height()));
 
 		SetDirty(false);
 	}
 
-	virtual void RenderToTarget(cOvgRenderTarget *target, int left, int top)
+	// renders the part of the view port within clip, returns the pixel count
+	virtual int RenderToTarget(cOvgRenderTarget *target, int left, int top,
+			const cRect &clip)
 	{
 		LOCK_PIXMAPS;
-		cRect d = ViewPort().Shifted(left, top);
-		cPoint s = -DrawPort().Point();
+		cRect v = ViewPort().Intersected(clip);
+		if (v.IsEmpty())
+		{
+			SetDirty(false);
+			return 0;
+		}
+
+		cRect d = v.Shifted(left, top);
+		cPoint s = v.Point() - ViewPort().Point() - DrawPort().Point();
 
+		SubmitBatch();
 		if (Tile())
 			m_ovg->DoCmd(new cOvgCmdRenderPattern(target, m_buffer,
 					d.X(), d.Y(), s.X(), s.Y(), d.Width(), d.Height(),
@@ -2239,20 +3790,154 @@ public:
 					Alpha()));
 
 		SetDirty(false);
+		return d.Width() * d.Height();
 	}
 
 	virtual bool IsDirty(void) { return m_dirty; }
-	virtual void SetDirty(bool dirty = true) { m_dirty = dirty; }
+	virtual void SetDirty(bool dirty = true)
+	{
+		m_dirty = dirty;
+		if (!dirty)
+		{
+			m_visible = Layer() >= 0;
+			SetClean();
+		}
+	}
+
+	// true if the pixmap has been visible at the last flush
+	bool WasVisible(void) { return m_visible; }
+
+	// returns and resets the number of commands saved by coalescing
+	int GetCoalesced(void)
+	{
+		int coalesced = m_coalesced;
+		m_coalesced = 0;
+		return coalesced;
+	}
+
+	// hand over all batched commands to the OpenVG thread
+	void SubmitBatch(void)
+	{
+		FlushPixels();
+		FlushRectangle();
+
+		for (std::vector<tBatchedCmd>::iterator it = m_batch.begin();
+				it != m_batch.end(); ++it)
+			m_ovg->DoCmd(it->cmd);
+
+		m_batch.clear();
+	}
 
 private:
 
 	cOvgPixmap(const cOvgPixmap&);
 	cOvgPixmap& operator= (const cOvgPixmap&);
 
+	// commands are held back until the pixmap gets rendered, so draws which
+	// are overwritten in the meantime can be dropped. commands replacing all
+	// pixels of their rectangle drop any batched command inside that area,
+	// barriers (commands reading back a buffer) submit the batch immediately
+	void Submit(cOvgCmd *cmd, const cRect &rect = cRect::Null,
+			bool replaces = false, bool barrier = false)
+	{
+		FlushPixels();
+		FlushRectangle();
+		Queue(cmd, rect, replaces, barrier);
+	}
+
+	void Queue(cOvgCmd *cmd, const cRect &rect,
+			bool replaces = false, bool barrier = false)
+	{
+		if (replaces && !rect.IsEmpty())
+		{
+			std::vector<tBatchedCmd>::iterator it = m_batch.begin();
+			while (it != m_batch.end())
+			{
+				if (!it->rect.IsEmpty() && rect.Contains(it->rect))
+				{
+					delete it->cmd;
+					it = m_batch.erase(it);
+					m_coalesced++;
+				}
+				else
+					++it;
+			}
+		}
+
+		m_batch.push_back(tBatchedCmd(cmd, rect));
+
+		if (barrier || m_batch.size() >= OVG_PIXMAP_BATCH_SIZE)
+			SubmitBatch();
+	}
+
+	void FlushRectangle(void)
+	{
+		if (m_hasRect)
+		{
+			m_hasRect = false;
+			Queue(new cOvgCmdDrawRectangle(m_buffer, m_rect.X(), m_rect.Y(),
+					m_rect.Width(), m_rect.Height(), m_rectColor), m_rect, true);
+		}
+	}
+
+	void FlushPixels(void)
+	{
+		int n = m_numPixels;
+		m_numPixels = 0;
+
+		if (n == 1)
+			Queue(new cOvgCmdDrawPixel(m_buffer, m_pixelsPos.X(),
+					m_pixelsPos.Y(), m_pixels[0], false),
+					cRect(m_pixelsPos, cSize(1, 1)), true);
+		else if (n > 1)
+		{
+			tColor *argb = MALLOC(tColor, n);
+			if (!argb)
+				return;
+
+			memcpy(argb, m_pixels, sizeof(tColor) * n);
+			Queue(new cOvgCmdDrawBitmap(m_buffer, m_pixelsPos.X(),
+					m_pixelsPos.Y(), n, 1, argb, false),
+					cRect(m_pixelsPos, cSize(n, 1)), true);
+
+			m_coalesced += n - 1;
+		}
+	}
+
+	static bool Adjacent(const cRect &a, const cRect &b)
+	{
+		return (a.Y() == b.Y() && a.Height() == b.Height() &&
+				(a.X() + a.Width() == b.X() || b.X() + b.Width() == a.X())) ||
+			(a.X() == b.X() && a.Width() == b.Width() &&
+				(a.Y() + a.Height() == b.Y() || b.Y() + b.Height() == a.Y()));
+	}
+
+	struct tBatchedCmd
+	{
+		tBatchedCmd(cOvgCmd *_cmd, const cRect &_rect) :
+			cmd(_cmd), rect(_rect) { }
+
+		cOvgCmd *cmd;
+		cRect    rect;
+	};
+
 	cOvgThread       *m_ovg;
 	cOvgRenderTarget *m_buffer;
 
 	bool m_dirty;
+	bool m_visible;
+
+	std::vector<tBatchedCmd> m_batch;
+
+	bool   m_hasRect;
+	cRect  m_rect;
+	tColor m_rectColor;
+
+	cPoint m_pixelsPos;
+	tColor m_pixels[OVG_PIXEL_RUN_SIZE];
+	int    m_numPixels;
+
+	int m_coalesced;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -2272,7 +3957,7 @@ public:
 	{
 		SetActive(false);
 		m_ovg->DoCmd(new cOvgCmdDropRegion(m_savedRegion));
-		m_ovg->DoCmd(new cOvgCmdDestroySurface(m_surface));
+		m_ovg->DoCmd(new cOvgCmdDestroySurface(m_surface), true);
 	}
 
 	virtual eOsdError SetAreas(const tArea *Areas, int NumAreas)
@@ -2328,13 +4013,11 @@ public:
 #endif
 		// create pixel buffer and wait until command has been completed
 		cOvgRenderTarget *buffer = new cOvgRenderTarget(width, height);
-		m_ovg->DoCmd(new cOvgCmdCreatePixelBuffer(buffer), true);
-
-		cTimeMs timer(10000);
-		while (!buffer->initialized && !timer.TimedOut())
-			cCondWait::SleepMs(2);
+		cOvgFence *fence = new cOvgFence();
+		m_ovg->DoCmd(new cOvgCmdCreatePixelBuffer(buffer, fence), true);
 
-		if (buffer->initialized && buffer->image != VG_INVALID_HANDLE)
+		bool done = fence->Wait(10000);
+		if (done && (buffer->image != VG_INVALID_HANDLE || buffer->pixels))
 		{
 			cOvgPixmap *pm = new cOvgPixmap(Layer, m_ovg, buffer,
 					ViewPort, DrawPort);
@@ -2353,8 +4036,8 @@ public:
 		else
 		{
 			ELOG("[OpenVG] failed to create pixmap! (%s)",
-					timer.TimedOut() ? "timed out" : "allocation failed");
-			m_ovg->DoCmd(new cOvgCmdDestroySurface(buffer));
+					done ? "allocation failed" : "timed out");
+			m_ovg->DoCmd(new cOvgCmdDestroySurface(buffer), true);
 		}
 		return NULL;
 	}
@@ -2367,8 +4050,8 @@ public:
 			for (int i = 1; i < m_pixmaps.Size(); i++)
 				if (m_pixmaps[i] == Pixmap)
 				{
-					if (Pixmap->Layer() >= 0)
-						m_pixmaps[0]->SetDirty();
+					if (Pixmap->Layer() >= 0 || m_pixmaps[i]->WasVisible())
+						m_damage.Combine(Pixmap->ViewPort());
 
 					m_pixmaps[i] = NULL;
 					cOsd::DestroyPixmap(Pixmap);
@@ -2508,22 +4191,48 @@ public:
 #endif
 		}
 #else
-		bool dirty = false;
-		for (int i = 0; i < m_pixmaps.Size() && !dirty; i++)
-			if (m_pixmaps[i] &&
-					m_pixmaps[i]->Layer() >= 0 && m_pixmaps[i]->IsDirty())
-				dirty = true;
+		// collect damage of all pixmaps which are or have just been visible
+		cRect damage = m_damage;
+		for (int i = 0; i < m_pixmaps.Size(); i++)
+			if (m_pixmaps[i] && (m_pixmaps[i]->Layer() >= 0 ||
+					m_pixmaps[i]->WasVisible()))
+				damage.Combine(m_pixmaps[i]->DirtyViewPort());
 
-		if (!dirty)
+		m_damage = cRect::Null;
+		if (damage.IsEmpty())
+		{
+			for (int i = 0; i < m_pixmaps.Size(); i++)
+				if (m_pixmaps[i])
+					m_pixmaps[i]->SetDirty(false);
 			return;
+		}
 
-		m_ovg->DoCmd(new cOvgCmdClear(m_surface));
+		// clear and recomposite the damaged area only
+		m_ovg->DoCmd(new cOvgCmdClear(m_surface,
+				damage.Shifted(Left(), Top())));
 
+		int pixels = 0;
 		for (int layer = 0; layer < MAXPIXMAPLAYERS; layer++)
 			for (int i = 0; i < m_pixmaps.Size(); i++)
 				if (m_pixmaps[i])
 					if (m_pixmaps[i]->Layer() == layer)
-						m_pixmaps[i]->RenderToTarget(m_surface, Left(), Top());
+						pixels += m_pixmaps[i]->RenderToTarget(
+								m_surface, Left(), Top(), damage);
+
+		int coalesced = 0;
+		for (int i = 0; i < m_pixmaps.Size(); i++)
+			if (m_pixmaps[i])
+			{
+				coalesced += m_pixmaps[i]->GetCoalesced();
+				if (m_pixmaps[i]->Layer() < 0)
+					m_pixmaps[i]->SetDirty(false);
+			}
+
+		DBG("[OpenVG] %d pixels composited for %dx%d damage",
+				pixels, damage.Width(), damage.Height());
+
+		if (coalesced)
+			DBG("[OpenVG] %d commands coalesced", coalesced);
 #endif
 		m_ovg->DoCmd(new cOvgCmdFlush(m_surface), true);
 		return;
@@ -2539,15 +4248,22 @@ protected:
 			if (!On)
 				Clear();
 			else
+			{
+				// surface has been cleared, so everything needs to be redrawn
+				for (int i = 0; i < m_pixmaps.Size(); i++)
+					if (m_pixmaps[i] && m_pixmaps[i]->Layer() >= 0)
+						m_damage.Combine(m_pixmaps[i]->ViewPort());
+
 				if (GetBitmap(0))
 					Flush();
+			}
 		}
 	}
 
 	virtual void Clear(void)
 	{
 		m_ovg->DoCmd(new cOvgCmdClear(m_surface));
-		m_ovg->DoCmd(new cOvgCmdFlush(m_surface));
+		m_ovg->DoCmd(new cOvgCmdFlush(m_surface), true);
 	}
 
 private:
@@ -2556,6 +4272,220 @@ private:
 	cOvgRenderTarget     *m_surface;
 	cVector<cOvgPixmap *> m_pixmaps;
 	cOvgSavedRegion      *m_savedRegion;
+	cRect                 m_damage;
+};
+
+/* ------------------------------------------------------------------------- */
+
+// software composition of memory pixmaps for the raw OSD. the dirty area is
+// split into bands of rows, which are blended by a small pool of worker
+// threads and the calling thread in parallel
+
+#define OVG_COMPOSER_BAND_HEIGHT 32
+#define OVG_COMPOSER_MAX_WORKERS 3
+#define OVG_RAW_OSD_MAX_DAMAGE   8 // separately updated areas per flush
+
+class cOvgRawPixmap : public cPixmapMemory
+{
+public:
+
+	cOvgRawPixmap(int Layer, const cRect &ViewPort,
+			const cRect &DrawPort = cRect::Null) :
+		cPixmapMemory(Layer, ViewPort, DrawPort) { }
+
+	void Clean(void) { SetClean(); }
+};
+
+class cOvgComposer
+{
+public:
+
+	cOvgComposer() :
+		m_numWorkers(0),
+		m_pixmaps(0),
+		m_numPixmaps(0),
+		m_argb(0),
+		m_nextBand(0),
+		m_numBands(0),
+		m_doneBands(0),
+		m_quit(false)
+	{
+		m_numWorkers = constrain((int)sysconf(_SC_NPROCESSORS_ONLN) - 1,
+				0, OVG_COMPOSER_MAX_WORKERS);
+
+		for (int i = 0; i < m_numWorkers; i++)
+			m_workers[i] = new cWorker(this);
+
+		DLOG("[OpenVG] raw OSD composer using %d worker threads", m_numWorkers);
+	}
+
+	~cOvgComposer()
+	{
+		m_mutex.Lock();
+		m_quit = true;
+		m_job.Broadcast();
+		m_mutex.Unlock();
+
+		for (int i = 0; i < m_numWorkers; i++)
+			delete m_workers[i];
+	}
+
+	// compose pixmaps, ordered by layer, within rect into argb
+	void Compose(cOvgRawPixmap **pixmaps, int numPixmaps, const cRect &rect,
+			tColor *argb)
+	{
+		m_mutex.Lock();
+		m_pixmaps = pixmaps;
+		m_numPixmaps = numPixmaps;
+		m_rect = rect;
+		m_argb = argb;
+		m_nextBand = 0;
+		m_doneBands = 0;
+		m_numBands = (rect.Height() + OVG_COMPOSER_BAND_HEIGHT - 1) /
+				OVG_COMPOSER_BAND_HEIGHT;
+		m_job.Broadcast();
+		m_mutex.Unlock();
+
+		Work();
+
+		m_mutex.Lock();
+		while (m_doneBands < m_numBands)
+			m_done.Wait(m_mutex);
+		m_mutex.Unlock();
+	}
+
+private:
+
+	class cWorker : public cThread
+	{
+	public:
+
+		cWorker(cOvgComposer *composer) :
+			cThread("ovgcomposer"), m_composer(composer)
+		{
+			Start();
+		}
+
+		virtual ~cWorker()
+		{
+			Cancel(3);
+		}
+
+	protected:
+
+		virtual void Action(void)
+		{
+			while (m_composer->WaitForJob())
+				m_composer->Work();
+		}
+
+	private:
+
+		cOvgComposer *m_composer;
+	};
+
+	bool WaitForJob(void)
+	{
+		m_mutex.Lock();
+		while (!m_quit && m_nextBand >= m_numBands)
+			m_job.Wait(m_mutex);
+
+		bool quit = m_quit;
+		m_mutex.Unlock();
+		return !quit;
+	}
+
+	void Work(void)
+	{
+		m_mutex.Lock();
+		while (m_nextBand < m_numBands)
+		{
+			int band = m_nextBand++;
+			m_mutex.Unlock();
+
+			int y0 = band * OVG_COMPOSER_BAND_HEIGHT;
+			int y1 = min(y0 + OVG_COMPOSER_BAND_HEIGHT, m_rect.Height());
+			for (int y = y0; y < y1; y++)
+				ComposeRow(m_argb + y * m_rect.Width(), m_rect.Y() + y);
+
+			m_mutex.Lock();
+			if (++m_doneBands == m_numBands)
+				m_done.Broadcast();
+		}
+		m_mutex.Unlock();
+	}
+
+	// blend all pixmaps of a row with premultiplied alpha
+	void ComposeRow(tColor *dst, int y)
+	{
+		int x1 = m_rect.Left();
+		int x2 = m_rect.Right() + 1;
+		memset(dst, 0, m_rect.Width() * sizeof(tColor));
+
+		for (int i = 0; i < m_numPixmaps; i++)
+		{
+			cOvgRawPixmap *pm = m_pixmaps[i];
+			const cRect &vp = pm->ViewPort();
+			const cRect &dp = pm->DrawPort();
+
+			int x = max(x1, vp.Left());
+			int xe = min(x2, vp.Right() + 1);
+			if (y < vp.Top() || y > vp.Bottom() || x >= xe ||
+					dp.IsEmpty() || pm->Alpha() == ALPHA_TRANSPARENT)
+				continue;
+
+			const tColor *data = (const tColor *)pm->Data();
+			int sy = y - vp.Y() - dp.Y();
+			int sx = x - vp.X() - dp.X();
+
+			if (pm->Tile())
+			{
+				sy = (sy % dp.Height() + dp.Height()) % dp.Height();
+				sx = (sx % dp.Width() + dp.Width()) % dp.Width();
+				while (x < xe)
+				{
+					int n = min(xe - x, dp.Width() - sx);
+					cPixelKernels::BlendRow(dst + x - x1,
+							data + sy * dp.Width() + sx, n, pm->Alpha());
+					x += n;
+					sx = 0;
+				}
+			}
+			else
+			{
+				if (sy < 0 || sy >= dp.Height())
+					continue;
+
+				if (sx < 0)
+				{
+					x -= sx;
+					sx = 0;
+				}
+				xe = min(xe, x + dp.Width() - sx);
+				if (x < xe)
+					cPixelKernels::BlendRow(dst + x - x1,
+							data + sy * dp.Width() + sx, xe - x, pm->Alpha());
+			}
+		}
+		cPixelKernels::Unpremultiply(dst, m_rect.Width());
+	}
+
+	cWorker *m_workers[OVG_COMPOSER_MAX_WORKERS];
+	int m_numWorkers;
+
+	cOvgRawPixmap **m_pixmaps;
+	int m_numPixmaps;
+	cRect m_rect;
+	tColor *m_argb;
+
+	int m_nextBand;
+	int m_numBands;
+	int m_doneBands;
+	bool m_quit;
+
+	cMutex m_mutex;
+	cCondVar m_job;
+	cCondVar m_done;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -2564,16 +4494,26 @@ class cOvgRawOsd : public cOsd
 {
 public:
 
-	cOvgRawOsd(int Left, int Top, uint Level, cOvgThread *ovg) :
+	cOvgRawOsd(int Left, int Top, uint Level, cOvgThread *ovg,
+			cOvgComposer *composer) :
 		cOsd(Left, Top, Level),
 		m_ovg(ovg),
-		m_surface(new cOvgRenderTarget())
-	{ }
+		m_composer(composer),
+		m_surface(new cOvgRenderTarget()),
+		m_nextStaging(0)
+	{
+		m_staging[0] = new cOvgPixelBuffer();
+		m_staging[1] = new cOvgPixelBuffer();
+	}
 
 	virtual ~cOvgRawOsd()
 	{
 		SetActive(false);
-		m_ovg->DoCmd(new cOvgCmdDestroySurface(m_surface));
+		m_ovg->DoCmd(new cOvgCmdDestroySurface(m_surface), true);
+
+		m_staging[0]->Release();
+		m_staging[1]->Release();
+		cOvgPixelBuffer::Log();
 	}
 
 	virtual void Flush(void)
@@ -2584,27 +4524,47 @@ public:
 		if (IsTrueColor())
 		{
 			LOCK_PIXMAPS;
-			while (cPixmapMemory *pm =
-					dynamic_cast<cPixmapMemory *>(RenderPixmaps()))
+			cVector<cOvgRawPixmap *> pixmaps;
+			for (int i = 0; i < m_pixmaps.Size(); i++)
+				if (m_pixmaps[i])
+				{
+					AddDamage(m_pixmaps[i]->DirtyViewPort());
+					m_pixmaps[i]->Clean();
+				}
+
+			for (int layer = 0; layer < MAXPIXMAPLAYERS; layer++)
+				for (int i = 0; i < m_pixmaps.Size(); i++)
+					if (m_pixmaps[i] && m_pixmaps[i]->Layer() == layer)
+						pixmaps.Append(m_pixmaps[i]);
+
+			// all damaged areas are composed into one staging buffer and
+			// uploaded separately
+			int size = 0;
+			for (int i = 0; i < m_damage.Size(); i++)
+				size += m_damage[i].Width() * m_damage[i].Height();
+
+			cOvgPixelBuffer *staging = size ? GetStaging() : 0;
+			if (staging && staging->Reserve(size))
 			{
-				if (tColor* argb = MALLOC(tColor,
-						pm->DrawPort().Width() * pm->DrawPort().Height()))
+				for (int i = 0, offset = 0; i < m_damage.Size(); i++)
 				{
-					memcpy(argb, pm->Data(), sizeof(tColor) *
-							pm->DrawPort().Width() * pm->DrawPort().Height());
+					const cRect &dirty = m_damage[i];
+					tColor *argb = staging->Data() + offset;
+					if (pixmaps.Size())
+						m_composer->Compose(&pixmaps[0], pixmaps.Size(), dirty,
+								argb);
+					else
+						memset(argb, 0,
+								sizeof(tColor) * dirty.Width() * dirty.Height());
 
 					m_ovg->DoCmd(new cOvgCmdDrawBitmap(m_surface,
-							Left() + pm->ViewPort().Left(),
-							Top() + pm->ViewPort().Top(),
-							pm->DrawPort().Width(), pm->DrawPort().Height(),
-							argb));
+							Left() + dirty.Left(), Top() + dirty.Top(),
+							dirty.Width(), dirty.Height(), staging, offset));
+
+					offset += dirty.Width() * dirty.Height();
 				}
-#if APIVERSNUM >= 20110
-				DestroyPixmap(pm);
-#else
-				delete pm;
-#endif
 			}
+			m_damage.Clear();
 		}
 		else
 		{
@@ -2613,20 +4573,14 @@ public:
 				int x1, y1, x2, y2;
 				if (bitmap->Dirty(x1, y1, x2, y2))
 				{
-					int w = x2 - x1 + 1;
-					int h = y2 - y1 + 1;
-					tColor *argb = MALLOC(tColor, w * h);
+					tColor *argb = cOvgBitmap::Argb(*bitmap, x1, y1, x2, y2);
 					if (!argb)
 						return;
 
-					tColor *p = argb;
-					for (int y = y1; y <= y2; ++y)
-						for (int x = x1; x <= x2; ++x)
-							*p++ = bitmap->GetColor(x, y);
-
 					m_ovg->DoCmd(new cOvgCmdDrawBitmap(m_surface,
 							Left() + bitmap->X0() + x1,
-							Top() + bitmap->Y0() + y1, w, h, argb));
+							Top() + bitmap->Y0() + y1,
+							x2 - x1 + 1, y2 - y1 + 1, argb));
 
 					bitmap->Clean();
 				}
@@ -2643,6 +4597,9 @@ public:
 		if (Active())
 			Clear();
 
+		for (int i = 0; i < m_pixmaps.Size(); i++)
+			m_pixmaps[i] = NULL;
+
 		error = cOsd::SetAreas(Areas, NumAreas);
 
 		for (int i = 0; (bitmap = GetBitmap(i)) != NULL; i++)
@@ -2651,6 +4608,40 @@ public:
 		return error;
 	}
 
+	virtual cPixmap *CreatePixmap(int Layer, const cRect &ViewPort,
+			const cRect &DrawPort = cRect::Null)
+	{
+		LOCK_PIXMAPS;
+		cOvgRawPixmap *pm = new cOvgRawPixmap(Layer, ViewPort, DrawPort);
+		if (cOsd::AddPixmap(pm))
+		{
+			for (int i = 0; i < m_pixmaps.Size(); i++)
+				if (!m_pixmaps[i])
+					return m_pixmaps[i] = pm;
+
+			m_pixmaps.Append(pm);
+			return pm;
+		}
+		delete pm;
+		return NULL;
+	}
+
+	virtual void DestroyPixmap(cPixmap *Pixmap)
+	{
+		if (Pixmap)
+		{
+			LOCK_PIXMAPS;
+			for (int i = 1; i < m_pixmaps.Size(); i++)
+				if (m_pixmaps[i] == Pixmap)
+				{
+					AddDamage(Pixmap->ViewPort());
+					m_pixmaps[i] = NULL;
+					cOsd::DestroyPixmap(Pixmap);
+					return;
+				}
+		}
+	}
+
 protected:
 
 	virtual void SetActive(bool On)
@@ -2669,14 +4660,63 @@ protected:
 	virtual void Clear(void)
 	{
 		m_ovg->DoCmd(new cOvgCmdClear(m_surface));
-		m_ovg->DoCmd(new cOvgCmdFlush(m_surface));
+		m_ovg->DoCmd(new cOvgCmdFlush(m_surface), true);
 	}
 
 private:
 
+	// keep damaged areas apart unless they overlap, so unrelated updates,
+	// e.g. of a clock and a progress bar, don't upload all in between
+	void AddDamage(cRect rect)
+	{
+		if (rect.IsEmpty())
+			return;
+
+		for (int i = 0; i < m_damage.Size(); )
+			if (m_damage[i].Intersects(rect))
+			{
+				rect.Combine(m_damage[i]);
+				m_damage.Remove(i);
+				i = 0;
+			}
+			else
+				i++;
+
+		if (m_damage.Size() == OVG_RAW_OSD_MAX_DAMAGE)
+		{
+			for (int i = 0; i < m_damage.Size(); i++)
+				rect.Combine(m_damage[i]);
+			m_damage.Clear();
+		}
+		m_damage.Append(rect);
+	}
+
+	// staging buffers are used alternately. if the OpenVG thread still
+	// draws from both, the older one is left to it and replaced
+	cOvgPixelBuffer *GetStaging(void)
+	{
+		m_nextStaging ^= 1;
+		if (m_staging[m_nextStaging]->Busy() &&
+				m_staging[m_nextStaging ^ 1]->Busy())
+		{
+			m_staging[m_nextStaging]->Release();
+			m_staging[m_nextStaging] = new cOvgPixelBuffer();
+		}
+		else if (m_staging[m_nextStaging]->Busy())
+			m_nextStaging ^= 1;
+
+		return m_staging[m_nextStaging];
+	}
+
 	cOvgThread       *m_ovg;
+	cOvgComposer     *m_composer;
 	cOvgRenderTarget *m_surface;
 
+	cVector<cOvgRawPixmap *> m_pixmaps;
+	cVector<cRect> m_damage;
+
+	cOvgPixelBuffer *m_staging[2];
+	int m_nextStaging;
 };
 
 /* ------------------------------------------------------------------------- */
@@ -2685,26 +4725,39 @@ cRpiOsdProvider* cRpiOsdProvider::s_instance = 0;
 
 cRpiOsdProvider::cRpiOsdProvider() :
 	cOsdProvider(),
-	m_ovg(0)
+	m_ovg(0),
+	m_composer(0)
 {
 	DLOG("new cOsdProvider()");
-	m_ovg = new cOvgThread();
+	cOvgFont::SetCacheDirectory(cPlugin::CacheDirectory(PLUGIN_NAME_I18N));
+	m_ovg = new cOvgThread(cRpiSetup::IsSoftwareOsd(),
+			cRpiSetup::GetSoftwareOsdDir());
 	s_instance = this;
+	PreloadFonts();
 }
 
 cRpiOsdProvider::~cRpiOsdProvider()
 {
 	DLOG("delete cOsdProvider()");
 	s_instance = 0;
+	delete m_composer;
 	delete m_ovg;
 }
 
 cOsd *cRpiOsdProvider::CreateOsd(int Left, int Top, uint Level)
 {
 	if (cRpiSetup::IsHighLevelOsd())
-		return new cOvgOsd(Left, Top, Level, m_ovg);
-	else
-		return new cOvgRawOsd(Left, Top, Level, m_ovg);
+	{
+		if (!m_ovg->IsOutOfMemory())
+			return new cOvgOsd(Left, Top, Level, m_ovg);
+
+		ILOG("[OpenVG] out of GPU memory, using VDR's OSD rendering");
+	}
+	// composer threads are only needed with the raw OSD
+	if (!m_composer)
+		m_composer = new cOvgComposer();
+
+	return new cOvgRawOsd(Left, Top, Level, m_ovg, m_composer);
 }
 
 int cRpiOsdProvider::StoreImageData(const cImage &Image)
@@ -2726,10 +4779,37 @@ const cImage *cRpiOsdProvider::GetImageData(int ImageHandle)
 	return cOsdProvider::GetImageData(ImageHandle);
 }
 
+bool cRpiOsdProvider::StoreImages(int count, const cImage *const *images,
+		int *handles)
+{
+	if (!s_instance)
+		return false;
+
+	// the OpenVG thread is woken up once all images are queued
+	for (int i = 0; i < count; i++)
+	{
+		handles[i] = s_instance->m_ovg->StoreImageData(*images[i], false);
+		if (!handles[i])
+			handles[i] = s_instance->cOsdProvider::StoreImageData(*images[i]);
+	}
+	s_instance->m_ovg->Wake();
+	return true;
+}
+
 void cRpiOsdProvider::ResetOsd(bool cleanup)
 {
 	if (s_instance)
-		s_instance->m_ovg->DoCmd(new cOvgCmdReset(cleanup));
-
+	{
+		s_instance->m_ovg->DoCmd(new cOvgCmdReset(cleanup), true);
+		if (cleanup)
+			PreloadFonts();
+	}
 	UpdateOsdSize(true);
 }
+
+void cRpiOsdProvider::PreloadFonts(void)
+{
+	cOvgFont::Preload(cFont::GetFont(fontOsd)->FontName());
+	cOvgFont::Preload(cFont::GetFont(fontSml)->FontName());
+	cOvgFont::Preload(cFont::GetFont(fontFix)->FontName());
+}
@@ -10,6 +10,20 @@
 #include <vdr/osd.h>
 
 class cOvgThread;
+class cOvgComposer;
+
+// service to store several images at once, e.g. for preloading channel logos.
+// returned handles are valid right away, calling with Data = NULL checks for
+// support
+
+#define RPIHDDEVICE_STORE_IMAGES_SERVICE "RpiHdDevice-StoreImages-v1.0"
+
+struct RpiHdDevice_StoreImages_v1_0
+{
+	int count;                   // in
+	const cImage *const *images; // in
+	int *handles;                // out
+};
 
 class cRpiOsdProvider : public cOsdProvider
 {
@@ -21,6 +35,8 @@ public:
 
 	static void ResetOsd(bool cleanup = false);
 	static const cImage *GetImageData(int ImageHandle);
+	static bool StoreImages(int count, const cImage *const *images,
+			int *handles);
 
 protected:
 
@@ -31,7 +47,10 @@ protected:
 
 private:
 
+	static void PreloadFonts(void);
+
 	cOvgThread *m_ovg;
+	cOvgComposer *m_composer;
 	static cRpiOsdProvider *s_instance;
 };
 
@@ -0,0 +1,258 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+#ifndef OVG_QUEUE_H
+#define OVG_QUEUE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include <new>
+#include <vector>
+
+// Allocation and hand-over of the commands passed to the OpenVG thread. Both
+// only depend on pthreads, so they can be exercised on any host, see
+// bench/ovgbench.c.
+
+// commands are allocated from slabs of fixed size slots, which are recycled
+// instead of being returned to the heap, larger commands use the heap
+#define OVG_CMD_SLOT_SIZE  64
+#define OVG_CMD_SLAB_SLOTS 256
+
+class cOvgSlabPool
+{
+public:
+
+	cOvgSlabPool() : m_free(0)
+	{
+		pthread_mutex_init(&m_mutex, 0);
+	}
+
+	~cOvgSlabPool()
+	{
+		CleanUp();
+		pthread_mutex_destroy(&m_mutex);
+	}
+
+	void *Alloc(size_t size)
+	{
+		if (size > OVG_CMD_SLOT_SIZE)
+			return ::operator new(size);
+
+		pthread_mutex_lock(&m_mutex);
+		if (!m_free)
+		{
+			tSlot *slab = (tSlot *)malloc(sizeof(tSlot) * OVG_CMD_SLAB_SLOTS);
+			if (!slab)
+			{
+				pthread_mutex_unlock(&m_mutex);
+				throw std::bad_alloc();
+			}
+			for (int i = 0; i < OVG_CMD_SLAB_SLOTS - 1; i++)
+				slab[i].next = &slab[i + 1];
+
+			slab[OVG_CMD_SLAB_SLOTS - 1].next = 0;
+			m_free = slab;
+			m_slabs.push_back(slab);
+		}
+		tSlot *slot = m_free;
+		m_free = slot->next;
+		pthread_mutex_unlock(&m_mutex);
+
+		return slot;
+	}
+
+	void Free(void *ptr, size_t size)
+	{
+		if (!ptr)
+			return;
+
+		if (size > OVG_CMD_SLOT_SIZE)
+		{
+			::operator delete(ptr);
+			return;
+		}
+
+		pthread_mutex_lock(&m_mutex);
+		tSlot *slot = static_cast<tSlot*>(ptr);
+		slot->next = m_free;
+		m_free = slot;
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	// must only be called when there are no commands left
+	void CleanUp(void)
+	{
+		pthread_mutex_lock(&m_mutex);
+		for (std::vector<tSlot*>::iterator it = m_slabs.begin();
+				it != m_slabs.end(); ++it)
+			free(*it);
+
+		m_slabs.clear();
+		m_free = 0;
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	int Slabs(void) { return m_slabs.size(); }
+
+private:
+
+	union tSlot
+	{
+		tSlot *next;
+		char data[OVG_CMD_SLOT_SIZE];
+	};
+
+	pthread_mutex_t m_mutex;
+	tSlot *m_free;
+	std::vector<tSlot*> m_slabs;
+
+	cOvgSlabPool(const cOvgSlabPool&);
+	cOvgSlabPool& operator= (const cOvgSlabPool&);
+};
+
+/* ------------------------------------------------------------------------- */
+
+#define OVG_CMDQUEUE_SIZE 2048 // must be a power of two
+
+// commands are handed over to the OpenVG thread through a ring buffer with
+// free running indices, which only needs locking among the producers.
+// if the ring is full, producers block until it's drained to half. the
+// consumer sleeps until it's signaled, so producers need to signal the last
+// command of a sequence
+
+template<class T> class cOvgCmdQueue
+{
+public:
+
+	cOvgCmdQueue() : m_rdIdx(0), m_wrIdx(0), m_stalled(false),
+		m_signaled(false)
+	{
+		pthread_mutex_init(&m_mutex, 0);
+		pthread_cond_init(&m_space, 0);
+		pthread_cond_init(&m_wake, 0);
+	}
+
+	~cOvgCmdQueue()
+	{
+		pthread_cond_destroy(&m_wake);
+		pthread_cond_destroy(&m_space);
+		pthread_mutex_destroy(&m_mutex);
+	}
+
+	// to be called by the producers, the consumer is woken up if signal is
+	// set or the queue is full. returns true if the queue got full
+	bool Put(T cmd, bool signal)
+	{
+		pthread_mutex_lock(&m_mutex);
+		while (m_stalled)
+			pthread_cond_wait(&m_space, &m_mutex);
+
+		m_commands[m_wrIdx & (OVG_CMDQUEUE_SIZE - 1)] = cmd;
+		__sync_synchronize();
+		m_wrIdx++;
+
+		bool stalled = m_wrIdx - m_rdIdx >= OVG_CMDQUEUE_SIZE;
+		if (stalled)
+			m_stalled = true;
+
+		if (signal || m_stalled)
+		{
+			m_signaled = true;
+			pthread_cond_signal(&m_wake);
+		}
+		pthread_mutex_unlock(&m_mutex);
+		return stalled;
+	}
+
+	// to be called by the consumer only, returns false if the queue is empty
+	bool Get(T &cmd)
+	{
+		if (m_rdIdx == m_wrIdx)
+		{
+			// the producer may have decided to stall on an outdated
+			// read index after the queue has been drained already
+			if (m_stalled)
+				Unstall();
+			return false;
+		}
+
+		__sync_synchronize();
+		cmd = m_commands[m_rdIdx & (OVG_CMDQUEUE_SIZE - 1)];
+		__sync_synchronize();
+		m_rdIdx++;
+
+		if (m_stalled && m_wrIdx - m_rdIdx < OVG_CMDQUEUE_SIZE / 2)
+			Unstall();
+
+		return true;
+	}
+
+	// wake up the consumer, e.g. after commands have been put unsignaled
+	void Signal(void)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_signaled = true;
+		pthread_cond_signal(&m_wake);
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	// to be called by the consumer only, waits until a producer signals or
+	// the timeout in ms has expired, without timeout if it's 0
+	void Wait(int timeoutMs)
+	{
+		pthread_mutex_lock(&m_mutex);
+		if (!timeoutMs)
+		{
+			while (!m_signaled)
+				pthread_cond_wait(&m_wake, &m_mutex);
+		}
+		else
+		{
+			struct timeval now;
+			gettimeofday(&now, 0);
+			uint64_t ns = (now.tv_usec + timeoutMs * 1000ULL) * 1000;
+
+			struct timespec abstime;
+			abstime.tv_sec = now.tv_sec + ns / 1000000000;
+			abstime.tv_nsec = ns % 1000000000;
+
+			while (!m_signaled)
+				if (pthread_cond_timedwait(&m_wake, &m_mutex, &abstime))
+					break;
+		}
+		m_signaled = false;
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+private:
+
+	// release producers waiting for space in the command queue
+	void Unstall(void)
+	{
+		pthread_mutex_lock(&m_mutex);
+		m_stalled = false;
+		pthread_cond_broadcast(&m_space);
+		pthread_mutex_unlock(&m_mutex);
+	}
+
+	T m_commands[OVG_CMDQUEUE_SIZE];
+	volatile unsigned int m_rdIdx;
+	volatile unsigned int m_wrIdx;
+
+	pthread_mutex_t m_mutex;
+	pthread_cond_t m_space;
+	pthread_cond_t m_wake;
+	volatile bool m_stalled;
+	bool m_signaled;
+
+	cOvgCmdQueue(const cOvgCmdQueue&);
+	cOvgCmdQueue& operator= (const cOvgCmdQueue&);
+};
+
+#endif
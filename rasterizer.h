@@ -0,0 +1,632 @@
+/*
+ * See the README file for copyright information and how to reach the author.
+ *
+ * $Id$
+ */
+
+#ifndef RASTERIZER_H
+#define RASTERIZER_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <vector>
+
+// CPU rasterizer of the software OSD backend, which draws anti-aliased paths,
+// pixel blocks and patterns into an ARGB surface in memory. like the kernels,
+// it only depends on the CPU, see bench/kernelbench.c
+
+/* ------------------------------------------------------------------------- */
+
+// path flattened to line edges in surface coordinates, with y pointing down.
+// points are given in user coordinates and mapped by the current transform
+
+class cRasterPath
+{
+public:
+
+	cRasterPath()
+	{
+		SetTransform(1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+		Clear();
+	}
+
+	void Clear(void)
+	{
+		m_edges.clear();
+		m_startX = m_startY = m_curX = m_curY = 0.0f;
+		m_minX = m_minY = HUGE_VALF;
+		m_maxX = m_maxY = -HUGE_VALF;
+	}
+
+	// x' = a * x + c * y + e, y' = b * x + d * y + f
+	void SetTransform(float a, float b, float c, float d, float e, float f)
+	{
+		m_matrix[0] = a; m_matrix[1] = b; m_matrix[2] = c;
+		m_matrix[3] = d; m_matrix[4] = e; m_matrix[5] = f;
+	}
+
+	// apply transform to user coordinates before the current one, as
+	// vgTranslate(), vgScale() and vgRotate() do
+	void Transform(float a, float b, float c, float d, float e, float f)
+	{
+		const float *m = m_matrix;
+		SetTransform(
+				m[0] * a + m[2] * b, m[1] * a + m[3] * b,
+				m[0] * c + m[2] * d, m[1] * c + m[3] * d,
+				m[0] * e + m[2] * f + m[4], m[1] * e + m[3] * f + m[5]);
+	}
+
+	void MoveTo(float x, float y)
+	{
+		Close();
+		Map(x, y);
+		m_startX = m_curX = x;
+		m_startY = m_curY = y;
+	}
+
+	void LineTo(float x, float y)
+	{
+		Map(x, y);
+		AddEdge(x, y);
+	}
+
+	void QuadTo(float x1, float y1, float x2, float y2)
+	{
+		Map(x1, y1);
+		Map(x2, y2);
+
+		// the deviation of a chord is below a tenth of a pixel
+		float ddx = m_curX - 2 * x1 + x2;
+		float ddy = m_curY - 2 * y1 + y2;
+		int n = Steps(sqrtf(ddx * ddx + ddy * ddy) * 2.5f);
+
+		float x0 = m_curX, y0 = m_curY;
+		for (int i = 1; i < n; i++)
+		{
+			float t = (float)i / n, u = 1.0f - t;
+			AddEdge(u * u * x0 + 2 * u * t * x1 + t * t * x2,
+					u * u * y0 + 2 * u * t * y1 + t * t * y2);
+		}
+		AddEdge(x2, y2);
+	}
+
+	void CubicTo(float x1, float y1, float x2, float y2, float x3, float y3)
+	{
+		Map(x1, y1);
+		Map(x2, y2);
+		Map(x3, y3);
+
+		float ddx = fmaxf(fabsf(m_curX - 2 * x1 + x2), fabsf(x1 - 2 * x2 + x3));
+		float ddy = fmaxf(fabsf(m_curY - 2 * y1 + y2), fabsf(y1 - 2 * y2 + y3));
+		int n = Steps(sqrtf(ddx * ddx + ddy * ddy) * 7.5f);
+
+		float x0 = m_curX, y0 = m_curY;
+		for (int i = 1; i < n; i++)
+		{
+			float t = (float)i / n, u = 1.0f - t;
+			float a = u * u * u, b = 3 * u * u * t, c = 3 * u * t * t;
+			float d = t * t * t;
+			AddEdge(a * x0 + b * x1 + c * x2 + d * x3,
+					a * y0 + b * y1 + c * y2 + d * y3);
+		}
+		AddEdge(x3, y3);
+	}
+
+	void Close(void)
+	{
+		if (m_curX != m_startX || m_curY != m_startY)
+			AddEdge(m_startX, m_startY);
+	}
+
+	// counterclockwise arc in degrees around cx, cy from the current point,
+	// which is expected at the start of the arc, as drawn by vguArc()
+	void ArcTo(float cx, float cy, float rx, float ry, float start,
+			float extent)
+	{
+		int n = (int)ceilf(fabsf(extent) / 90.0f);
+		float step = extent / n * (float)M_PI / 180.0f;
+		float a0 = start * (float)M_PI / 180.0f;
+		float k = 4.0f / 3.0f * tanf(step / 4);
+
+		for (int i = 0; i < n; i++, a0 += step)
+		{
+			float a1 = a0 + step;
+			float c0 = cosf(a0), s0 = sinf(a0), c1 = cosf(a1), s1 = sinf(a1);
+			CubicTo(cx + rx * (c0 - k * s0), cy + ry * (s0 + k * c0),
+					cx + rx * (c1 + k * s1), cy + ry * (s1 - k * c1),
+					cx + rx * c1, cy + ry * s1);
+		}
+	}
+
+	// shapes within the unit square with y pointing up, the same as those of
+	// cOvgPaintBox for the quadrants and types of VDR's DrawEllipse() and
+	// DrawSlope()
+
+	void Ellipse(int quadrants)
+	{
+		// inverted quadrants are closed via the corner opposite of the center
+		static const float arcs[13][7] = {
+			// center x, y, radius x, y, start, extent, corner x, y
+			{ 0.0f, 1.0f, 1.0f, 1.0f, 270, 1.0f, 0.0f },
+			{ 1.0f, 1.0f, 1.0f, 1.0f, 180, 0.0f, 0.0f },
+			{ 1.0f, 0.0f, 1.0f, 1.0f,  90, 0.0f, 1.0f },
+			{ 0.0f, 0.0f, 1.0f, 1.0f,   0, 1.0f, 1.0f },
+			{ 0.5f, 0.5f, 0.5f, 0.5f,   0, 0.0f, 0.0f },
+			{ 0.0f, 0.0f, 1.0f, 1.0f,   0, 0.0f, 0.0f },
+			{ 1.0f, 0.0f, 1.0f, 1.0f,  90, 0.0f, 0.0f },
+			{ 1.0f, 1.0f, 1.0f, 1.0f, 180, 0.0f, 0.0f },
+			{ 0.0f, 1.0f, 1.0f, 1.0f, 270, 0.0f, 0.0f },
+			{ 0.0f, 0.5f, 1.0f, 0.5f, 270, 0.0f, 0.0f },
+			{ 0.5f, 0.0f, 0.5f, 1.0f,   0, 0.0f, 0.0f },
+			{ 1.0f, 0.5f, 1.0f, 0.5f,  90, 0.0f, 0.0f },
+			{ 0.5f, 1.0f, 0.5f, 1.0f, 180, 0.0f, 0.0f }
+		};
+
+		int i = (quadrants < -4 || quadrants > 8) ? 4 : quadrants + 4;
+		const float *a = arcs[i];
+		float extent = i < 4 ? 90 : i == 4 ? 360 : i < 9 ? 90 : 180;
+		float start = a[4] * (float)M_PI / 180.0f;
+
+		if (i > 4)
+		{
+			// pie, starting at the center
+			MoveTo(a[0], a[1]);
+			LineTo(a[0] + a[2] * cosf(start), a[1] + a[3] * sinf(start));
+		}
+		else
+			MoveTo(a[0] + a[2] * cosf(start), a[1] + a[3] * sinf(start));
+
+		ArcTo(a[0], a[1], a[2], a[3], a[4], extent);
+
+		if (i < 4)
+			LineTo(a[5], a[6]);
+
+		Close();
+	}
+
+	void Slope(int type)
+	{
+		// variants are the basic form translated, scaled and rotated
+		static const float variants[7][5] = {
+			// translation x, y, scale x, y, rotated by 90 degrees
+			{ -1.0f, -1.0f, -1.0f, -1.0f, 0 }, { -1.0f,  0.0f, -1.0f,  1.0f, 0 },
+			{  0.0f, -1.0f,  1.0f, -1.0f, 0 }, { -1.0f, -1.0f, -1.0f,  1.0f, 1 },
+			{  0.0f,  0.0f,  1.0f, -1.0f, 1 }, { -1.0f,  0.0f, -1.0f, -1.0f, 1 },
+			{  0.0f, -1.0f,  1.0f,  1.0f, 1 }
+		};
+
+		float backup[6];
+		memcpy(backup, m_matrix, sizeof(backup));
+
+		if (type > 0 && type < 8)
+		{
+			const float *v = variants[type - 1];
+			if (v[4])
+				Transform(0.0f, 1.0f, -1.0f, 0.0f, 0.0f, 0.0f);
+
+			Transform(v[2], 0.0f, 0.0f, v[3], v[2] * v[0], v[3] * v[1]);
+		}
+
+		// gradient of the slope: VDR uses 0.5 but 0.6 looks nicer...
+		const float s = 0.6f;
+		MoveTo(1.0f, 0.0f);
+		LineTo(1.0f, 1.0f);
+		CubicTo(1.0f - s, 1.0f, s, 0.0f, 0.0f, 0.0f);
+		Close();
+
+		memcpy(m_matrix, backup, sizeof(backup));
+	}
+
+	bool IsEmpty(void) const { return m_edges.empty(); }
+
+private:
+
+	friend class cRasterSurface;
+
+	struct tEdge
+	{
+		float x0, y0, x1, y1;
+	};
+
+	void Map(float &x, float &y) const
+	{
+		float tx = m_matrix[0] * x + m_matrix[2] * y + m_matrix[4];
+		y = m_matrix[1] * x + m_matrix[3] * y + m_matrix[5];
+		x = tx;
+	}
+
+	// number of chords for a curve, given the square of it
+	static int Steps(float n)
+	{
+		n = ceilf(sqrtf(n));
+		return n < 1.0f ? 1 : n > 64.0f ? 64 : (int)n;
+	}
+
+	void AddEdge(float x, float y)
+	{
+		if (y != m_curY)
+		{
+			tEdge e = { m_curX, m_curY, x, y };
+			m_edges.push_back(e);
+
+			m_minX = fminf(m_minX, fminf(m_curX, x));
+			m_maxX = fmaxf(m_maxX, fmaxf(m_curX, x));
+			m_minY = fminf(m_minY, fminf(m_curY, y));
+			m_maxY = fmaxf(m_maxY, fmaxf(m_curY, y));
+		}
+		m_curX = x;
+		m_curY = y;
+	}
+
+	std::vector<tEdge> m_edges;
+	float m_matrix[6];
+	float m_startX, m_startY;
+	float m_curX, m_curY;
+	float m_minX, m_minY, m_maxX, m_maxY;
+};
+
+/* ------------------------------------------------------------------------- */
+
+// ARGB surface with non-premultiplied alpha, as the OpenVG surfaces. all
+// operations are clipped to the surface
+
+class cRasterSurface
+{
+public:
+
+	cRasterSurface(int width, int height) :
+		m_data((uint32_t *)calloc((size_t)width * height, sizeof(uint32_t))),
+		m_width(m_data ? width : 0),
+		m_height(m_data ? height : 0)
+	{ }
+
+	~cRasterSurface()
+	{
+		free(m_data);
+	}
+
+	bool IsValid(void) const { return m_data != 0; }
+
+	int Width(void) const { return m_width; }
+	int Height(void) const { return m_height; }
+
+	      uint32_t *Data(void)       { return m_data; }
+	const uint32_t *Data(void) const { return m_data; }
+
+	void Fill(int x, int y, int w, int h, uint32_t color)
+	{
+		if (!Clip(x, y, w, h))
+			return;
+
+		for (int i = 0; i < h; i++)
+		{
+			uint32_t *p = m_data + (y + i) * m_width + x;
+			for (int j = 0; j < w; j++)
+				p[j] = color;
+		}
+	}
+
+	void Blend(int x, int y, uint32_t color)
+	{
+		if (x >= 0 && y >= 0 && x < m_width && y < m_height)
+			m_data[y * m_width + x] =
+					SrcOver(color, m_data[y * m_width + x], 255);
+	}
+
+	// fill path with non-zero winding and replace the covered pixels, edges
+	// are mixed with the destination by their exact area coverage
+	void Fill(const cRasterPath &path, uint32_t color,
+			int clipX = 0, int clipY = 0, int clipW = -1, int clipH = -1)
+	{
+		if (clipW < 0)
+		{
+			clipW = m_width;
+			clipH = m_height;
+		}
+		if (path.IsEmpty() || !Clip(clipX, clipY, clipW, clipH))
+			return;
+
+		int x0 = (int)fmaxf(floorf(path.m_minX), clipX);
+		int y0 = (int)fmaxf(floorf(path.m_minY), clipY);
+		int x1 = (int)fminf(ceilf(path.m_maxX), clipX + clipW);
+		int y1 = (int)fminf(ceilf(path.m_maxY), clipY + clipH);
+		if (x0 >= x1 || y0 >= y1)
+			return;
+
+		int w = x1 - x0, h = y1 - y0, stride = w + 2;
+		m_cover.assign((size_t)stride * h, 0.0f);
+
+		for (std::vector<cRasterPath::tEdge>::const_iterator e =
+				path.m_edges.begin(); e != path.m_edges.end(); ++e)
+			ClipEdge(e->x0 - x0, e->y0 - y0, e->x1 - x0, e->y1 - y0,
+					w, h, stride);
+
+		for (int y = 0; y < h; y++)
+		{
+			const float *cover = &m_cover[y * stride];
+			uint32_t *p = m_data + (y0 + y) * m_width + x0;
+			float acc = 0.0f;
+			for (int x = 0; x < w; x++)
+			{
+				acc += cover[x];
+				int a = (int)(fminf(fabsf(acc), 1.0f) * 255.0f + 0.5f);
+				if (a == 255)
+					p[x] = color;
+				else if (a)
+					p[x] = Mix(color, p[x], a);
+			}
+		}
+	}
+
+	// draw the w x h pixels at sx, sy of a source with the given stride and
+	// size to dx, dy, either replacing or blending them with layer alpha
+	void Draw(int dx, int dy, const uint32_t *src, int stride,
+			int srcWidth, int srcHeight, int sx, int sy, int w, int h,
+			int alpha = 255, bool blend = false)
+	{
+		// clip to source, then to destination
+		if (sx < 0) { dx -= sx; w += sx; sx = 0; }
+		if (sy < 0) { dy -= sy; h += sy; sy = 0; }
+		w = w < srcWidth - sx ? w : srcWidth - sx;
+		h = h < srcHeight - sy ? h : srcHeight - sy;
+
+		int x = dx, y = dy;
+		if (!Clip(x, y, w, h))
+			return;
+
+		sx += x - dx;
+		sy += y - dy;
+
+		for (int i = 0; i < h; i++)
+		{
+			const uint32_t *s = src + (sy + i) * stride + sx;
+			uint32_t *d = m_data + (y + i) * m_width + x;
+			if (!blend)
+				memmove(d, s, w * sizeof(uint32_t));
+			else
+				for (int j = 0; j < w; j++)
+					d[j] = SrcOver(s[j], d[j], alpha);
+		}
+	}
+
+	void Draw(int dx, int dy, const cRasterSurface &src, int sx, int sy,
+			int w, int h, int alpha = 255, bool blend = false)
+	{
+		Draw(dx, dy, src.m_data, src.m_width, src.m_width, src.m_height,
+				sx, sy, w, h, alpha, blend);
+	}
+
+	// draw w x h source pixels scaled, nearest neighbour
+	void DrawScaled(int dx, int dy, const uint32_t *src, int stride,
+			int w, int h, double scaleX, double scaleY, bool blend = false)
+	{
+		int x = dx, y = dy;
+		int dw = (int)ceil(w * scaleX), dh = (int)ceil(h * scaleY);
+		if (!Clip(x, y, dw, dh))
+			return;
+
+		for (int i = 0; i < dh; i++)
+		{
+			int sy = (int)((y + i - dy + 0.5) / scaleY);
+			if (sy >= h)
+				break;
+
+			const uint32_t *s = src + sy * stride;
+			uint32_t *d = m_data + (y + i) * m_width + x;
+			for (int j = 0; j < dw; j++)
+			{
+				int sx = (int)((x + j - dx + 0.5) / scaleX);
+				if (sx < w)
+					d[j] = blend ? SrcOver(s[sx], d[j], 255) : s[sx];
+			}
+		}
+	}
+
+	// fill rect with the tiled source, whose origin is at ox, oy, blending
+	// it with layer alpha
+	void DrawPattern(int dx, int dy, int w, int h, const cRasterSurface &src,
+			int ox, int oy, int alpha)
+	{
+		if (!src.m_width || !src.m_height || !Clip(dx, dy, w, h))
+			return;
+
+		for (int i = 0; i < h; i++)
+		{
+			int sy = ((dy + i - oy) % src.m_height + src.m_height) %
+					src.m_height;
+			int sx = ((dx - ox) % src.m_width + src.m_width) % src.m_width;
+			const uint32_t *s = src.m_data + sy * src.m_width;
+			uint32_t *d = m_data + (dy + i) * m_width + dx;
+			for (int j = 0; j < w; j++)
+			{
+				d[j] = SrcOver(s[sx], d[j], alpha);
+				if (++sx == src.m_width)
+					sx = 0;
+			}
+		}
+	}
+
+	// copy pixels within the surface, areas may overlap
+	void Move(int dx, int dy, int sx, int sy, int w, int h)
+	{
+		if (dy > sy)
+			for (int i = h; i--; )
+				Draw(dx, dy + i, m_data, m_width, m_width, m_height,
+						sx, sy + i, w, 1);
+		else
+			for (int i = 0; i < h; i++)
+				Draw(dx, dy + i, m_data, m_width, m_width, m_height,
+						sx, sy + i, w, 1);
+	}
+
+	static inline uint32_t Div255(uint32_t x)
+	{
+		return (x + 128 + ((x + 128) >> 8)) >> 8;
+	}
+
+	// linear interpolation of all channels by a
+	static inline uint32_t Mix(uint32_t s, uint32_t d, uint32_t a)
+	{
+		uint32_t ia = 255 - a;
+		return Div255((s >> 24) * a + (d >> 24) * ia) << 24 |
+				Div255((s >> 16 & 0xff) * a + (d >> 16 & 0xff) * ia) << 16 |
+				Div255((s >>  8 & 0xff) * a + (d >>  8 & 0xff) * ia) <<  8 |
+				Div255((s       & 0xff) * a + (d       & 0xff) * ia);
+	}
+
+	// source over destination, both with non-premultiplied alpha
+	static inline uint32_t SrcOver(uint32_t s, uint32_t d, uint32_t alpha)
+	{
+		uint32_t sa = s >> 24;
+		if (alpha != 255)
+			sa = Div255(sa * alpha);
+
+		if (!sa)
+			return d;
+		if (sa == 255)
+			return s;
+
+		uint32_t da = Div255((d >> 24) * (255 - sa));
+		uint32_t a = sa + da;
+		return a << 24 |
+				((s >> 16 & 0xff) * sa + (d >> 16 & 0xff) * da + a / 2) / a << 16 |
+				((s >>  8 & 0xff) * sa + (d >>  8 & 0xff) * da + a / 2) / a <<  8 |
+				((s       & 0xff) * sa + (d       & 0xff) * da + a / 2) / a;
+	}
+
+private:
+
+	cRasterSurface(const cRasterSurface&);
+	cRasterSurface& operator= (const cRasterSurface&);
+
+	bool Clip(int &x, int &y, int &w, int &h) const
+	{
+		if (x < 0) { w += x; x = 0; }
+		if (y < 0) { h += y; y = 0; }
+		if (w > m_width - x) w = m_width - x;
+		if (h > m_height - y) h = m_height - y;
+		return w > 0 && h > 0;
+	}
+
+	// split edge at the left and right border of the coverage buffer. parts
+	// beyond are moved onto the border, where they still add to the winding
+	void ClipEdge(float x0, float y0, float x1, float y1, int w, int h,
+			int stride)
+	{
+		float t[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+		int n = 1;
+		if (x0 != x1)
+			for (int b = 0; b <= w; b += w)
+			{
+				float tb = (b - x0) / (x1 - x0);
+				if (tb > 0.0f && tb < 1.0f)
+					t[n++] = tb;
+			}
+
+		if (n == 3 && t[1] > t[2])
+		{
+			float tmp = t[1];
+			t[1] = t[2];
+			t[2] = tmp;
+		}
+		t[n] = 1.0f;
+
+		float xa = x0, ya = y0;
+		for (int i = 1; i <= n; i++)
+		{
+			float xb = x0 + (x1 - x0) * t[i];
+			float yb = y0 + (y1 - y0) * t[i];
+			if (i == n)
+			{
+				xb = x1;
+				yb = y1;
+			}
+			Accumulate(fminf(fmaxf(xa, 0.0f), (float)w), ya,
+					fminf(fmaxf(xb, 0.0f), (float)w), yb, h, stride);
+			xa = xb;
+			ya = yb;
+		}
+	}
+
+	// add the signed area covered right of the line to the coverage buffer,
+	// based on the accumulation rasterizer of font-rs
+	void Accumulate(float x0, float y0, float x1, float y1, int h,
+			int stride)
+	{
+		if (y0 == y1)
+			return;
+
+		float dir = 1.0f;
+		if (y0 > y1)
+		{
+			dir = -1.0f;
+			float tx = x0, ty = y0;
+			x0 = x1; y0 = y1;
+			x1 = tx; y1 = ty;
+		}
+
+		float dxdy = (x1 - x0) / (y1 - y0);
+		float x = x0;
+		if (y0 < 0.0f)
+			x -= y0 * dxdy;
+
+		int ys = y0 < 0.0f ? 0 : (int)y0;
+		int ye = (int)ceilf(y1) < h ? (int)ceilf(y1) : h;
+
+		for (int y = ys; y < ye; y++)
+		{
+			float *line = &m_cover[y * stride];
+			float dy = fminf(y + 1.0f, y1) - fmaxf((float)y, y0);
+			float xnext = x + dxdy * dy;
+			float d = dy * dir;
+
+			float xa = fminf(x, xnext), xb = fmaxf(x, xnext);
+			float xaFloor = floorf(xa);
+			int xai = (int)xaFloor;
+			int xbi = (int)ceilf(xb);
+
+			if (xbi <= xai + 1)
+			{
+				// within a single pixel
+				float xm = 0.5f * (x + xnext) - xaFloor;
+				line[xai] += d - d * xm;
+				line[xai + 1] += d * xm;
+			}
+			else
+			{
+				float s = 1.0f / (xb - xa);
+				float xaf = xa - xaFloor;
+				float a0 = 0.5f * s * (1.0f - xaf) * (1.0f - xaf);
+				float xbf = xb - xbi + 1.0f;
+				float am = 0.5f * s * xbf * xbf;
+
+				line[xai] += d * a0;
+				if (xbi == xai + 2)
+					line[xai + 1] += d * (1.0f - a0 - am);
+				else
+				{
+					float a1 = s * (1.5f - xaf);
+					line[xai + 1] += d * (a1 - a0);
+					for (int xi = xai + 2; xi < xbi - 1; xi++)
+						line[xi] += d * s;
+
+					float a2 = a1 + (xbi - xai - 3) * s;
+					line[xbi - 1] += d * (1.0f - a2 - am);
+				}
+				line[xbi] += d * am;
+			}
+			x = xnext;
+		}
+	}
+
+	uint32_t *m_data;
+	int m_width;
+	int m_height;
+
+	std::vector<float> m_cover;
+};
+
+#endif
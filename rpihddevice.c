@@ -43,6 +43,10 @@ public:
 	virtual cOsdObject *MainMenuAction(void) { return NULL; }
 	virtual cMenuSetupPage *SetupMenu(void);
 	virtual bool SetupParse(const char *Name, const char *Value);
+	virtual bool Service(const char *Id, void *Data = NULL);
+	virtual const char **SVDRPHelpPages(void);
+	virtual cString SVDRPCommand(const char *Command, const char *Option,
+			int &ReplyCode);
 };
 
 cPluginRpiHdDevice::cPluginRpiHdDevice(void) : 
@@ -92,6 +96,99 @@ bool cPluginRpiHdDevice::SetupParse(const char *Name, const char *Value)
 	return cRpiSetup::GetInstance()->Parse(Name, Value);
 }
 
+bool cPluginRpiHdDevice::Service(const char *Id, void *Data)
+{
+	if (!strcmp(Id, RPIHDDEVICE_STORE_IMAGES_SERVICE))
+	{
+		if (!Data)
+			return cRpiSetup::HasOsd();
+
+		RpiHdDevice_StoreImages_v1_0 *s =
+				static_cast<RpiHdDevice_StoreImages_v1_0 *>(Data);
+		return cRpiOsdProvider::StoreImages(s->count, s->images, s->handles);
+	}
+	return false;
+}
+
+const char **cPluginRpiHdDevice::SVDRPHelpPages(void)
+{
+	static const char *HelpPages[] = {
+		"LATENCY [ <target> [ <correction> ] ]\n"
+		"    Report measured live latency, its target and the current speed\n"
+		"    correction. If given, set latency target in ms (0 for automatic)\n"
+		"    and maximum speed correction in ppm.",
+		"AUDIOQUEUE [ RESET ]\n"
+		"    Report current and maximum depth of the decoded audio frame\n"
+		"    queue and how often it ran dry. If given, reset the statistics.",
+		NULL
+	};
+	return HelpPages;
+}
+
+cString cPluginRpiHdDevice::SVDRPCommand(const char *Command,
+		const char *Option, int &ReplyCode)
+{
+	if (!strcasecmp(Command, "LATENCY"))
+	{
+		cRpiSetup::LatencyParameters latency;
+		latency.target = cRpiSetup::GetLatencyTarget();
+		latency.maxCorrection = cRpiSetup::GetMaxLatencyCorrection();
+
+		if (*Option)
+		{
+			int target, maxCorrection = latency.maxCorrection;
+			int n = sscanf(Option, "%d %d", &target, &maxCorrection);
+			if (n < 1 || target < 0 || target > 5000 ||
+					maxCorrection < 0 || maxCorrection > 1000)
+			{
+				ReplyCode = 501;
+				return "invalid latency parameters";
+			}
+
+			latency.target = target;
+			latency.maxCorrection = maxCorrection;
+			cRpiSetup::GetInstance()->SetLatency(latency);
+
+			SetupStore("LatencyTarget", latency.target);
+			SetupStore("MaxLatencyCorrection", latency.maxCorrection);
+		}
+
+		int measured = 0, target = 0, correction = 0;
+		if (m_device)
+			m_device->GetLatency(measured, target, correction);
+
+		ReplyCode = 900;
+		return cString::sprintf("latency: %dms, target: %dms%s, "
+				"correction: %+dppm (max. %dppm)", measured, target,
+				latency.target ? "" : " (auto)", correction,
+				latency.maxCorrection);
+	}
+	else if (!strcasecmp(Command, "AUDIOQUEUE"))
+	{
+		bool reset = false;
+		if (*Option)
+		{
+			if (strcasecmp(Option, "RESET"))
+			{
+				ReplyCode = 501;
+				return "invalid option";
+			}
+			reset = true;
+		}
+
+		int queued = 0, size = 0, maxQueued = 0, underruns = 0;
+		if (m_device)
+			m_device->GetAudioQueueStats(queued, size, maxQueued, underruns,
+					reset);
+
+		ReplyCode = 900;
+		return cString::sprintf("audio frame queue: %d/%d frames, "
+				"max. %d frames, %d underruns%s", queued, size, maxQueued,
+				underruns, reset ? " (reset)" : "");
+	}
+	return NULL;
+}
+
 bool cPluginRpiHdDevice::ProcessArgs(int argc, char *argv[])
 {
 	return cRpiSetup::GetInstance()->ProcessArgs(argc, argv);
@@ -27,11 +27,13 @@ public:
 	cRpiSetupPage(
 			cRpiSetup::AudioParameters audio,
 			cRpiSetup::VideoParameters video,
-			cRpiSetup::OsdParameters osd) :
+			cRpiSetup::OsdParameters osd,
+			cRpiSetup::LatencyParameters latency) :
 
 		m_audio(audio),
 		m_video(video),
-		m_osd(osd)
+		m_osd(osd),
+		m_latency(latency)
 	{
 		m_audioPort[0] = tr("analog");
 		m_audioPort[1] = tr("HDMI");
@@ -67,11 +69,13 @@ public:
 	eOSState ProcessKey(eKeys Key)
 	{
 		int newAudioPort = m_audio.port;
+		int newAccelerated = m_osd.accelerated;
 		eOSState state = cMenuSetupPage::ProcessKey(Key);
 
 		if (Key != kNone)
 		{
-			if (newAudioPort != m_audio.port)
+			if (newAudioPort != m_audio.port ||
+					newAccelerated != m_osd.accelerated)
 				Setup();
 		}
 
@@ -90,8 +94,12 @@ protected:
 		SetupStore("FrameRate", m_video.frameRate);
 
 		SetupStore("AcceleratedOsd", m_osd.accelerated);
+		SetupStore("OsdImageCache", m_osd.imageCache);
 
-		cRpiSetup::GetInstance()->Set(m_audio, m_video, m_osd);
+		SetupStore("LatencyTarget", m_latency.target);
+		SetupStore("MaxLatencyCorrection", m_latency.maxCorrection);
+
+		cRpiSetup::GetInstance()->Set(m_audio, m_video, m_osd, m_latency);
 }
 
 private:
@@ -125,6 +133,16 @@ private:
 		Add(new cMenuEditBoolItem(
 				tr("Use GPU accelerated OSD"), &m_osd.accelerated));
 
+		if (m_osd.accelerated)
+			Add(new cMenuEditIntItem(tr("OSD Image Cache (MB)"),
+					&m_osd.imageCache, 8, 256));
+
+		Add(new cMenuEditIntItem(tr("Live Latency Target (ms)"),
+				&m_latency.target, 0, 5000, tr("auto")));
+
+		Add(new cMenuEditIntItem(tr("Max. Latency Correction (ppm)"),
+				&m_latency.maxCorrection, 0, 1000));
+
 		SetCurrent(Get(current));
 		Display();
 	}
@@ -132,6 +150,7 @@ private:
 	cRpiSetup::AudioParameters m_audio;
 	cRpiSetup::VideoParameters m_video;
 	cRpiSetup::OsdParameters   m_osd;
+	cRpiSetup::LatencyParameters m_latency;
 
 	const char *m_audioPort[2];
 	const char *m_audioFormat[3];
@@ -282,7 +301,7 @@ void cRpiSetup::SetHDMIChannelMapping(bool passthrough, int channels)
 
 cMenuSetupPage* cRpiSetup::GetSetupPage(void)
 {
-	return new cRpiSetupPage(m_audio, m_video, m_osd);
+	return new cRpiSetupPage(m_audio, m_video, m_osd, m_latency);
 }
 
 bool cRpiSetup::Parse(const char *name, const char *value)
@@ -299,13 +318,19 @@ bool cRpiSetup::Parse(const char *name, const char *value)
 		m_video.frameRate = atoi(value);
 	else if (!strcasecmp(name, "AcceleratedOsd"))
 		m_osd.accelerated = atoi(value);
+	else if (!strcasecmp(name, "OsdImageCache"))
+		m_osd.imageCache = constrain(atoi(value), 8, 256);
+	else if (!strcasecmp(name, "LatencyTarget"))
+		m_latency.target = constrain(atoi(value), 0, 5000);
+	else if (!strcasecmp(name, "MaxLatencyCorrection"))
+		m_latency.maxCorrection = constrain(atoi(value), 0, 1000);
 	else return false;
 
 	return true;
 }
 
 void cRpiSetup::Set(AudioParameters audio, VideoParameters video,
-		OsdParameters osd)
+		OsdParameters osd, LatencyParameters latency)
 {
 	if (audio != m_audio)
 	{
@@ -326,21 +351,32 @@ void cRpiSetup::Set(AudioParameters audio, VideoParameters video,
 		m_osd = osd;
 		cRpiOsdProvider::ResetOsd(false);
 	}
+	else
+		m_osd = osd;
+
+	// latency parameters are polled by device, no need for notification
+	m_latency = latency;
 }
 
 bool cRpiSetup::ProcessArgs(int argc, char *argv[])
 {
 	static struct option long_options[] = {
-			{ "disable-osd", no_argument, NULL, 'd' },
+			{ "disable-osd",  no_argument,       NULL, 'd' },
+			{ "software-osd", optional_argument, NULL, 's' },
+			{ 0, 0, 0, 0 }
 	};
 	int c;
-	while ((c = getopt_long(argc, argv, "d", long_options, NULL)) != -1)
+	while ((c = getopt_long(argc, argv, "ds::", long_options, NULL)) != -1)
 	{
 		switch (c)
 		{
 		case 'd':
 			m_plugin.hasOsd = false;
 			break;
+		case 's':
+			m_plugin.softwareOsd = true;
+			m_plugin.softwareOsdDir = optarg ? optarg : "";
+			break;
 		default:
 			return false;
 		}
@@ -350,5 +386,8 @@ bool cRpiSetup::ProcessArgs(int argc, char *argv[])
 
 const char *cRpiSetup::CommandLineHelp(void)
 {
-	return "  -d,       --disable-osd  disable OSD\n";
+	return "  -d,       --disable-osd  disable OSD\n"
+			"  -s[DIR],  --software-osd[=DIR]\n"
+			"                           render OSD by the CPU instead of the GPU\n"
+			"                           and write each frame to DIR, if given\n";
 }
@@ -7,6 +7,8 @@
 #ifndef SETUP_H
 #define SETUP_H
 
+#include <vdr/tools.h>
+
 #include "omx.h"
 #include "tools.h"
 
@@ -49,21 +51,38 @@ public:
 	struct OsdParameters
 	{
 		OsdParameters() :
-			accelerated(1) { }
+			accelerated(1),
+			imageCache(64) { }
 
 		int accelerated;
+		int imageCache;
 
+		// image cache size is applied without resetting the OSD
 		bool operator!=(const OsdParameters& a) {
 			return (a.accelerated != accelerated);
 		}
 	};
 
+	struct LatencyParameters
+	{
+		LatencyParameters() :
+			target(0),
+			maxCorrection(150) { }
+
+		int target;
+		int maxCorrection;
+	};
+
 	struct PluginParameters
 	{
 		PluginParameters() :
-			hasOsd(true) { }
+			hasOsd(true),
+			softwareOsd(false),
+			softwareOsdDir("") { }
 
 		bool hasOsd;
+		bool softwareOsd;
+		cString softwareOsdDir;
 	};
 
 	static bool HwInit(void);
@@ -117,10 +136,35 @@ public:
 		return GetInstance()->m_osd.accelerated != 0;
 	}
 
+	// GPU memory budget for OSD images in MB
+	static int GetOsdImageCacheSize(void) {
+		return GetInstance()->m_osd.imageCache;
+	}
+
 	static bool HasOsd(void) {
 		return GetInstance()->m_plugin.hasOsd;
 	}
 
+	// render OSD by the CPU instead of OpenVG, e.g. for benchmarking skins
+	static bool IsSoftwareOsd(void) {
+		return GetInstance()->m_plugin.softwareOsd;
+	}
+
+	// directory to write the frames of the software OSD to, may be empty
+	static const char *GetSoftwareOsdDir(void) {
+		return GetInstance()->m_plugin.softwareOsdDir;
+	}
+
+	// live mode latency target in ms, 0 for automatic
+	static int GetLatencyTarget(void) {
+		return GetInstance()->m_latency.target;
+	}
+
+	// maximum clock speed correction in ppm
+	static int GetMaxLatencyCorrection(void) {
+		return GetInstance()->m_latency.maxCorrection;
+	}
+
 	static void SetHDMIChannelMapping(bool passthrough, int channels);
 
 	static cRpiSetup* GetInstance(void);
@@ -129,7 +173,10 @@ public:
 	class cMenuSetupPage* GetSetupPage(void);
 	bool Parse(const char *name, const char *value);
 
-	void Set(AudioParameters audio, VideoParameters video, OsdParameters osd);
+	void Set(AudioParameters audio, VideoParameters video, OsdParameters osd,
+			LatencyParameters latency);
+
+	void SetLatency(LatencyParameters latency) { m_latency = latency; }
 
 	static void SetAudioSetupChangedCallback(void (*callback)(void*), void* data = 0);
 	static void SetVideoSetupChangedCallback(void (*callback)(void*), void* data = 0);
@@ -154,6 +201,7 @@ private:
 	AudioParameters  m_audio;
 	VideoParameters  m_video;
 	OsdParameters    m_osd;
+	LatencyParameters m_latency;
 	PluginParameters m_plugin;
 
 	bool m_mpeg2Enabled;